@@ -1,7 +1,9 @@
 #pragma once
 #include <orient/pred_tree/async_job.hpp>
 #include <orient/fs/data_iter.hpp>
+#include <orient/fs/watcher.hpp>
 #include <cassert>
+#include <algorithm>
 
 namespace orie {
 
@@ -9,10 +11,25 @@ using fsearch_expr = orie::pred_tree::node<fs_data_iter, sv_t>;
 
 class app {
     bool _auto_update_stopped = false;
+    // An auto update is due now; guarded by `_paths_mut`
+    bool _update_requested = false;
 
     str_t _conf_path;
     std::vector<str_t> _start_paths;
+    // Database of the root path, which also holds special paths
     std::shared_ptr<dmp::dumper> _dumper;
+    // Databases of shard roots, usually mount points of other devices,
+    // rebuilt in parallel with `_dumper` and excluded from it
+    std::vector<std::shared_ptr<dmp::dumper>> _shards;
+    // Changes since last updatedb, recorded by `_watcher`
+    std::shared_ptr<dmp::delta_segment> _delta;
+    std::unique_ptr<dmp::fs_watcher> _watcher;
+    // Where hot copies of forward indexes are kept; none if unset
+    std::optional<str_t> _hot_index;
+    // Whether auto updates watch the filesystem in between
+    bool _watch = false;
+    // See `set_query_window`
+    unsigned _query_window = 0;
 
 public:
     // Since _pool is a reference which cannot be modified to point to
@@ -26,6 +43,8 @@ private:
     std::condition_variable _auto_update_cv;
 
     void handle_connection_impl(int connfd);
+    // Database path of the shard rooted at `root`
+    str_t shard_db_path(const str_t& root) const;
 
 public:
     static app os_default(fifo_thpool& pool);
@@ -36,38 +55,95 @@ public:
     // app& read_db(str_t path = str_t());
 
     // Scan filesystem, update database and write to the db file
-    app& update_db();
+    // If `incremental`, listings of directories unchanged since last
+    // update are copied from current database instead of read from disk.
+    // Shards are rebuilt in parallel; those failed keep their old data,
+    // and the errors are thrown after the others are updated.
+    app& update_db(bool incremental = false);
     app& set_db_path(const char_t* path);
 
-    // Auto updating
+    // Auto updating. Also watches the filesystem in between if `set_watch`
+    // or the WATCH conf key is on, and stops watching when stopped.
     template <class Rep, class Period>
     app& start_auto_update(const std::chrono::duration<Rep, Period>& interval,
                            bool update_immediate);
     // CANNOT BE CALLED SIMUTANEOUSLY ON MULTIPLE THREADS!
     app& stop_auto_update();
 
+    // Watch the filesystem under root path so that files created or deleted
+    // after last updatedb are reflected in `run` and `get_jobs` results.
+    // Return false if watching is unsupported or not permitted.
+    // CANNOT BE CALLED SIMUTANEOUSLY ON MULTIPLE THREADS!
+    bool start_watching();
+    // Stop watching and forget recorded changes
+    app& stop_watching();
+    // Whether auto updates start watching; takes effect on the next one
+    app& set_watch(bool on) noexcept { _watch = on; return *this; }
+    // Changes recorded since last updatedb; nullptr if not watching.
+    // Iterators of the databases skip entries deleted here, and `get_jobs`
+    // adds jobs over entries created here. Once it has overflowed, jobs
+    // use the databases alone until next updatedb, which `get_jobs` asks
+    // auto updates to run at once.
+    const std::shared_ptr<dmp::delta_segment>& delta() const noexcept {
+        return _delta;
+    }
+
     // Set special paths; thread safe
     app& add_ignored_path(str_t path);
     app& erase_ignored_path(const str_t& path);
     app& add_slow_path(str_t path);
     app& erase_slow_path(const str_t& path);
+    // Read at most `nthreads` directories at a time under mount point
+    // `path`. Replaces the previous limit of `path`.
+    app& set_concur_limit(str_t path, unsigned nthreads);
+    app& erase_concur_limit(const str_t& path);
+    // Index `root` in its own database, rebuilt in parallel with others.
+    // Special paths of the app also apply to it. Requires a database path.
+    app& add_shard(str_t root);
+    // Keep decompressed copies of forward indexes, mapped read-only, in
+    // unlinked files under `dir` (like a tmpfs), or in memory if `dir` is
+    // empty, so that scanning them takes no locks nor decompression.
+    // Databases are made hot now and whenever rebuilt; nullopt turns it
+    // off. Those failing to be made hot stay cold.
+    // No job may be running. THREAD UNSAFE
+    app& set_hot_index(std::optional<str_t> dir);
+    // Width of trigram keys of databases rebuilt since, up to
+    // `dmp::exact_trigram_bits`. Throw out of range if it is invalid.
+    app& set_trigram_bits(unsigned bits);
+    // Evaluate up to `pages` pages of inverted indexes ahead on the pool
+    // in name queries; 0 turns it off. Only pays for callers enumerating
+    // every match, like `run`, since queries stopping early waste the
+    // pages evaluated ahead. Applies to jobs created since.
+    app& set_query_window(unsigned pages);
+    app& erase_shard(const str_t& root);
+    // Configure special paths from mounted filesystems: pseudo filesystems
+    // are ignored, rotational devices become slow paths, and NVMe devices
+    // get concurrency limits. Does nothing if mount points are unknown.
+    app& configure_mounts();
     app& set_root_path(str_t path);
     app& add_start_path(str_t path);
     app& erase_start_path(const str_t& path);
 
     // Getters
     const str_t& db_path() const noexcept {
-        return _dumper->fwdidx_path();
+        return _dumper->db_path();
     }
     const str_t& root_path() const noexcept { return _dumper->_root_path; }
     const str_t& conf_path() const noexcept { return _conf_path; }
+    const std::optional<str_t>& hot_index() const noexcept { return _hot_index; }
+    bool watch() const noexcept { return _watch; }
+    unsigned query_window() const noexcept { return _query_window; }
+    unsigned trigram_bits() const noexcept { return _dumper->_trigram_bits; }
 
     const std::vector<str_t>& 
     slow_paths() const noexcept { return _dumper->_noconcur_paths; }
     const std::vector<str_t>& 
     ignored_paths() const noexcept { return _dumper->_pruned_paths; }
+    const std::vector<std::pair<str_t, unsigned>>&
+    concur_limits() const noexcept { return _dumper->_concur_limits; }
     const std::vector<str_t>& 
     start_paths() const noexcept { return _start_paths; }
+    std::vector<str_t> shard_roots() const;
 
     // Read or write config files. Use the most recently passed
     // parameter if it is empty. THREAD UNSAFE
@@ -81,12 +157,16 @@ public:
     // Paths can only be set in valid state
     bool valid() const noexcept { return _dumper != nullptr; }
     bool has_data() const noexcept {
-        return _dumper != nullptr && _dumper->chunk_count() != 0;
+        if (_dumper != nullptr && _dumper->chunk_count() != 0)
+            return true;
+        return std::any_of(_shards.begin(), _shards.end(),
+            [] (const auto& s) { return s->chunk_count() != 0; });
     }
 
     // To keep jobs safe after updatedb, which resets dumped data in
     // app class, shared pointer to previous data is stored along with
-    // the job itself.
+    // the job itself. Jobs over entries created since last updatedb
+    // have a null one.
     typedef std::vector<std::pair<
         std::shared_ptr<dmp::dumper>, 
         // Use unique_ptr simply because async_job is not movable
@@ -131,7 +211,11 @@ app& app::start_auto_update(const std::chrono::duration<Rep, Period>& interval,
                 try {
                     if (!_conf_path.empty())
                         read_conf();
-                    update_db();
+                    update_db(true);
+                    if (_watch && _watcher == nullptr)
+                        start_watching();
+                    else if (!_watch && _watcher != nullptr)
+                        stop_watching();
                 } catch(const std::runtime_error& e) {
                     // Cannot throw here
                     NATIVE_STDERR << "Error during orient auto updatedb: "
@@ -141,7 +225,8 @@ app& app::start_auto_update(const std::chrono::duration<Rep, Period>& interval,
             not_first = true;
             std::unique_lock __lck(_paths_mut);
             _auto_update_cv.wait_for(__lck, interval, 
-                [this] () {return _auto_update_stopped;});
+                [this] () {return _auto_update_stopped || _update_requested;});
+            _update_requested = false;
         }
     });
     return *this;
@@ -2,9 +2,14 @@
 #include "predef.hpp"
 #include "dumper.hpp"
 #include <optional>
+#include <memory>
 
 namespace orie {
-namespace dmp { class trigram_query; }
+namespace dmp {
+    class trigram_query;
+    class delta_segment;
+    using delta_entries = std::vector<std::pair<str_t, category_tag>>;
+}
 
 
 /*! @class fs_data_record
@@ -16,7 +21,7 @@ class fs_data_record {
 private:
     dmp::dumper* _dumper;
 
-    // Current chunk in Forward Index, 0~4095
+    // Current chunk in Forward Index, ~uint32_t() if invalid
     uint32_t _cur_chunk;
     // Current batch in Inverted Index
     uint32_t _cur_batch;
@@ -29,6 +34,10 @@ private:
     uint8_t _in_batch_pos;
     bool _is_viewing;
 
+    // Make the header of the next batch readable if it is in the current
+    // chunk, in which it may start another frame
+    void __reveal_next_batch();
+
 public:
     //! @brief Open views to filesystem database 
     //! making all methods return valid data and @c increment work
@@ -58,12 +67,16 @@ public:
     //! @brief Get the file name length of current entry
     //! @c start_visit must be called beforehand 
     size_t file_name_len() const noexcept;
+    //! @brief Get the change stamp of current directory when it was dumped,
+    //! in nanoseconds. 0 if unknown. @c start_visit must be called beforehand
+    //! @warning Undefined if @a file_type does not return dir_tag
+    uint64_t dir_stamp() const noexcept;
 
     // Simple getters
     uint8_t in_batch_pos() const noexcept { return _in_batch_pos; };
     uint32_t at_batch() const noexcept { return _cur_batch; };
     dmp::dumper* dumper() const noexcept { return _dumper; };
-    bool valid() const noexcept { return _cur_chunk < 4096; }
+    bool valid() const noexcept { return _cur_chunk != ~uint32_t(); }
 
     //! @brief Get the type of the file.
     //! @retval unknown_tag End of data reached; no other functions shall be called.
@@ -137,6 +150,20 @@ private:
     mutable std::optional<orie::stat_t> _opt_stat;
     int _fetch_stat() const noexcept;
 
+    // Changes since the database was dumped, whose deleted entries are
+    // skipped. Null if not watched.
+    std::shared_ptr<const dmp::delta_segment> _delta;
+    // Whether `_prefix` itself has been deleted
+    bool _prefix_removed;
+    // Entries iterated over instead of a database, if not null
+    std::shared_ptr<const dmp::delta_entries> _added;
+    size_t _added_at;
+
+    void __increment();
+    void __check_prefix();
+    void __skip_removed();
+    void __view_added();
+
 public:
     // Disable view to database. Re-established on ++ call.
     void close_index_view() noexcept {
@@ -250,9 +277,13 @@ public:
         return !(*this == rhs);
     }
     bool operator<(const fs_data_iter &rhs) const noexcept {
+        if (_added != nullptr)
+            return _added_at < rhs._added_at;
         return _cur_record < rhs._cur_record;
     }
     bool operator>(const fs_data_iter &rhs) const noexcept {
+        if (_added != nullptr)
+            return _added_at > rhs._added_at;
         return _cur_record > rhs._cur_record;
     }
 
@@ -264,6 +295,11 @@ public:
     // or is not a directory.
     fs_data_iter(dmp::dumper* dumper, sv_t start_path)
         : fs_data_iter(dumper) { change_root(start_path); }
+    // Construct an iterator over entries not in any database, such as those
+    // recorded by `dmp::fs_watcher`. Like the "special state" of `updir`,
+    // only path, type and `stat`-related functions are valid, and the
+    // depth is 1 until the end.
+    fs_data_iter(std::shared_ptr<const dmp::delta_entries> entries);
 
     // Copy the content of rhs.
     // Copied or moved iterator has iteration mode OFF!!!
@@ -2,9 +2,13 @@
 #include <orient/fs/trigram.hpp>
 #include <orient/util/fifo_thpool.hpp>
 #include <orient/util/file_mem_chunk.hpp>
+#include <memory>
 
 namespace orie {
+class uring;
+
 namespace dmp {
+class delta_segment;
 
 // Low-level filesystem database writer
 // All members can be directly modified
@@ -13,10 +17,24 @@ public:
     // TODO: Changeable in conf file
     // Minimum size of each chunk. Actual size will be a bit larger.
     static constexpr size_t chunk_size_hint = 2000000;
-    // Number of chunks loaded into memory
-    static constexpr uint8_t cached_chunk_cnt = 8;
+    // Default bytes of decompressed chunks kept in memory
+    static constexpr size_t default_cache_budget = 8 * chunk_size_hint;
     // Number of files in a batch
     static constexpr uint8_t nfile_in_batch = 24;
+    // Directories changed within this many nanoseconds before a rebuild
+    // starts get a 0 stamp, which never matches in incremental rebuilds,
+    // since changes in the same timestamp granularity are undetectable.
+    static constexpr uint64_t default_racy_stamp_margin = 2000000000;
+    // Maximum number of directories read ahead of serialization
+    // during concurrent traversal
+    static constexpr size_t max_lookahead_dirs = 4096;
+    // Maximum number of batched requests in flight when reading slow paths
+    // with io_uring, which is also the number of sub directories read
+    // together in `dump_noconcur`
+    static constexpr unsigned uring_queue_depth = 64;
+    // Maximum number of descriptors of directories kept open by
+    // `dump_noconcur` for reading their sub directories relative to them
+    static constexpr size_t max_kept_dir_fds = 4 * uring_queue_depth;
 
     // The path to start scanning filesystem
     str_t _root_path;
@@ -29,9 +47,36 @@ public:
     // All path must be absolute (start with slash) and have no extra slash
     // or they will be made so during database rebuild.
     std::vector<str_t> _noconcur_paths;
+    // Mount points of devices read concurrently, and the max number of
+    // directories of each read at a time, which covers everything under
+    // the mount point except nested mount points listed here or in
+    // `_noconcur_paths`. Paths follow the same rules as `_noconcur_paths`.
+    std::vector<std::pair<str_t, unsigned>> _concur_limits;
+    // Width of trigram keys of databases built by `rebuild_database`.
+    // Wider keys collide less, so fewer batches are scanned in vain, at the
+    // cost of a larger inverted index. That of the opened one by default.
+    unsigned _trigram_bits;
+    // See `default_racy_stamp_margin`
+    uint64_t _racy_stamp_margin = default_racy_stamp_margin;
     fifo_thpool& _pool;
 
 private:
+    // A generation of the database: files written by one rebuild
+    struct generation_t {
+        uint64_t id = 0;
+        str_t fwd_path, inv_path;
+        // Files are new and must start empty
+        bool fresh = true;
+        // Database written before manifests, whose forward index is at
+        // the manifest path; opened as generation 0 until a publish
+        // replaces it, and never rebuilt in place
+        bool legacy = false;
+    };
+    // Path to the manifest, a small file recording the generation in use.
+    // It is replaced atomically by `publish`.
+    str_t _db_path;
+    generation_t _gen;
+
     // The filesystem database
     // Outside the class, its _unplaced_dat field MUST NOT BE
     // MODIFIED and shall REMAIN EMPTY
@@ -42,11 +87,60 @@ private:
     // (inverted index to forward index)
     std::vector<uint32_t> _pos_of_batches; // In-chunk position
     std::vector<uint32_t> _chunk_of_batches; // Chunk id
+    // Places basename trigrams into the inverted index being built
+    trigram_placer _placer;
+    // Pages of the inverted index evaluated ahead on `_pool` by queries
+    // from `to_query_of_this_index`; 0 to evaluate them on query threads
+    std::atomic<unsigned> _query_window = 0;
+    // Changes since the database was dumped, seen by its iterators
+    std::shared_ptr<const delta_segment> _delta;
+
+    // Listings of directories in the previous database; only set during an
+    // incremental `rebuild_database`. Defined in dumper.cpp.
+    struct prev_dirs_t;
+    const prev_dirs_t* _prev_dirs = nullptr;
+    // Stamps newer than this are racy and recorded as 0
+    uint64_t _racy_since = 0;
+    // Listings copied from `_prev_dirs` by the last `rebuild_database`
+    std::atomic<size_t> _reused_dirs = 0;
+
+    // Ring for batched reads of slow paths; only set during
+    // `rebuild_database` if io_uring is available.
+    uring* _uring = nullptr;
+    // Descriptors kept in batches of `fetch_dir_infos`
+    size_t _kept_dir_fds = 0;
+
+    // Work-stealing traversal engine of `dump_concur`. Defined in dumper.cpp.
+    class concur_walker;
+
+    // Generation to open for the manifest at `db_path`: the recorded one,
+    // or the one after it if `next`. Leftover files of a new generation
+    // are removed. Without a valid manifest, the database written there
+    // by older versions if any, or generation 0.
+    static generation_t pick_generation(const str_t& db_path, bool next);
+    // Point the manifest to the current generation, whose files must be
+    // durable already, with an atomic rename. Files of generations older
+    // than the previous one are removed afterwards, since readers may still
+    // have the previous one open.
+    // Throw runtime error if the manifest cannot be written. Nothing is
+    // thrown once it is replaced, not even if its directory fails to sync.
+    void publish();
 
 public:
-    dumper(sv_t database_path, fifo_thpool& pool);
-    void rebuild_database();
-    void move_file(str_t path);
+    // Open the generation recorded in the manifest at `database_path`. If
+    // there is none, open the database of an older version there read
+    // only, or an empty generation 0.
+    // If `next_generation`, open a new empty generation after the recorded
+    // one instead, which readers of the manifest do not see until it is
+    // published by `rebuild_database`.
+    dumper(sv_t database_path, fifo_thpool& pool, bool next_generation = false);
+    // Scan the filesystem, rewrite the database and publish it.
+    // If `prev` is given, listings of directories whose change stamps are
+    // unchanged since `prev` was dumped are copied from `prev` instead of
+    // being read from disk again. `prev` must not be `this`.
+    // Throw runtime error if this is a database of an older version, which
+    // is rebuilt by a new dumper with `next_generation` instead.
+    void rebuild_database(dumper* prev = nullptr);
 
     // The position `batch`th batch is at, in its chunk in forward index
     uint32_t in_chunk_pos_of_batch(size_t batch) const noexcept {
@@ -59,16 +153,60 @@ public:
 
     size_t batch_count() const noexcept { return _pos_of_batches.size(); }
     size_t chunk_count() const noexcept { return _index.chunk_count(); }
+    const str_t& db_path() const noexcept { return _db_path; }
+    uint64_t generation() const noexcept { return _gen.id; }
+    // Number of directory listings the last `rebuild_database` copied
+    // from the previous database instead of reading them from disk
+    size_t reused_dir_count() const noexcept { return _reused_dirs; }
     const str_t& fwdidx_path() const noexcept { return _index.saving_path(); }
     const str_t& invidx_path() const noexcept { return _invidx.saving_path(); }
+    // Width of trigram keys of the database in use
+    unsigned trigram_bits() const noexcept {
+        unsigned bits = _index.build_params().trigram_bits;
+        return bits == 0 ? default_trigram_bits : bits;
+    }
+    // Whether the inverted index has `ancestor_key`s
+    bool ancestor_keys() const noexcept {
+        return _index.build_params().ancestor_keys != 0;
+    }
+    // Whether the inverted index has `bigram_key`s and `extension_key`s
+    bool short_keys() const noexcept {
+        return _index.build_params().short_keys != 0;
+    }
+    // Whether the inverted index has anchor keys of basenames
+    bool anchor_keys() const noexcept {
+        return _index.build_params().anchor_keys != 0;
+    }
 
     // TODO: Refactor file_mem_chunk to auto manage file memory visit
     // Calls _fwdidx->start_visit()
     const std::byte* start_visit(uint32_t chunk, size_t in_chunk_pos) {
         return _index.start_visit(chunk, in_chunk_pos);
     }
+    // Calls _fwdidx->extend_visit(); frames start at batches
+    void extend_visit(uint32_t chunk, size_t in_chunk_pos) {
+        _index.extend_visit(chunk, in_chunk_pos);
+    }
     // Calls _fwdidx->finish_visit()
-    void finish_visit() { _index.finish_visit(); }
+    void finish_visit(uint32_t chunk) noexcept { _index.finish_visit(chunk); }
+    void set_cache_budget(size_t bytes) { _index.set_cache_budget(bytes); }
+    void set_readahead(unsigned depth) noexcept { _index.set_readahead(depth); }
+    // See `arr2d_intersect::set_parallel`; for queries enumerating every
+    // match, not ones stopping early. Applies to later queries reset by
+    // `to_query_of_this_index`. Thread safe.
+    void set_query_window(unsigned pages) noexcept { _query_window = pages; }
+    unsigned query_window() const noexcept { return _query_window; }
+    // Make iterators constructed later skip entries deleted in `delta`;
+    // null to stop. Thread safe.
+    void set_delta(std::shared_ptr<const delta_segment> delta) noexcept {
+        std::atomic_store(&_delta, std::move(delta));
+    }
+    std::shared_ptr<const delta_segment> delta() const noexcept {
+        return std::atomic_load(&_delta);
+    }
+    // See `file_mem_chunk::make_hot`; no record may be visiting
+    void make_hot(const str_t& dir) { _index.make_hot(dir); }
+    void drop_hot() noexcept { _index.drop_hot(); }
 
     void set_remove_on_destroy(bool on) noexcept {
         _index._rmfile_on_dtor = on;
@@ -76,9 +214,13 @@ public:
     }
 
     // Reset a trigram query object so that it queries data dumped
-    // by this dumper object. Calls `query.reset_reader(&_invidx)`.
-    void to_query_of_this_index(trigram_query& query) const noexcept {
-        query.reset_reader(&_invidx);
+    // by this dumper object. Calls `query.reset_reader` with the index,
+    // its key width and whether it has ancestor, short and anchor keys.
+    void to_query_of_this_index(trigram_query& query) const {
+        query.reset_reader(&_invidx, trigram_bits(), ancestor_keys(),
+                           short_keys(), anchor_keys());
+        unsigned window = _query_window;
+        query.set_parallel(window ? &_pool : nullptr, window);
     }
 
 private:
@@ -86,21 +228,100 @@ private:
     bool is_pruned(const str_t& fullp);
     bool is_noconcur(const str_t& fullp);
 
-    // Basename of child dirs and basenames of child files
+    // Basenames of child dirs, tags and basenames of child files and the
+    // directory's change stamp (0 if unknown or racy).
+    // Names are kept in one buffer instead of a string each. Buffers are
+    // recycled through per-thread pools when destroyed, so that reading
+    // directories rarely allocates.
+    class dir_info_t {
+        struct ent_t {
+            uint32_t at; // Offset in `_names`
+            uint32_t len;
+        };
+        // Each name is followed by a NUL; file names are preceded by tags
+        std::vector<char_t> _names;
+        std::vector<ent_t> _subdirs;
+        std::vector<ent_t> _files;
+
+        // Buffer pool; defined in dumper.cpp
+        struct pool_t;
+        ent_t place(sv_t name);
+
+    public:
+        uint64_t stamp = 0;
+
+        dir_info_t();
+        ~dir_info_t();
+        dir_info_t(const dir_info_t&) = default;
+        dir_info_t(dir_info_t&&) noexcept = default;
+        dir_info_t& operator=(const dir_info_t&) = default;
+        // Buffers of `*this` are recycled when `rhs` is destroyed
+        dir_info_t& operator=(dir_info_t&& rhs) noexcept;
+
+        size_t subdir_count() const noexcept { return _subdirs.size(); }
+        size_t file_count() const noexcept { return _files.size(); }
+        bool empty() const noexcept { return _subdirs.empty() && _files.empty(); }
+        // NUL terminated basename of `i`th sub dir
+        const char_t* subdir_cstr(size_t i) const noexcept {
+            return _names.data() + _subdirs[i].at;
+        }
+        sv_t subdir(size_t i) const noexcept {
+            return sv_t(_names.data() + _subdirs[i].at, _subdirs[i].len);
+        }
+        sv_t file(size_t i) const noexcept {
+            return sv_t(_names.data() + _files[i].at, _files[i].len);
+        }
+        category_tag file_tag(size_t i) const noexcept {
+            return static_cast<category_tag>(_names[_files[i].at - 1]);
+        }
+
+        void add_subdir(sv_t name) { _subdirs.push_back(place(name)); }
+        void add_file(category_tag tag, sv_t name) {
+            _names.push_back(static_cast<char_t>(tag));
+            _files.push_back(place(name));
+        }
+    };
+    // If `parent_fd` is an opened descriptor of the parent directory, the
+    // directory is opened by its basename relative to it, sparing a full
+    // path lookup. If `dir_fd` is given, the opened descriptor of the
+    // directory is stored there (-1 on failure) for the caller to close.
+    // Descriptors are not used on Windows.
     // dir_fullpath may change inside, but remain unchanged on return
-    typedef std::pair<std::vector<str_t>, std::vector<str_t>> dir_info_t;
-    dir_info_t fetch_dir_info(str_t& dir_fullpath);
+    dir_info_t fetch_dir_info(str_t& dir_fullpath, int parent_fd = -1,
+                              int* dir_fd = nullptr);
+    // Read sub dirs of `parent` in [since, until) into `res` with batched
+    // requests through `_uring`. `parent_fullpath` ends with a separator and
+    // `parent_fd` is an opened descriptor of it or -1.
+    // Pruned ones are left empty. Descriptors of those with sub directories
+    // are kept in `dir_fds`, up to `max_kept_dir_fds` in total, and -1
+    // otherwise; each is released by `__release_dir_fd`.
+    // parent_fullpath may change inside, but remain unchanged on return
+    void fetch_dir_infos(str_t& parent_fullpath, int parent_fd,
+                         const dir_info_t& parent, size_t since,
+                         size_t until, std::vector<dir_info_t>& res,
+                         std::vector<int>& dir_fds);
+    // Close a descriptor kept by `fetch_dir_infos` and set it to -1
+    void __release_dir_fd(int& fd) noexcept;
+    // Copy the listing of `dir_fullpath` from previous database.
+    // Return false if the directory changed since then.
+    bool fetch_prev_dir_info(const str_t& dir_fullpath, dir_info_t& res);
+    static void load_prev_dirs(dumper& prev, prev_dirs_t& dest);
 
     // Helper function that serilizes a directory whose contents
     // are already read into `info`
     size_t dump_one(const str_t& fullpath, size_t basename_len, arr2d_writer& w,
                     const dir_info_t& info, size_t nth_file);
+    // Dump dir pop tag and start a new chunk if current one is large enough
+    void dump_dir_pop(arr2d_writer& w);
+    // Sub directories are read ahead by `_pool.n_workers()` threads.
     // fullpath may change inside, but remain unchanged on return
     size_t dump_concur(str_t& fullpath, size_t basename_len, arr2d_writer& w,
                        const dir_info_t& info, size_t nth_file);
+    // `dir_fd` is an opened descriptor of `fullpath` or -1.
     // fullpath may change inside, but remain unchanged on return
     size_t dump_noconcur(str_t& fullpath, size_t basename_len, arr2d_writer& w,
-                         const dir_info_t& info, size_t nth_file);
+                         const dir_info_t& info, size_t nth_file,
+                         int dir_fd = -1);
 };
 
 }
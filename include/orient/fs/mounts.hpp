@@ -0,0 +1,44 @@
+#pragma once
+#include <orient/fs/predef.hpp>
+#include <string>
+#include <vector>
+
+namespace orie {
+namespace dmp {
+
+// A mounted filesystem and what is known about its backing device
+struct mount_info {
+    // Mount point
+    str_t path;
+    std::string fstype;
+    // "major:minor" of the device; major is 0 for those without a block
+    // device, like network and pseudo filesystems
+    std::string device;
+    // Holds nothing worth indexing, like proc, sysfs or cgroup
+    bool pseudo = false;
+    // A network filesystem, like NFS or CIFS
+    bool network = false;
+    // Backed by a rotational block device
+    bool rotational = false;
+    // Backed by an NVMe block device
+    bool nvme = false;
+    // `queue/nr_requests` of the backing block device; 0 if unknown
+    unsigned nr_requests = 0;
+    // Directories not worth indexing because of this mount, like upper and
+    // work directories of overlay mounts
+    std::vector<str_t> hidden_paths;
+};
+
+// Parse mount points from `mountinfo`, formatted as /proc/self/mountinfo,
+// and look up their block devices under `sysfs`.
+// Return an empty list if `mountinfo` is unreadable or not on Linux.
+std::vector<mount_info> read_mounts(const char* mountinfo = "/proc/self/mountinfo",
+                                    const char* sysfs = "/sys");
+
+// Max number of directories to read from the device of `m` at a time.
+// 1 for rotational devices, which are best read serially;
+// 0 for unlimited, which is the case if the device is unknown.
+unsigned device_concurrency(const mount_info& m) noexcept;
+
+} // namespace dmp
+} // namespace orie
@@ -7,35 +7,191 @@ class fs_data_iter;
 
 namespace dmp {
 
+// Trigrams are keys, i.e. line numbers, of the inverted index. Keys of an
+// index are `bits` wide, which is a build parameter of the database.
+// Keys narrower than `exact_trigram_bits` are CRCs of trigrams truncated to
+// `bits`; keys of `exact_trigram_bits` are the case folded trigrams
+// themselves if chars are bytes, leaving no collisions.
+inline constexpr unsigned default_trigram_bits = 13;
+inline constexpr unsigned min_trigram_bits = 8;
+inline constexpr unsigned exact_trigram_bits = 24;
+inline constexpr bool valid_trigram_bits(unsigned bits) noexcept {
+    return bits >= min_trigram_bits && bits <= exact_trigram_bits;
+}
+
 // Simple trigram extraction
-size_t strstr_trigram_ext(sv_t name, uint32_t* out, size_t outsz) noexcept;
+size_t strstr_trigram_ext(sv_t name, uint32_t* out, size_t outsz,
+                          unsigned bits = default_trigram_bits) noexcept;
 // Extract trigrams from glob patterns. Does not treat '/' specially
 std::pair<size_t, bool> // trigram size and is basename
-glob_trigram_ext(sv_t pat, uint32_t* out, const size_t outsz, bool full) noexcept;
+glob_trigram_ext(sv_t pat, uint32_t* out, const size_t outsz, bool full,
+                 unsigned bits = default_trigram_bits) noexcept;
 std::pair<size_t, bool> // trigram size and is basename
-fullpath_trigram_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz);
+fullpath_trigram_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz,
+                     unsigned bits = default_trigram_bits);
+
+// Keys of trigrams in the names of ancestor directories of entries in a
+// batch. Full path queries intersect them instead of scanning subtrees of
+// directories matching basename keys.
+inline constexpr uint32_t ancestor_key(uint32_t key, unsigned bits) noexcept {
+    return key | (uint32_t(1) << bits);
+}
+// Trigrams of `pat` that the full paths matching it have in their names,
+// not across separators. Keys of names before the last separator of `pat`
+// are in ancestors of matches and go first, followed by the rest, which
+// may be in basenames or ancestors. The final literal of a glob pattern is
+// not extracted, since it is anchored in basenames; see
+// `fullpath_trigram_ext` for it.
+std::pair<size_t, size_t> // number of keys and of ancestor keys
+path_trigram_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz,
+                 unsigned bits = default_trigram_bits) noexcept;
+
+// Keys of bigrams and of extensions of basenames in a batch, looked up by
+// patterns too short to have trigrams. They follow `ancestor_key`s.
+// `key` is below `1 << bits`, from `bigram_hash` or `extension_hash`.
+inline constexpr uint32_t bigram_key(uint32_t key, unsigned bits) noexcept {
+    return key | (uint32_t(2) << bits);
+}
+inline constexpr uint32_t extension_key(uint32_t key, unsigned bits) noexcept {
+    return key | (uint32_t(3) << bits);
+}
+// Short keys found in more than 1 / `short_key_max_density` of all batches
+// are not looked up, since scanning every batch is about as fast.
+inline constexpr size_t short_key_max_density = 8;
+uint32_t bigram_hash(char_t low, char_t high, unsigned bits) noexcept;
+// Hash of the case folded extension, which is the part of a name after its
+// last '.', excluding it
+uint32_t extension_hash(sv_t ext, unsigned bits) noexcept;
+// `bigram_key`s of literals of at least 2 chars in `pat`, which is a
+// basename glob pattern if `glob`, followed by the `extension_key` if
+// every match of the glob pattern has the same extension
+size_t short_key_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz,
+                     unsigned bits = default_trigram_bits) noexcept;
+
+// Keys of trigrams of names padded with `separator`, which no name has:
+// the first 2 chars after it and the last 2 before it, or a 1-char name
+// between 2 of them. They mark where names start and end, as ordinary
+// keys no name placed by `trigram_placer::place` has.
+size_t name_anchor_ext(sv_t name, uint32_t* out, size_t outsz,
+                       unsigned bits = default_trigram_bits) noexcept;
+// Anchor keys of `name_anchor_ext` every match of the basename glob
+// pattern `pat` has, i.e. of literals it starts or ends with
+size_t glob_anchor_ext(sv_t pat, uint32_t* out, size_t outsz,
+                       unsigned bits = default_trigram_bits) noexcept;
+
+// Literals every match of a regex contains, as an AND/OR tree in the style
+// of Google Code Search. Literals have at least 3 chars; shorter ones have
+// no trigrams and are dropped.
+struct regex_literals {
+    // Any of `lits` and `subs` if true, otherwise all of them
+    bool is_or = false;
+    std::vector<str_t> lits;
+    std::vector<regex_literals> subs;
+
+    // Whether nothing is required, i.e. any string may match
+    bool any() const noexcept { return lits.empty() && subs.empty(); }
+};
+// Literals required by PCRE2 pattern `pat`. Unsupported syntax (extended
+// mode, recursion, conditionals, verbs...) requires nothing.
+regex_literals regex_literal_ext(sv_t pat);
 
 uint32_t char_to_trigram(uint32_t low, uint32_t mid, uint32_t high) noexcept;
-void place_trigram(sv_t name, uint32_t batch, arr2d_writer& w);
+// Key of the trigram `low, mid, high` in an index of `bits` wide keys
+uint32_t trigram_key(char_t low, char_t mid, char_t high, unsigned bits) noexcept;
+// Number of windows hashed at a time by `hash_trigrams` callers
+inline constexpr size_t trigram_window_batch = 64;
+// Hash all `nwin` 3-char windows starting at `p` into `out`. `out[i]` is
+// `trigram_key(p[i], p[i+1], p[i+2], bits)`; `p` has `nwin + 2` chars.
+// Both index building and queries use it, so their hashes always match.
+void hash_trigrams(const char_t* p, size_t nwin, uint32_t* out,
+                   unsigned bits = default_trigram_bits) noexcept;
+void place_trigram(sv_t name, uint32_t batch, arr2d_writer& w,
+                   unsigned bits = default_trigram_bits);
+
+// Same as `place_trigram`, but a trigram is placed only once per batch,
+// checked with a bitmap of all keys before reaching the writer. Only keys
+// set in the current batch are cleared when it changes. Batches must be
+// placed in ascending order. Call `reset` before writing another index.
+class trigram_placer {
+    std::vector<uint64_t> _placed;
+    std::vector<uint32_t> _placed_keys;
+    uint32_t _batch = uint32_t(-1);
+    unsigned _bits = default_trigram_bits;
+
+    void __start_batch(uint32_t batch);
+
+public:
+    void place(sv_t name, uint32_t batch, arr2d_writer& w);
+    // Place `ancestor_key`s of names in the directory path `dir`, which
+    // is an ancestor of entries in `batch`
+    void place_ancestors(sv_t dir, uint32_t batch, arr2d_writer& w);
+    // Place `bigram_key`s and the `extension_key` of `name`
+    void place_short(sv_t name, uint32_t batch, arr2d_writer& w);
+    // Place anchor keys of `name`; see `name_anchor_ext`
+    void place_anchors(sv_t name, uint32_t batch, arr2d_writer& w);
+    // Start another index of `bits` wide keys
+    void reset(unsigned bits = default_trigram_bits);
+    unsigned bits() const noexcept { return _bits; }
+};
 
 // Lazily find possible batches that may contain matches of a strstr or glob
 // pattern set via `reset_*_needle`, on an `arr2d_reader` object storing a
 // inverted index constructed by `place_trigram`.
+// Trigrams of the needle are extracted again if the reader is of another
+// key width. Needles without trigrams look up short keys instead, if the
+// index has them and they are not too dense. Basename glob needles also
+// look up anchor keys of literals they start or end with.
 class trigram_query {
     arr2d_intersect _query;
     bool _is_full = false;
+    // The needle, kept to extract trigrams of another width
+    str_t _needle;
+    bool _needle_glob = false;
+    bool _needle_full = false;
+    unsigned _bits = default_trigram_bits;
+    // Whether the index has `ancestor_key`s
+    bool _ancestors = false;
+    // Whether the index has `bigram_key`s and `extension_key`s
+    bool _short_keys = false;
+    // Whether the index has anchor keys of basenames
+    bool _anchor_keys = false;
+    // Short keys of the needle if it has no trigrams
+    std::vector<uint32_t> _short;
+
+    void __extract();
+    // Look up `_short` unless they are found in too many batches
+    void __plan_short();
 
 public:
-    // Getter
+    // Whether a batch found may only have the ancestor of a match, and
+    // descendants of matching directories must be scanned
     bool is_fullpath() const noexcept { return _is_full; }
-    size_t trigram_size() const noexcept
-        { return _query._lines_to_query.size(); }
-    void reset_reader(const arr2d_reader* reader) noexcept {
-        _query.set_reader(reader);
+    size_t trigram_size() const noexcept {
+        return _query._lines_to_query.size() +
+               _query._line_pairs_to_query.size();
+    }
+    unsigned trigram_bits() const noexcept { return _bits; }
+    // Whether the needle has keys to look up in some index, even if
+    // `trigram_size()` is 0 for the current one
+    bool indexable() const noexcept {
+        return trigram_size() != 0 || !_short.empty();
     }
+    // `bits` is the key width of the index `reader` views, `ancestors` is
+    // whether it has `ancestor_key`s, `short_keys` is whether it has
+    // `bigram_key`s and `extension_key`s and `anchor_keys` is whether it
+    // has the keys of `name_anchor_ext`
+    void reset_reader(const arr2d_reader* reader,
+                      unsigned bits = default_trigram_bits,
+                      bool ancestors = false, bool short_keys = false,
+                      bool anchor_keys = false);
     void rewind() noexcept { _query.rewind(); }
+    // See `arr2d_intersect::set_parallel`
+    void set_parallel(fifo_thpool* pool, size_t window = 0) noexcept {
+        _query.set_parallel(pool, window);
+    }
 
-    // is_fullpath() will return the same as is_full here
+    // is_fullpath() will return the same as is_full here, unless the index
+    // has ancestor keys
     void reset_strstr_needle(sv_t needle, bool is_full);
     // is_full == true here does not mean is_fullpath() return true
     void reset_glob_needle(sv_t needle, bool is_full);
@@ -51,8 +207,8 @@ public:
 
     trigram_query(const arr2d_reader *reader, sv_t needle = sv_t(),
                   bool is_glob = false, bool is_full = false)
-        : _query(reader) { is_glob ? reset_strstr_needle(needle, is_full)
-                                   : reset_glob_needle(needle, is_full); }
+        : _query(reader) { is_glob ? reset_glob_needle(needle, is_full)
+                                   : reset_strstr_needle(needle, is_full); }
     trigram_query() = default;
     ~trigram_query() = default;
 };
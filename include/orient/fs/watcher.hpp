@@ -0,0 +1,132 @@
+#pragma once
+#include <orient/fs/predef.hpp>
+#include <unordered_map>
+#include <map>
+#include <shared_mutex>
+#include <atomic>
+#include <array>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <functional>
+
+namespace orie {
+namespace dmp {
+
+// Entries not in any database and their types, such as those created
+// since it was dumped
+using delta_entries = std::vector<std::pair<str_t, category_tag>>;
+
+// Changes made to the filesystem since the database was dumped.
+// Recorded by `fs_watcher` and consulted alongside the dumped data.
+// All methods are thread safe.
+class delta_segment {
+    mutable std::shared_mutex _mut;
+    // Entries created since the database was dumped; path to (tag, epoch).
+    // Ordered, so that entries under a directory are a range.
+    using added_map = std::map<str_t, std::pair<category_tag, uint64_t>>;
+    added_map _added;
+    // Entries (and their sub entries) deleted since the database was
+    // dumped; path to epoch
+    std::unordered_map<str_t, uint64_t> _removed;
+    uint64_t _epoch = 0;
+    // Set if changes were lost, after which the segment is incomplete
+    std::atomic<bool> _overflowed = false;
+    // Size of `_removed` and a bitmap of hashes of basenames in it, read
+    // without locks since iterators consult them for every entry
+    std::atomic<size_t> _nremoved = 0;
+    std::array<std::atomic<uint64_t>, 64> _removed_names{};
+
+    static size_t __name_bit(sv_t name) noexcept;
+    // Range of `_added` strictly under `dir`; all if `dir` is empty.
+    // `_mut` must be held.
+    std::pair<added_map::const_iterator, added_map::const_iterator>
+    __added_below(sv_t dir) const;
+    // Set the two above from `_removed`; `_mut` must be held
+    void __index_removed() noexcept;
+
+public:
+    // Record a newly created entry
+    void add(str_t path, category_tag tag);
+    // Record a deletion. Also drops created entries under `path`.
+    void remove(str_t path);
+
+    // Whether `path` or any of its parent directories has been deleted
+    // since the database was dumped.
+    bool is_removed(sv_t path) const;
+    // Whether an entry named `name` may have been deleted. False positives
+    // are possible but rare; `is_removed` tells for sure.
+    bool may_be_removed(sv_t name) const noexcept {
+        size_t bit = __name_bit(name);
+        return _nremoved != 0 &&
+            (_removed_names[bit / 64].load(std::memory_order_relaxed) &
+             (uint64_t(1) << (bit % 64)));
+    }
+    bool has_removed() const noexcept { return _nremoved != 0; }
+    // Created entries being `prefix` or under it, sorted. Empty `prefix`
+    // for all.
+    delta_entries added_under(sv_t prefix) const;
+    bool empty() const noexcept;
+    // Record that changes were lost, e.g. by an overflowed event queue.
+    // The segment is then incomplete until a rebuild that started after it.
+    void set_overflowed() noexcept { _overflowed = true; }
+    bool overflowed() const noexcept { return _overflowed; }
+    // Clear the overflow mark and return it. Call it right before a
+    // database rebuild starts, since changes lost earlier are in it.
+    bool take_overflowed() noexcept { return _overflowed.exchange(false); }
+
+    // Changes recorded after this call are tagged with a new epoch,
+    // which is returned. Call it right before a database rebuild starts.
+    uint64_t new_epoch() noexcept;
+    // Forget changes recorded before `epoch`, which are in a rebuilt database.
+    // If `dumped` is given, only those to paths it returns true for.
+    void drop_before(uint64_t epoch,
+                     const std::function<bool(sv_t)>& dumped = nullptr);
+    // Forget created entries in `paths`, which are in a rebuilt database,
+    // unless deleted since
+    void forget_added(const std::vector<str_t>& paths);
+    void clear() noexcept;
+};
+
+// Watches a directory tree and records changes to a `delta_segment`.
+// Implemented with inotify(7) on Linux; unsupported elsewhere.
+class fs_watcher {
+    std::shared_ptr<delta_segment> _delta;
+    std::vector<str_t> _pruned_paths;
+    // Watch descriptor to watched directory
+    std::unordered_map<int, str_t> _wd_paths;
+    // Size of the above, read by other threads
+    std::atomic<size_t> _nwatches = 0;
+    std::thread _watch_thread;
+    std::atomic<bool> _stopped;
+    int _fd;
+
+    bool is_pruned(const str_t& fullp) const;
+    // Watch `path` and its sub directories. If `record`, their content
+    // are also recorded as created.
+    void __add_watch_recursive(const str_t& path, bool record);
+    void __rm_watch_recursive(const str_t& path);
+    void __watch_loop();
+
+public:
+    // Start watching `root` and its sub directories except `pruned`.
+    // Return false if inotify is unsupported or could not be initialized.
+    // Directories beyond the inotify watch limit are not watched.
+    bool start(str_t root, std::vector<str_t> pruned);
+    // Stop watching; recorded changes are kept
+    void stop() noexcept;
+    bool running() const noexcept { return !_stopped; }
+    size_t watch_count() const noexcept { return _nwatches; }
+    const std::shared_ptr<delta_segment>& delta() const noexcept {
+        return _delta;
+    }
+
+    fs_watcher(std::shared_ptr<delta_segment> delta)
+        : _delta(std::move(delta)), _stopped(true), _fd(-1) {}
+    fs_watcher(const fs_watcher&) = delete;
+    fs_watcher& operator=(const fs_watcher&) = delete;
+    ~fs_watcher() { stop(); }
+};
+
+} // namespace dmp
+} // namespace orie
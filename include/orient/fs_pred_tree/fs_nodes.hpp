@@ -18,6 +18,7 @@ namespace pred_tree {
 
 using fs_node = node<fs_data_iter, sv_t>;
 using fs_mod_node = mod_base_node<fs_data_iter, sv_t>;
+using fs_plan = index_plan<fs_data_iter>;
 using fuzz_cache = rapidfuzz::fuzz::CachedPartialRatio<char_t>;
 
 /* Predicates that require no syscalls; info read directly from fs dump */
@@ -101,6 +102,27 @@ class updir_node;
 // TODO: Action Modifiers
 // -prune-if -delete-if -[f]print[f]-if -exec-if
 
+// Candidate batches of a trigram query in the index of an iterator,
+// planned by name predicates
+class trigram_plan : public fs_plan {
+    dmp::trigram_query _query;
+    size_t _fuzz_thresh;
+    uint32_t _head = 0;
+    bool _started = false;
+
+public:
+    const dmp::trigram_query& query() const noexcept { return _query; }
+
+    uint32_t next_from(uint32_t at) override;
+    void step(fs_data_iter& it, fs_plan& cands) override;
+    void stop(fs_data_iter& it) override { it.close_index_view(); }
+
+    // `query` has its needle set, and candidates are those of it in the
+    // index of `it`. See `fs_data_iter::change_batch` for `fuzz_thresh`.
+    trigram_plan(const dmp::trigram_query& query, const fs_data_iter& it,
+                 size_t fuzz_thresh = 0);
+};
+
 class glob_node : public fs_node {
 // Because of the "non-idiomatic" inheritance of strstr_node,
 // "protected" must be used instead of "private"
@@ -133,9 +155,10 @@ public:
     bool next_param(sv_t param) override;
 
     bool faster_with_next(bool t) override {
-        return t && !_is_lname && _query.trigram_size();
+        return t && !_is_lname && _query.indexable();
     }
     void next(fs_data_iter& it, const fs_data_iter&, bool t) override;
+    std::unique_ptr<fs_plan> plan(fs_data_iter& it) override;
 
     glob_node(bool full = false, bool lname = false, bool icase = false);
     glob_node(const glob_node& rhs);
@@ -173,16 +196,33 @@ class regex_node : public fs_node {
     bool _is_lname;
     bool _is_icase;
 
+    // Literals required by the pattern, looked up in the index
+    std::shared_ptr<const dmp::regex_literals> _lits;
+    std::shared_ptr<fs_plan> _plan;
+    fs_data_iter* _last_match = nullptr;
+
+    std::unique_ptr<fs_plan> __plan_of(const dmp::regex_literals& lits,
+                                       fs_data_iter& it) const;
+
 public:
     double success_rate() const noexcept override { return 0.05; }
     double cost() const noexcept override { return 1e-6; }
     fs_node* clone() const override {
-        return new regex_node(*this);
+        regex_node* res = new regex_node(*this);
+        res->_plan.reset();
+        res->_last_match = nullptr;
+        return res;
     }
 
     bool apply_blocked(fs_data_iter& it) override; 
     bool next_param(sv_t param) override;
 
+    bool faster_with_next(bool t) override {
+        return t && !_is_lname && _lits != nullptr && !_lits->any();
+    }
+    void next(fs_data_iter& it, const fs_data_iter& end, bool t) override;
+    std::unique_ptr<fs_plan> plan(fs_data_iter& it) override;
+
     regex_node(bool full = false, bool exact = false,
                bool lname = false, bool icase = false) 
         : _match_dat(pcre2_match_data_create(16, nullptr), pcre2_match_data_free)
@@ -214,6 +254,7 @@ public:
                _query.trigram_size() >= 4;
     }
     void next(fs_data_iter& it, const fs_data_iter&, bool t) override;
+    std::unique_ptr<fs_plan> plan(fs_data_iter& it) override;
 
     bool apply_blocked(fs_data_iter& it) override; 
     bool next_param(sv_t param) override;
@@ -4,6 +4,9 @@
 #include <memory>
 #include <iterator>
 #include <ctime>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
 
 #include "excepts.hpp"
 
@@ -82,6 +85,82 @@ enum CONDS : int8_t {
     NOT_MASK = 4
 };
 
+/** @class index_plan
+ * @brief Candidates of a predicate looked up in an index: ascending positions
+ * in it (like batches of an inverted index), out of which no iterator
+ * satisfies the predicate. Planned by @a node::plan and merged by
+ * @c cond_node, so that only iterators at candidates are tested.
+ * @tparam iter_t Type of iterator being judged */
+template <class iter_t> struct index_plan {
+    /** @brief The first candidate not before @p at, or ~uint32_t() if none.
+     * @note @p at never decreases between calls. */
+    virtual uint32_t next_from(uint32_t at) = 0;
+    /** @brief Increment @p it, and move it to the next candidate of
+     * @p cands if it leaves a candidate. @p cands is this plan or a plan
+     * merged from it. */
+    virtual void step(iter_t& it, index_plan& cands) = 0;
+    /** @brief Called on @p it when a @a node::next visiting candidates
+     * stops at it. Base impl does nothing. */
+    virtual void stop(iter_t&) {}
+    virtual ~index_plan() noexcept = default;
+};
+
+/** @class merged_plan
+ * @brief Union or intersection of candidates of many plans, for the OR or
+ * AND of the predicates planned. Iterators are moved by the first plan. */
+template <class iter_t>
+class merged_plan : public index_plan<iter_t> {
+    std::vector<std::unique_ptr<index_plan<iter_t>>> _plans;
+    bool _union;
+
+public:
+    uint32_t next_from(uint32_t at) override {
+        if (_union) {
+            // K-way merge of the candidates
+            uint32_t res = ~uint32_t();
+            for (auto& p : _plans)
+                res = std::min(res, p->next_from(at));
+            return res;
+        }
+        // Leapfrog until all plans agree on a candidate
+        for (size_t i = 0, agreed = 0; agreed < _plans.size();
+             i = (i + 1) % _plans.size()) {
+            uint32_t cand = _plans[i]->next_from(at);
+            if (cand == ~uint32_t())
+                return cand;
+            if (cand == at)
+                ++agreed;
+            else {
+                at = cand;
+                agreed = 1;
+            }
+        }
+        return at;
+    }
+    void step(iter_t& it, index_plan<iter_t>& cands) override {
+        _plans[0]->step(it, cands);
+    }
+    void stop(iter_t& it) override { _plans[0]->stop(it); }
+
+    /** @brief Plan of the union ( @p is_union ) or intersection of @p lhs
+     * and @p rhs, flattening those merged the same way */
+    static std::unique_ptr<index_plan<iter_t>> merge(
+        std::unique_ptr<index_plan<iter_t>> lhs,
+        std::unique_ptr<index_plan<iter_t>> rhs, bool is_union)
+    {
+        std::unique_ptr<merged_plan> res(new merged_plan);
+        res->_union = is_union;
+        for (auto* p : { &lhs, &rhs }) {
+            auto* m = dynamic_cast<merged_plan*>(p->get());
+            if (m != nullptr && m->_union == is_union)
+                for (auto& sub : m->_plans)
+                    res->_plans.push_back(std::move(sub));
+            else res->_plans.push_back(std::move(*p));
+        }
+        return res;
+    }
+};
+
 /** @class orie::pred_tree::node
  * @brief A tree-shaped predicate judging whether a iterator satisfies
  * the predicate it describes.
@@ -118,7 +197,10 @@ public:
      * @warning @p it != @p end
      * @note Base impl simply iterates @p it in a loop, calling @a apply_blocked.
      * @note May be faster than pure iteration. Whether it is faster can be queried
-     * with @a faster_with_next( @p true_or_false ) */
+     * with @a faster_with_next( @p true_or_false )
+     * @note Called again with the same @p it (by address), nodes faster with
+     * @a next move past where they stopped, keeping state of @p it in between.
+     * Others, like the base impl, stay there; increment @p it first. */
     virtual void next(iter_t& it, const iter_t& end, bool true_or_false) {
         while (it != end && apply_blocked(it) == true_or_false)
             ++it;
@@ -143,6 +225,13 @@ public:
     }
     // Is using `next` faster than simple iteration?
     virtual bool faster_with_next(bool) { return false; }
+    /** @brief Look up candidates where the predicate may be true for
+     * iterators like @p it in an index they iterate.
+     * @return Null if the predicate cannot be planned with an index.
+     * @note Base impl returns null. */
+    virtual std::unique_ptr<index_plan<iter_t>> plan(iter_t&) {
+        return nullptr;
+    }
 
     /** @brief Some node accept options as strings, which are parsed by passing them here.
      * @param param The next option string to be parsed.
@@ -324,6 +413,20 @@ class cond_node : public node<iter_t, sv_t> {
     iter_t _next_res[2];
     // It will never be dereferenced and is often dangling
     iter_t* _last_match;
+    // Candidates of `next` planned for the iterator `_planned_for`
+    std::shared_ptr<index_plan<iter_t>> _plan;
+    iter_t* _planned_for = nullptr;
+
+    // Plan `_plan` if `it` is not the iterator planned for, otherwise
+    // step past the last result. False if `it` cannot be planned.
+    bool __plan_for(iter_t& it, const iter_t& end) {
+        if (&it != _planned_for) {
+            _plan = plan(it);
+            _planned_for = &it;
+        } else if (_plan && it != end)
+            _plan->step(it, *_plan);
+        return _plan != nullptr;
+    }
 
 public:
     bool communicative() const noexcept override { return _commu; }
@@ -475,6 +578,15 @@ public:
         CONDS cond_true = t ? _cond : CONDS(_cond ^ CONDS::NOT_MASK);
         node<iter_t, sv_t> *lhs = _left.get(), *rhs = _right.get();
 
+        // Test only candidates merged from indexes of children
+        if (t && (_cond == CONDS::AND || _cond == CONDS::OR) &&
+            __plan_for(it, end)) {
+            while (it != end && !apply_blocked(it))
+                _plan->step(it, *_plan);
+            _plan->stop(it);
+            return;
+        }
+
         switch (cond_true) {
         case CONDS::XOR: case CONDS::XNOR:
             return node<iter_t, sv_t>::next(it, end, t);
@@ -529,6 +641,18 @@ public:
         CONDS cond_true = t ? _cond : CONDS(_cond ^ CONDS::NOT_MASK);
         node<iter_t, sv_t> *lhs = _left.get(), *rhs = _right.get();
 
+        if (t && (_cond == CONDS::AND || _cond == CONDS::OR) &&
+            __plan_for(it, end)) {
+            for (; it != end; _plan->step(it, *_plan)) {
+                tribool_bad res = apply(it);
+                if (res.is_uncertain() || res == tribool_bad::True) {
+                    _plan->stop(it);
+                    return res.is_uncertain();
+                }
+            }
+            return false;
+        }
+
         switch (cond_true) {
         case CONDS::XOR: case CONDS::XNOR:
             return node<iter_t, sv_t>::next_or_uncertain(it, end, t);
@@ -594,11 +718,34 @@ public:
         return false;// End iterator reached
     }
 
+    // Candidates of AND are those of either child, and those of OR are
+    // those of both
+    std::unique_ptr<index_plan<iter_t>> plan(iter_t& it) override {
+        if (_cond != CONDS::AND && _cond != CONDS::OR)
+            return nullptr;
+        auto lplan = _left->plan(it);
+        if (!lplan && _cond == CONDS::OR)
+            return nullptr;
+        auto rplan = _right->plan(it);
+        if (!lplan || !rplan) {
+            if (_cond == CONDS::OR)
+                return nullptr;
+            return lplan ? std::move(lplan) : std::move(rplan);
+        }
+        return merged_plan<iter_t>::merge(std::move(lplan), std::move(rplan),
+                                          _cond == CONDS::OR);
+    }
+
+    // Copies plan for iterators of their own
     node<iter_t, sv_t>* clone() const override {
-        return new cond_node<iter_t, sv_t>(*this);
+        cond_node<iter_t, sv_t>* res = new cond_node<iter_t, sv_t>(*this);
+        res->_plan.reset();
+        res->_planned_for = nullptr;
+        return res;
     }
     node<iter_t, sv_t>* clone_deep() const override {
-        cond_node<iter_t, sv_t>* res = new cond_node<iter_t, sv_t>(*this);
+        cond_node<iter_t, sv_t>* res =
+            static_cast<cond_node<iter_t, sv_t>*>(clone());
         res->setprev(_left->clone_deep(), true);
         res->setprev(_right->clone_deep(), false);
         return res;
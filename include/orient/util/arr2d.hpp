@@ -1,11 +1,26 @@
 #pragma once
 #include <orient/fs/predef.hpp>
 #include <orient/util/compresslib/intersection.h>
+#include <deque>
+#include <memory>
 #include <shared_mutex>
+#include <unordered_map>
 
+// Each call to `append_pending_to_file` writes a page, which is either dense,
+// with an offset for every row up to the last non-empty one, or sparse, with
+// a directory of the non-empty rows only, sorted by row number. Pages are
+// sparse iff any row is at least `dense_rows`, so that the file does not
+// grow with the number of possible rows.
 struct arr2d_writer {
+    // Rows below this are kept in `_data_pending` and may be in dense pages.
+    // Covers trigram keys of the default width, their ancestor keys, and
+    // bigram and extension keys.
+    static constexpr size_t dense_rows = 32768;
+
     orie::str_t _saving_path;
     std::vector<std::vector<uint32_t>> _data_pending;
+    // Rows not less than `dense_rows`
+    std::unordered_map<uint32_t, std::vector<uint32_t>> _sparse_pending;
 
     void add_int(size_t row, uint32_t val);
     // Throw runtime error if write failed; data pending unchanged
@@ -32,12 +47,14 @@ private:
     const uint32_t* _mapped_data;
     size_t _mapped_sz;
 
-    // Cache the starting point of a page for repeated access
-    mutable uint32_t _cache_page_idx;
-    mutable uint32_t _cache_page_offset;
-    mutable std::mutex _cache_mut;
+    // Offset of each page in the file, found by walking the page chain
+    // on `refresh`. Guarded by `_access_mut` like the mapped data.
+    std::vector<uint32_t> _page_offs;
     mutable std::shared_mutex _access_mut;
 
+    // Walk the pages mapped and fill `_page_offs`
+    void __index_pages();
+
     // Tuple of offset to compressed data, compressed and decompressed size
     // [0, -1, -1] if page is out of bound
     // [0, 0, 0] if line is out of bound but page is not
@@ -46,7 +63,9 @@ private:
     // Get the offset of `page` in the file.
     // Matching it against `~uint32_t()` is useful in determining whether
     // a page exists or not.
-    uint32_t page_offset(size_t page) const noexcept;
+    uint32_t page_offset(size_t page) const noexcept {
+        return page < _page_offs.size() ? _page_offs[page] : ~uint32_t();
+    }
 
 public:
     // Write decompressed data to out and total size (in 4 bytes).
@@ -63,6 +82,14 @@ public:
     // ~uint32_t() if page is out of bound, 0 if line is empty or out of bound
     // no throw because out of bound is common :)
     uint32_t uncmprs_size(size_t line, size_t page) const noexcept;
+    // `uncmprs_size` of `nline` lines at a time into `out`, locking once
+    void uncmprs_sizes(const uint32_t* lines, size_t nline, size_t page,
+                       uint32_t* out) const noexcept;
+    // Number of integers in each of `nline` lines over all pages into
+    // `out`, locking once
+    void line_totals(const uint32_t* lines, size_t nline,
+                     size_t* out) const noexcept;
+    size_t page_count() const noexcept;
     const orie::str_t& saving_path() const noexcept { return _map_path; }
 
     // Move the database file elsewhere. 
@@ -98,38 +125,91 @@ public:
     ~arr2d_reader() noexcept;
 };
 
+namespace orie {
+class fifo_thpool;
+}
+
 // THREAD UNSAFE semi-lazy invert index queryer
 // Create multiple queries for thread safety
 // Can query both intersection and frequency (for fuzzy search)
+// With `set_parallel`, pages after the current one are decoded and
+// intersected on a thread pool, at most `window` pages ahead, and results
+// are still returned in ascending order.
 class arr2d_intersect {
     const arr2d_reader* _reader;
     // Lazily evaluate results, one page at a time
     std::vector<uint32_t> _cur_page_res;
-    compressionLib::fastPForCodec _codec;
     uint32_t _next_page_idx;
 
+    // Buffers for evaluating a page; each pool worker has its own
+    struct page_buf;
+    std::unique_ptr<page_buf> _buf;
+
+    // A page evaluated ahead on the pool. Whoever sets `claimed` first,
+    // the worker or the query, evaluates it.
+    struct page_job;
+    orie::fifo_thpool* _pool = nullptr;
+    size_t _window = 0;
+    std::deque<std::shared_ptr<page_job>> _jobs;
+    // What the jobs compute: lines, and min frequency or redundancy
+    std::shared_ptr<const std::vector<uint32_t>> _job_lines;
+    std::shared_ptr<const std::vector<std::pair<uint32_t, uint32_t>>>
+        _job_pairs;
+    bool _job_frequent = false;
+    uint32_t _job_param = 0;
+
+    // Evaluate `page` into `res`, in descending order. False if the page
+    // is out of bound.
+    static bool __intersect_page(const arr2d_reader& reader,
+        const std::vector<uint32_t>& lines,
+        const std::vector<std::pair<uint32_t, uint32_t>>& pairs,
+        size_t page, size_t redundancy,
+        page_buf& buf, std::vector<uint32_t>& res);
+    static bool __frequent_page(const arr2d_reader& reader,
+        const std::vector<uint32_t>& lines, size_t page, uint32_t min_freq,
+        page_buf& buf, std::vector<uint32_t>& res);
+    // Fill `_cur_page_res` with the next page evaluated on the pool.
+    // False if no more pages.
+    bool __next_page_parallel(bool frequent, uint32_t param);
+    // Wait for or take back jobs given to the pool
+    void __cancel_jobs() noexcept;
+
 public:
     // Modify it before any call to next_intersect or before rewind
     // otherwise the behavior is undefined.
     std::vector<uint32_t> _lines_to_query;
+    // Pairs of lines whose unions are intersected along with the lines
+    // above by next_intersect; next_frequent ignores them. Same as above.
+    std::vector<std::pair<uint32_t, uint32_t>> _line_pairs_to_query;
 
     // ~uint32_t when finished, i.e., no more intersections
     uint32_t next_intersect(size_t redundancy = 0);
     // ~uint32_t when finished, i.e., no more integersappearing more than
     // `min_freq` times in `_lines_to_query`
     uint32_t next_frequent(uint32_t min_freq);
-    void rewind() noexcept { _next_page_idx = 0; _cur_page_res.clear(); }
+    void rewind() noexcept {
+        __cancel_jobs();
+        _next_page_idx = 0;
+        _cur_page_res.clear();
+    }
 
     // Reader is nullable and can be set later
     void set_reader(const arr2d_reader *reader) noexcept {
-        _reader = reader;
         rewind();
+        _reader = reader;
     }
     const arr2d_reader* reader() const noexcept { return _reader; }
+    // Evaluate up to `window` pages ahead on `pool`; 0 for the number of
+    // workers. Pages are evaluated on the calling thread if `pool` is null
+    // or has no workers.
+    void set_parallel(orie::fifo_thpool* pool, size_t window = 0) noexcept;
 
     // Reader is nullable and can be set later
-    arr2d_intersect(const arr2d_reader* reader = nullptr)
-        : _reader(reader), _next_page_idx(0) {}
+    arr2d_intersect(const arr2d_reader* reader = nullptr);
+    // Copies do not share the pages evaluated ahead
+    arr2d_intersect(const arr2d_intersect& rhs);
+    arr2d_intersect& operator=(const arr2d_intersect& rhs);
+    ~arr2d_intersect() noexcept;
 
     static std::vector<uint32_t>
     decompress_entire_line(uint32_t line, const arr2d_reader* reader);
@@ -371,6 +371,7 @@ next_token(const char_t* src, size_t src_size) {
     size_t res_len = res.find_last_not_of(char_t(0));
     if (res_len != res.npos)
         res.erase(res_len + 1);
+    else res.clear(); // Empty quotes
     return std::make_pair(src_at, res);
 }
 
@@ -18,6 +18,47 @@ namespace compressionLib {
 size_t i32_intersect(const uint32_t *A, const size_t s_a,
                       const uint32_t *B, const size_t s_b, uint32_t *out);
 
+/**
+ * All intersection kernels below write ascending results to out, which must
+ * have room for `i32_intersect_slack` more integers than the smaller input,
+ * since SIMD kernels store whole vectors.
+ */
+constexpr size_t i32_intersect_slack = 8;
+
+/**
+ * Exponential search of each element of the shorter list in the longer one,
+ * whose cost grows with the shorter list only, logarithmically in the longer.
+ */
+size_t i32_intersect_galloping(const uint32_t *A, const size_t s_a,
+                               const uint32_t *B, const size_t s_b,
+                               uint32_t *out);
+
+/**
+ * Same as `i32_intersect`, comparing 8 or 16 integers at a time.
+ * Only call them if `cpu_has_avx2` or `cpu_has_avx512` respectively.
+ * They are `i32_intersect` where the compiler cannot target them.
+ */
+size_t i32_intersect_avx2(const uint32_t *A, const size_t s_a,
+                          const uint32_t *B, const size_t s_b, uint32_t *out);
+size_t i32_intersect_avx512(const uint32_t *A, const size_t s_a,
+                            const uint32_t *B, const size_t s_b, uint32_t *out);
+bool cpu_has_avx2() noexcept;
+bool cpu_has_avx512() noexcept;
+
+/**
+ * Galloping is chosen if one list is this many times longer than the other.
+ */
+constexpr size_t i32_gallop_ratio = 32;
+
+/**
+ * Intersect with the kernel best for the sizes and the CPU: galloping for
+ * skewed sizes, or else AVX2 if available and SSE otherwise.
+ * Test/bench_intersect.cc compares them on real posting lists.
+ */
+size_t i32_intersect_adaptive(const uint32_t *A, const size_t s_a,
+                              const uint32_t *B, const size_t s_b,
+                              uint32_t *out);
+
 using fastPForCodec = CompositeCodec<FastPFor<8, true>, VariableByte<true>>;
 
 } // namespace SIMDCompressionLib
@@ -1,83 +1,302 @@
 #pragma once
 #include <orient/fs/predef.hpp>
 #include <zstd.h>
+#include <cstdio>
 #include <string>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
 #include <shared_mutex>
+#include <atomic>
+#include <condition_variable>
 
 namespace orie {
 namespace dmp {
 
-// At most 4095 chunks of raw data with at most 8 chunks in memory
-// Others are stored in a file
+// Chunks of raw data, some of which are decompressed in memory within a
+// byte budget. Others are stored in a file
+// Added chunks are compressed and written to the file by background
+// threads, in the order they are added.
+// The file starts with a versioned header, followed by compressed chunks
+// and then the table of their offsets, which is rewritten by `flush`.
+// Since version 3, each chunk is a table of independent zstd frames
+// followed by the frames, which start at seek points marked by the writer;
+// visiting a chunk only decompresses the frames visited. Files of older
+// versions are opened read-only, and their chunks are single frames.
+// Frames are decompressed straight from a read-only mapping of the file,
+// except on Windows where they are read.
+//
+// Visiting the start of a chunk right after the chunk before it reads
+// ahead the rest of it and the next few chunks in a background thread.
+//
+// Cached chunks are pinned by readers with atomic reference counts, and
+// evicted with the 2Q policy: chunks loaded once wait in a FIFO probation
+// queue, and only those loaded again soon after eviction join the
+// protected ones, which are evicted by CLOCK. A full scan thus only
+// evicts chunks in probation and never a few hot ones.
 class file_mem_chunk {
+public:
+    // Parameters a file is built with, recorded in its header
+    // 0 if unknown, which is the case of version 1 files
+    struct build_params_t {
+        uint64_t chunk_size_hint = 0;
+        uint32_t nfile_in_batch = 0;
+        // Width of keys of the inverted index built along
+        uint32_t trigram_bits = 0;
+        // 1 if the inverted index also has keys of trigrams of names of
+        // ancestor directories in each batch
+        uint32_t ancestor_keys = 0;
+        // 1 if it also has keys of bigrams and extensions of basenames
+        uint32_t short_keys = 0;
+        // 1 if it also has keys of where basenames start and end
+        uint32_t anchor_keys = 0;
+    };
+    // Chunk slots are allocated by pages
+    static constexpr size_t slot_page = 4096;
+    static constexpr size_t max_slot_pages = 16384;
+    // Maximum number of chunks
+    static constexpr size_t max_chunks = slot_page * max_slot_pages - 1;
+    // Number of chunks loaded into memory concurrently
+    static constexpr size_t load_shards = 16;
+    // Raw bytes in a frame before a seek point starts another one
+    static constexpr size_t frame_size_hint = 64 * 1024;
+
 private:
-    // Index of cache containing the chunk, >=8 for none
-    // 4096-sized heap-alloced array
-    uint8_t* _chunkid_to_cacheid;
-    // Presum of size in bytes of each chunk
-    // 4096-sized heap-alloced array
-    size_t* _chunk_size_presum;
-
-    // Compression Context
-    ZSTD_CCtx* _cctx;
-    // Decompression Context
-    ZSTD_DCtx* _dctx;
-
-    // Content of each cache
-    std::vector<std::byte> _cached_dat[8];
-    // Chunk index of each cache; only lower 12 bits used
-    uint32_t _cacheid_to_chunkid[8];
+    // Presum of compressed size in bytes of each chunk, starting from 0.
+    // Has an entry for each chunk written or being written to file.
+    // Guarded by `_pipe_mut` since the writer thread appends to it.
+    std::vector<uint64_t> _chunk_size_presum;
+
+    // A decompressed chunk in memory. Defined in file_mem_chunk.cpp.
+    struct entry_t;
+    // Pinned or evicted entries are never freed before `clear` or
+    // destruction, so that readers can try pinning them without locks.
+    // Slots of chunks, null if not in memory, `slot_page` in each page.
+    std::unique_ptr<std::atomic<entry_t*>[]> _slot_pages[max_slot_pages];
+    std::atomic<entry_t*>& __slot(uint32_t chunk_idx) const noexcept {
+        return _slot_pages[chunk_idx / slot_page][chunk_idx % slot_page];
+    }
+
+    // Replacement states, guarded by `_cache_mut`
+    mutable std::mutex _cache_mut;
+    std::deque<std::unique_ptr<entry_t>> _entries;
+    std::vector<entry_t*> _free_entries;
+    std::deque<entry_t*> _probation;
+    std::vector<entry_t*> _protected;
+    size_t _clock_hand;
+    // Chunks recently evicted from probation
+    std::deque<uint32_t> _ghosts;
+    size_t _cached_bytes, _probation_bytes, _cache_budget;
+
+    // Each chunk is loaded by one reader at a time, holding the mutex of
+    // its shard and using its decompression context
+    std::mutex _load_muts[load_shards];
+    ZSTD_DCtx* _dctxs[load_shards];
+
+    // Pin `chunk_idx`th chunk if it is in memory; null otherwise
+    entry_t* __pin(uint32_t chunk_idx) noexcept;
+    // Load the frame table of `chunk_idx`th chunk and the frame holding
+    // its `at`th byte from file, and pin it
+    entry_t* __load(uint32_t chunk_idx, size_t at);
+    // Decompress the frame of pinned `e` holding `at`th byte if not yet
+    void __reveal(entry_t* e, uint32_t chunk_idx, size_t at);
+    // Decompress `f`th frame of pinned `e`. The shard mutex is held.
+    void __decode_frame(entry_t* e, size_t f, size_t shard);
+    // Read the frame table of `chunk_idx`th chunk: raw offsets of frames
+    // followed by the raw size, and offsets of compressed frames followed
+    // by their end. Throw runtime error if invalid.
+    void __read_frame_table(uint32_t chunk_idx, std::vector<uint64_t>& raw_at,
+                            std::vector<uint64_t>& cmprs_at);
+    // Call `fn` with `n` bytes of chunk data at `at`, in the mapping of the
+    // file if possible. Throw runtime error if beyond the file.
+    template <class fn_t>
+    void __with_data(uint64_t at, size_t n, fn_t fn);
+    // Map the file again for at least `end` bytes. `_file_mut` held.
+    void __remap(uint64_t end);
+    void __unmap() noexcept;
+    // Take a free entry and make room for `bytes` more in memory, for the
+    // `chunk_idx`th chunk. Locks `_cache_mut`.
+    entry_t* __make_room(uint32_t chunk_idx, size_t bytes);
+    // Count `bytes` more decoded in pinned `e`, evicting others if over
+    // budget. Locks `_cache_mut`.
+    void __account(entry_t* e, size_t bytes);
+    // Evict an unpinned entry; false if all are pinned. `_cache_mut` held.
+    bool __evict_one() noexcept;
+    // Make `e` of `chunk_idx`th chunk visible to readers with `pins` pins
+    void __publish(entry_t* e, uint32_t chunk_idx, uint32_t pins) noexcept;
+    // Drop all entries. No chunk may be pinned.
+    void __drop_cache() noexcept;
+
+    // Number of chunks read ahead after the visited one
+    std::atomic<unsigned> _readahead;
+    // Chunks to decompress entirely by `_prefetcher`
+    std::deque<uint32_t> _prefetch_queue;
+    std::mutex _prefetch_mut;
+    std::condition_variable _prefetch_cv;
+    std::thread _prefetcher;
+    bool _prefetch_stop;
+    // Queue `chunk_idx`th chunk and `_readahead` ones after it
+    void __prefetch(uint32_t chunk_idx);
+    void __prefetch_loop();
+    // Stop `_prefetcher` and forget queued chunks
+    void __stop_prefetch() noexcept;
 
 public:
     // Final block is not in file yet and can be freely modified
     std::vector<std::byte> _unplaced_dat;
 
 private:
-    // For reader-writer synchonization
-    std::shared_mutex _buf_mut;
+    // Where frames of `_unplaced_dat` start, starting from 0
+    std::vector<uint64_t> _frame_starts;
+    // Guards `_saving_path` from `move_file` while readers open it, and
+    // the mapping of the file from being remapped while read
+    std::shared_mutex _file_mut;
+    // Read-only mapping of the file, of which `_map_valid` bytes were in
+    // the file when mapped. Null on Windows.
+    const std::byte* _map;
+    size_t _map_len, _map_valid;
+
+    // Decompressed copy of the first `_hot_chunks` chunks, the `i`th of
+    // which starts at `_hot_at[i]`; see `make_hot`
+    std::byte* _hot;
+    size_t _hot_len;
+    std::vector<uint64_t> _hot_at;
+    uint32_t _hot_chunks;
 
     // File to save memory not in cache
     str_t _saving_path;
-    uint32_t _chunk_num; // Amount of total chunks in file
-    uint8_t _next_overwrite; // Index of cache to get overwritten next (FIFO)
-    const uint8_t _cache_num; // Amount of cache blocks
+    uint64_t _data_offset; // Where chunks start in file
+    uint32_t _version; // Format version of the file
+    build_params_t _params;
+    bool _table_stale; // Table and header in file are not up to date
+    std::atomic<uint32_t> _chunk_num; // Amount of total chunks
+
+    // Added chunks not written to file yet, in chunk order.
+    // Defined in file_mem_chunk.cpp.
+    struct pending_t;
+    std::deque<std::unique_ptr<pending_t>> _pending;
+    mutable std::mutex _pipe_mut;
+    mutable std::condition_variable _pipe_cv;
+    std::vector<std::thread> _compressors;
+    std::thread _writer;
+    // Amount of chunks in file; chunks after it are in `_pending`
+    uint32_t _chunk_written;
+    bool _pipe_stop;
+    // Error occurred in background threads, thrown by `flush`
+    std::string _pipe_error;
 
-    void __writer_lock() noexcept; // `finish_visit` is writer unlock
+    void __compress_loop();
+    void __write_loop();
+    // Wait until `chunk_idx`th chunk is written to file, and return the
+    // range of its compressed data relative to `_data_offset`
+    std::pair<uint64_t, uint64_t> __wait_written(uint32_t chunk_idx) const;
+    // Write the table of chunk offsets after the last chunk, then the
+    // header. Return false on failure.
+    bool __write_table(FILE* fp);
+    // Read the header and the table of chunk offsets
+    // Throw runtime error if the file is invalid.
+    void __read_table(FILE* fp);
 
 public:
-    // TODO: 0 is too generic
-    static constexpr size_t magic_num = 0;
+    // First 8 bytes of files of version 2 and later
+    static constexpr char magic[8] = { 'o', 'r', 'i', 'e', 'F', 'W', 'D', '\0' };
+    // Version 1 files start with this instead
+    static constexpr uint64_t v1_magic_num = 0;
+    // Format version of new files
+    static constexpr uint32_t version = 3;
+    // Number of background compressing threads
+    static constexpr unsigned compress_threads = 2;
+    // Chunks read ahead by default
+    static constexpr unsigned default_readahead = 1;
+    // Maximum number of added chunks waiting to be written; `add_last_chunk`
+    // blocks when reached.
+    static constexpr size_t max_pending_chunks = 8;
     // Remove the memory file on destruction
     bool _rmfile_on_dtor;
 
     // Final block is not in file yet and can be freely modified
     // Modifications on this block is NOT thread safe to any functions
     std::vector<std::byte>& chunk_to_add() noexcept { return _unplaced_dat; };
-    uint32_t chunk_count() const noexcept { return _chunk_num; }
+    // Readers may start visiting the chunk to add from its current end.
+    // A frame starts here if the current one has `frame_size_hint` bytes.
+    void mark_seek_point() {
+        if (_unplaced_dat.size() - _frame_starts.back() >= frame_size_hint)
+            _frame_starts.push_back(_unplaced_dat.size());
+    }
+    uint32_t chunk_count() const noexcept { return _chunk_num.load(); }
     size_t chunk_size(uint32_t at) const;
     const str_t& saving_path() const noexcept { return _saving_path; }
+    uint32_t file_version() const noexcept { return _version; }
+    // Files of older versions cannot be added to, but can be cleared
+    bool read_only() const noexcept { return _version < version; }
+    const build_params_t& build_params() const noexcept { return _params; }
+    // Recorded in file by the next `flush`
+    void set_build_params(const build_params_t& p) noexcept {
+        _params = p;
+        _table_stale = true;
+    }
+
+    unsigned readahead() const noexcept { return _readahead.load(); }
+    // Read ahead `depth` chunks after one visited in order; 0 disables it
+    void set_readahead(unsigned depth) noexcept { _readahead.store(depth); }
+
+    size_t cache_budget() const noexcept { return _cache_budget; }
+    // Chunks are evicted once decompressed ones take more bytes, unless
+    // all of them are pinned
+    void set_cache_budget(size_t bytes);
+    // Bytes of decompressed frames in memory
+    size_t cached_bytes() const;
+    // Whether any frame of `chunk_idx`th chunk is decompressed in memory
+    bool cached(uint32_t chunk_idx) const noexcept {
+        return chunk_idx < _hot_chunks || (chunk_idx < chunk_count() &&
+                                           __slot(chunk_idx).load() != nullptr);
+    }
+
+    // Decompress all chunks added so far into a read-only mapped copy, in
+    // an unlinked file under `dir` (like a tmpfs) or in anonymous memory if
+    // `dir` is empty, and drop the cache. Visiting those chunks then takes
+    // no locks, pins nor copies; chunks added later are cached as usual.
+    // Throw runtime error on failure, in which case nothing changes.
+    // No chunk may be being visited. Not supported on Windows.
+    void make_hot(const str_t& dir);
+    // Free the copy made by `make_hot`. No chunk may be being visited.
+    void drop_hot() noexcept;
+    bool hot() const noexcept { return _hot != nullptr; }
 
     // Write the chunk returned in `chunk_to_add` to file, making it unchangable.
     // Empty chunk will not be added (no-op in that case)
+    // Throw runtime error if `read_only`.
+    // The chunk is readable once this returns, though it is compressed and
+    // written to file in background; call `flush` to wait for that.
     // Note that destructor also calls this function.
     void add_last_chunk();
+    // Wait for all added chunks to be written to file, stop background
+    // threads and update the table of chunks in file, after which the
+    // file is valid to open. Throw runtime error if any of them failed.
+    void flush();
 
-    // Visit the `at`-th byte of `chunk_idx`-th block
-    // The pointer is always valid before calling `finish_visit`
+    // Visit the `at`-th byte of `chunk_idx`-th block, pinning the chunk
+    // The pointer is always valid before calling `finish_visit`, but only
+    // bytes up to the next seek point starting a frame are readable.
     // If exception is thrown (out of bound), no need for `finisg_visit`
     const std::byte* start_visit(uint32_t chunk_idx, size_t at);
-    // Each `start_visit` must call one and only one `finish_visit`
-    void finish_visit() noexcept;
+    // Make bytes from `at` to the next frame readable in `chunk_idx`-th
+    // block pinned by `start_visit`. Pointers returned by it stay valid.
+    void extend_visit(uint32_t chunk_idx, size_t at);
+    // Each `start_visit` must call one and only one `finish_visit` with
+    // the same `chunk_idx`
+    void finish_visit(uint32_t chunk_idx) noexcept;
 
     // Move the memory file to `fpath`.
     // Throw runtime error if no permission, and the file is NOT moved
     void move_file(const char_t* fpath);
-    // Reset memory file and cache.
+    // Reset memory file and cache. The file is rewritten as the current
+    // version even if it was read-only. No chunk may be being visited.
     void clear();
 
-    // Throw runtime error if no permission
-    file_mem_chunk(sv_t fpath, uint8_t cached_chunk_cnt,
+    // Throw runtime error if no permission or the file is invalid
+    file_mem_chunk(sv_t fpath, size_t cache_budget,
                    bool empty, bool rmfile_on_destroy);
     ~file_mem_chunk();
     file_mem_chunk(const file_mem_chunk&) = delete;
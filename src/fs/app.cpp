@@ -1,66 +1,285 @@
 #include <orient/app.hpp>
 #include <orient/fs/dumper.hpp>
+#include <orient/fs/mounts.hpp>
 #include <fstream>
 #include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace orie {
 
+// Make `d` hot under `dir` if set, or cold otherwise.
+// Return false if it failed, in which case it stays cold.
+static bool __make_hot(dmp::dumper& d, const std::optional<str_t>& dir) noexcept {
+    d.drop_hot();
+    if (!dir)
+        return true;
+    try {
+        d.make_hot(*dir);
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
 app& app::set_db_path(const char_t* path) {
     // No lock since std::shared_ptr is thread safe
     _dumper.reset(new dmp::dumper(path, _pool));
+    _dumper->set_delta(_delta);
+    _dumper->set_query_window(_query_window);
+    __make_hot(*_dumper, _hot_index);
+    // Shard databases are named after the new path
+    for (auto& sh : _shards) {
+        str_t root = sh->_root_path;
+        sh.reset(new dmp::dumper(shard_db_path(root), _pool));
+        sh->_root_path = std::move(root);
+        sh->set_delta(_delta);
+        sh->set_query_window(_query_window);
+        __make_hot(*sh, _hot_index);
+    }
     return *this;
 }
 
-app& app::update_db() {
-    if (_dumper == nullptr)
-        throw std::runtime_error("orient database not set with `set_db_path`"
-                                 " or `read_conf`");
-    str_t db_path = _dumper->fwdidx_path();
+app& app::set_hot_index(std::optional<str_t> dir) {
+    _hot_index = std::move(dir);
+    if (_dumper != nullptr)
+        __make_hot(*_dumper, _hot_index);
+    for (auto& sh : _shards)
+        __make_hot(*sh, _hot_index);
+    return *this;
+}
 
-    // Having multiple dumpers running gets no performance gain
-    static std::mutex global_dump_lock;
-    std::lock_guard __lck(global_dump_lock);
+// Whether `path` is `dir` or under it
+static bool __is_under(sv_t path, sv_t dir) noexcept {
+    if (dir.size() == 1) // Root
+        return true;
+    return path.substr(0, dir.size()) == dir &&
+           (path.size() == dir.size() || path[dir.size()] == separator);
+}
 
-    // Move current dumper to a temporary location in case it is being used by
-    // jobs. Old database is also scheduled to be deleted on job finish.
-    try {
-#ifdef _WIN32
-        _dumper->move_file(db_path + std::to_wstring(::rand()));
-#else
-        _dumper->move_file(db_path + std::to_string(::rand()));
-#endif
-    } catch(const std::system_error& e) {
-        // If move fails, the original data remain unchanged.
-        throw std::runtime_error(std::string("Moving original data failed: ") +
-            e.what() + " Is another `orient` instance or other process using it?");
+// Move entries of `names` in directory `parent` of the database of `d`
+// to `res` as full paths, listing `parent` once
+static void __take_indexed(dmp::dumper& d, sv_t parent,
+                           std::unordered_set<sv_t>& names,
+                           std::vector<str_t>& res)
+{
+    fs_data_iter it(&d, parent);
+    it.set_recursive(false);
+    for (; it != it.end() && !names.empty(); ++it) {
+        auto name = names.find(it.basename());
+        if (name == names.end())
+            continue;
+        res.emplace_back(parent);
+        res.back().push_back(separator);
+        res.back() += *name;
+        names.erase(name);
     }
-    _dumper->set_remove_on_destroy(true);
+}
 
-    // Setup the new dumper
-    std::shared_ptr<dmp::dumper> dumper_new(new dmp::dumper(db_path, _pool));
-    dumper_new->_noconcur_paths = _dumper->_noconcur_paths;
-    dumper_new->_root_path = _dumper->_root_path;
-    dumper_new->_pruned_paths = _dumper->_pruned_paths;
+// Special paths shared by all databases of an app
+struct __special_paths {
+    std::vector<str_t> pruned, noconcur;
+    std::vector<std::pair<str_t, unsigned>> concur_limits;
+    std::optional<str_t> hot_index;
+    unsigned trigram_bits = dmp::default_trigram_bits;
+};
+
+// Rebuild the database of `old` at its path, with special paths `conf` and
+// `extra_pruned`. Return the new database; on failure, `old` is kept and
+// an exception is thrown.
+static std::shared_ptr<dmp::dumper>
+__rebuild(const std::shared_ptr<dmp::dumper>& old, const __special_paths& conf,
+          const std::vector<str_t>& extra_pruned, bool incremental)
+{
+    // The new generation is invisible to readers of the database path until
+    // it is published, so the old one needs no moving and remains
+    // functional while dumping, even if being used by jobs.
+    std::shared_ptr<dmp::dumper> dumper_new(
+        new dmp::dumper(old->db_path(), old->_pool, true));
+    dumper_new->_noconcur_paths = conf.noconcur;
+    dumper_new->_concur_limits = conf.concur_limits;
+    dumper_new->_root_path = old->_root_path;
+    dumper_new->_trigram_bits = conf.trigram_bits;
+    dumper_new->set_delta(old->delta());
+    dumper_new->set_query_window(old->query_window());
+    dumper_new->_pruned_paths = conf.pruned;
+    dumper_new->_pruned_paths.insert(dumper_new->_pruned_paths.end(),
+                                     extra_pruned.begin(), extra_pruned.end());
 #ifndef _WIN32
-    chmod(db_path.c_str(), 0600);
+    chmod(dumper_new->fwdidx_path().c_str(), 0600);
+    chmod(dumper_new->invidx_path().c_str(), 0600);
 #endif
 
-    // Dump with the new dumper. While dumping, old dumper remain functional
+    // The old dumper may also provide unchanged directories to the new one.
     try {
-        dumper_new->rebuild_database();
+        dumper_new->rebuild_database(incremental ? old.get() : nullptr);
     } catch(const std::exception& e) {
         // Keep the old one if the new dumper got errors while building.
         dumper_new->set_remove_on_destroy(true);
-        dumper_new.reset();
-        // Move original data back.
-        _dumper->move_file(db_path);
         throw std::runtime_error(std::string("Updatedb failed: ") + e.what() +
             "\nThis is usually caused by invalid or inaccessible root path.");
     }
-    
-    // Destroy old (pointer to) dumper
-    std::lock_guard __lck2(_paths_mut);
-    _dumper = std::move(dumper_new);
+    // Before any job uses it
+    __make_hot(*dumper_new, conf.hot_index);
+    // The old generation is kept for readers in other processes, and
+    // removed by a later `publish`
+    // Extra pruned paths are not part of the configuration
+    dumper_new->_pruned_paths.resize(conf.pruned.size());
+    return dumper_new;
+}
+
+app& app::update_db(bool incremental) {
+    if (_dumper == nullptr)
+        throw std::runtime_error("orient database not set with `set_db_path`"
+                                 " or `read_conf`");
+
+    // Having multiple updatedbs running gets no performance gain
+    static std::mutex global_dump_lock;
+    std::lock_guard __lck(global_dump_lock);
+    // Changes watched after this point may not be in the new database,
+    // while those lost before it are
+    bool delta_overflowed = _delta && _delta->take_overflowed();
+    uint64_t delta_epoch = _delta ? _delta->new_epoch() : 0;
+
+    std::unique_lock __lck2(_paths_mut);
+    // The root database, followed by shards
+    std::vector<std::shared_ptr<dmp::dumper>> olds{ _dumper };
+    olds.insert(olds.end(), _shards.begin(), _shards.end());
+    // Special paths are copied since they may be set while rebuilding
+    __special_paths conf{ _dumper->_pruned_paths, _dumper->_noconcur_paths,
+                          _dumper->_concur_limits, _hot_index,
+                          _dumper->_trigram_bits };
+    __lck2.unlock();
+
+    // Shard roots are excluded from databases other than their own
+    std::vector<str_t> shard_roots;
+    for (size_t i = 1; i < olds.size(); ++i)
+        shard_roots.push_back(olds[i]->_root_path);
+    std::vector<std::shared_ptr<dmp::dumper>> news(olds.size());
+    std::vector<std::string> errors(olds.size());
+    auto rebuild = [&] (size_t i) {
+        std::vector<str_t> extra_pruned(shard_roots);
+        if (i != 0)
+            extra_pruned.erase(extra_pruned.begin() + (i - 1));
+        try {
+            news[i] = __rebuild(olds[i], conf, extra_pruned, incremental);
+        } catch (const std::exception& e) {
+            errors[i] = e.what();
+        }
+    };
+    // Each shard on its own thread, so that devices are read in parallel
+    std::vector<std::thread> shard_threads;
+    for (size_t i = 1; i < olds.size(); ++i)
+        shard_threads.emplace_back(rebuild, i);
+    rebuild(0);
+    for (std::thread& t : shard_threads)
+        t.join();
+
+    // Destroy old (pointers to) dumpers that are rebuilt
+    std::string error_msg;
+    std::vector<std::shared_ptr<dmp::dumper>> rebuilt;
+    for (const auto& d : news)
+        if (d != nullptr)
+            rebuilt.push_back(d);
+    __lck2.lock();
+    for (size_t i = 0; i < olds.size(); ++i) {
+        if (!errors[i].empty()) {
+            if (i != 0)
+                error_msg += "Shard " + xxstrcpy(sv_t(olds[i]->_root_path)) + ": ";
+            (error_msg += errors[i]) += '\n';
+            continue;
+        }
+        if (i == 0)
+            _dumper = std::move(news[i]);
+        else {
+            // The shard may have been erased while rebuilding
+            auto it = std::find(_shards.begin(), _shards.end(), olds[i]);
+            if (it != _shards.end())
+                *it = std::move(news[i]);
+        }
+    }
+    if (delta_overflowed && !error_msg.empty())
+        _delta->set_overflowed(); // Failed databases still miss changes
+    else if (delta_overflowed) {
+        // Served again, having been dropped by `get_jobs`
+        _dumper->set_delta(_delta);
+        for (auto& sh : _shards)
+            sh->set_delta(_delta);
+    }
+    __lck2.unlock();
+    if (_delta) {
+        // Changes in databases failed to rebuild are kept. A path belongs
+        // to the shard with the longest root it is under, or the root one.
+        auto in_rebuilt = [&olds, &errors] (sv_t path) {
+            size_t owner = 0;
+            for (size_t i = 1; i < olds.size(); ++i) {
+                const str_t& root = olds[i]->_root_path;
+                if (__is_under(path, root) &&
+                    (owner == 0 || root.size() > olds[owner]->_root_path.size()))
+                    owner = i;
+            }
+            return errors[owner].empty();
+        };
+        if (error_msg.empty())
+            _delta->drop_before(delta_epoch);
+        else _delta->drop_before(delta_epoch, in_rebuilt);
+        // Entries created while rebuilding may be dumped already. They are
+        // grouped by parent, so that each directory is listed once.
+        dmp::delta_entries added = _delta->added_under(sv_t());
+        std::unordered_map<sv_t, std::unordered_set<sv_t>> names_in;
+        for (const auto& [path, tag] : added) {
+            size_t sep_at = path.find_last_of(separator);
+            names_in[sv_t(path).substr(0, sep_at)].insert(
+                sv_t(path).substr(sep_at + 1));
+        }
+        std::vector<str_t> dumped;
+        for (auto& [parent, names] : names_in)
+            for (const auto& d : rebuilt)
+                if (!names.empty() && __is_under(parent, d->_root_path))
+                    __take_indexed(*d, parent, names, dumped);
+        _delta->forget_added(dumped);
+    }
+    if (!error_msg.empty()) {
+        error_msg.pop_back();
+        throw std::runtime_error(error_msg);
+    }
+    return *this;
+}
+
+bool app::start_watching() {
+    stop_watching();
+    std::unique_lock __lck(_paths_mut);
+    if (_dumper == nullptr)
+        return false;
+    // Copied, since adding watches for the whole tree takes long
+    str_t root = _dumper->_root_path;
+    std::vector<str_t> pruned = _dumper->_pruned_paths;
+    __lck.unlock();
+
+    auto delta = std::make_shared<dmp::delta_segment>();
+    auto watcher = std::make_unique<dmp::fs_watcher>(delta);
+    if (!watcher->start(root, pruned))
+        return false;
+    __lck.lock();
+    _delta = std::move(delta);
+    _watcher = std::move(watcher);
+    _dumper->set_delta(_delta);
+    for (auto& sh : _shards)
+        sh->set_delta(_delta);
+    return true;
+}
+
+app& app::stop_watching() {
+    _watcher.reset();
+    std::lock_guard __lck(_paths_mut);
+    _delta.reset();
+    if (_dumper != nullptr)
+        _dumper->set_delta(nullptr);
+    for (auto& sh : _shards)
+        sh->set_delta(nullptr);
     return *this;
 }
 
@@ -75,6 +294,8 @@ app& app::stop_auto_update() {
         _auto_update_cv.notify_all();
         _auto_update_thread.join();
         // _auto_update_thread.reset();
+        if (_watch && _watcher != nullptr)
+            stop_watching();
     }
     return *this;
 }
@@ -98,6 +319,47 @@ app& app::add_slow_path(str_t path) {
     _dumper->_noconcur_paths.push_back(std::move(path));
     return *this;
 }
+app& app::set_concur_limit(str_t path, unsigned nthreads) {
+    rectify_path(path);
+    std::lock_guard __lck(_paths_mut);
+    auto& d = _dumper->_concur_limits;
+    auto it = std::find_if(d.begin(), d.end(),
+        [&path] (const auto& p) { return p.first == path; });
+    if (it != d.end())
+        it->second = nthreads;
+    else d.emplace_back(std::move(path), nthreads);
+    return *this;
+}
+app& app::set_trigram_bits(unsigned bits) {
+    if (!dmp::valid_trigram_bits(bits))
+        throw std::out_of_range("Invalid trigram width");
+    std::lock_guard __lck(_paths_mut);
+    _dumper->_trigram_bits = bits;
+    return *this;
+}
+app& app::set_query_window(unsigned pages) {
+    std::lock_guard __lck(_paths_mut);
+    _query_window = pages;
+    if (_dumper != nullptr)
+        _dumper->set_query_window(pages);
+    for (auto& sh : _shards)
+        sh->set_query_window(pages);
+    return *this;
+}
+app& app::add_shard(str_t root) {
+    rectify_path(root);
+    std::lock_guard __lck(_paths_mut);
+    for (const auto& sh : _shards)
+        if (sh->_root_path == root)
+            return *this;
+    auto sh = std::make_shared<dmp::dumper>(shard_db_path(root), _pool);
+    sh->_root_path = std::move(root);
+    sh->set_delta(_delta);
+    sh->set_query_window(_query_window);
+    __make_hot(*sh, _hot_index);
+    _shards.push_back(std::move(sh));
+    return *this;
+}
 app& app::add_start_path(str_t path) {
     rectify_path(path);
     std::lock_guard __lck(_paths_mut);
@@ -121,6 +383,26 @@ app& app::erase_slow_path(const str_t& path) {
             d.end());
     return *this;
 }
+app& app::erase_concur_limit(const str_t& path) {
+    std::lock_guard __lck(_paths_mut);
+    auto& d = _dumper->_concur_limits;
+    d.erase(std::remove_if(d.begin(), d.end(), [&path] (const auto& p) {
+                return p.first == path || p.first.c_str() + 1 == path;
+            }), d.end());
+    return *this;
+}
+app& app::erase_shard(const str_t& root) {
+    std::lock_guard __lck(_paths_mut);
+    auto it = std::stable_partition(_shards.begin(), _shards.end(),
+        [&root] (const auto& sh) {
+            return sh->_root_path != root && sh->_root_path.c_str() + 1 != root;
+        });
+    // Database files are deleted once jobs using them finish
+    for (auto j = it; j != _shards.end(); ++j)
+        (*j)->set_remove_on_destroy(true);
+    _shards.erase(it, _shards.end());
+    return *this;
+}
 app& app::erase_start_path(const str_t& path) {
     std::lock_guard __lck(_paths_mut);
     _start_paths.erase(
@@ -146,10 +428,16 @@ app& app::read_conf(str_t path) {
     ifs.imbue(std::locale("en_US.utf8"));
 #endif
     _dumper.reset();
+    _shards.clear();
+    // Databases stay cold while parsing; see the end
+    std::optional<str_t> hot_old = std::move(_hot_index);
+    _hot_index.reset();
+    _watch = false;
     str_t conf_cont;
     // Conf file are small enough to be loaded to memory entirely
     std::getline(ifs, conf_cont, NATIVE_PATH('\0'));
     sv_t conf_sv(conf_cont);
+    str_t limit_path;
 
     int last_at = -1;
     while (!conf_sv.empty()) {
@@ -160,6 +448,8 @@ app& app::read_conf(str_t path) {
         switch (last_at) {
         case 0: // DB_PATH
             _dumper.reset(new dmp::dumper(cur_tok, _pool)); 
+            _dumper->set_delta(_delta);
+            _dumper->set_query_window(_query_window);
             last_at = -1; break;
         case 1: // ROOT_PATH
             set_root_path(cur_tok);
@@ -170,6 +460,31 @@ app& app::read_conf(str_t path) {
         case 3: // SLOW_PATH
             add_slow_path(cur_tok);
             last_at = -1; break;
+        case 6: // SHARD
+            add_shard(cur_tok);
+            last_at = -1; break;
+        case 7: // HOT_INDEX
+            _hot_index = std::move(cur_tok);
+            last_at = -1; break;
+        case 4: // CONCUR_LIMIT, path
+            limit_path = std::move(cur_tok);
+            last_at = 5; break;
+        case 5: // CONCUR_LIMIT, thread count
+            try {
+                set_concur_limit(std::move(limit_path), std::stoul(cur_tok));
+            } catch (std::logic_error&) {
+                NATIVE_STDERR << NATIVE_PATH("Invalid CONCUR_LIMIT ")
+                              << cur_tok << NATIVE_PATH('\n');
+            }
+            last_at = -1; break;
+        case 8: // TRIGRAM_BITS
+            try {
+                set_trigram_bits(std::stoul(cur_tok));
+            } catch (std::logic_error&) {
+                NATIVE_STDERR << NATIVE_PATH("Invalid TRIGRAM_BITS ")
+                              << cur_tok << NATIVE_PATH('\n');
+            }
+            last_at = -1; break;
 
         default:
             if (cur_tok == NATIVE_PATH("DB_PATH")) {
@@ -183,6 +498,20 @@ app& app::read_conf(str_t path) {
             } else if (cur_tok == NATIVE_PATH("SLOW_PATH")) {
                 if (_dumper == nullptr) goto warning;
                 last_at = 3;
+            } else if (cur_tok == NATIVE_PATH("CONCUR_LIMIT")) {
+                if (_dumper == nullptr) goto warning;
+                last_at = 4;
+            } else if (cur_tok == NATIVE_PATH("SHARD")) {
+                if (_dumper == nullptr) goto warning;
+                last_at = 6;
+            } else if (cur_tok == NATIVE_PATH("HOT_INDEX")) {
+                if (_dumper == nullptr) goto warning;
+                last_at = 7;
+            } else if (cur_tok == NATIVE_PATH("TRIGRAM_BITS")) {
+                if (_dumper == nullptr) goto warning;
+                last_at = 8;
+            } else if (cur_tok == NATIVE_PATH("WATCH")) {
+                _watch = true; // Takes no value
             }  // Ignore all others
             break;
     warning:
@@ -192,6 +521,18 @@ app& app::read_conf(str_t path) {
     }
     if (_dumper == nullptr)
         throw std::runtime_error("Invalid conf file: must contain DB_PATH");
+
+    // Databases are made hot when rebuilt. Making them hot here would
+    // decompress them again on every auto update, so it is only done if
+    // the setting changed, to those no job uses.
+    if (_hot_index != hot_old) {
+        std::lock_guard __lck(_paths_mut);
+        if (_dumper.use_count() == 1)
+            __make_hot(*_dumper, _hot_index);
+        for (auto& sh : _shards)
+            if (sh.use_count() == 1)
+                __make_hot(*sh, _hot_index);
+    }
     return *this;
 }
 
@@ -213,8 +554,18 @@ app& app::write_conf(str_t path) {
     ofs << NATIVE_PATH("\nROOT_PATH `") << _dumper->_root_path << char_t('`');
     for (const auto& p : _dumper->_noconcur_paths)
         ofs << NATIVE_PATH("\nSLOW_PATH `") << p << char_t('`');
+    for (const auto& [p, n] : _dumper->_concur_limits)
+        ofs << NATIVE_PATH("\nCONCUR_LIMIT `") << p << NATIVE_PATH("` ") << n;
     for (const auto& p : _dumper->_pruned_paths)
         ofs << NATIVE_PATH("\nIGNORED_PATH `") << p << char_t('`');
+    for (const auto& sh : _shards)
+        ofs << NATIVE_PATH("\nSHARD `") << sh->_root_path << char_t('`');
+    if (_hot_index)
+        ofs << NATIVE_PATH("\nHOT_INDEX `") << *_hot_index << char_t('`');
+    if (_dumper->_trigram_bits != dmp::default_trigram_bits)
+        ofs << NATIVE_PATH("\nTRIGRAM_BITS ") << _dumper->_trigram_bits;
+    if (_watch)
+        ofs << NATIVE_PATH("\nWATCH");
     ofs.put(char_t('\n'));
     return *this;
 }
@@ -223,40 +574,92 @@ app::job_list app::get_jobs(fsearch_expr& expr) {
     job_list jobs;
     if (!has_data())
         return jobs;
-    jobs.reserve(_start_paths.size());
+    jobs.reserve(_start_paths.size() * (_shards.size() + 2));
     expr.update_cost();
     // A lock must be introduced or an updatedb may alter data_dumped between
     // construct dataiter(+5 lines) and copy data_dumped to job list(+11 lines)
     std::lock_guard __lck(_paths_mut);
+    // Changes were lost, so the databases alone are consistent; the delta
+    // is dropped from them until next updatedb, run now by auto updates
+    bool use_delta = _delta != nullptr && !_delta->overflowed();
+    if (_delta != nullptr && !use_delta) {
+        _dumper->set_delta(nullptr);
+        for (auto& sh : _shards)
+            sh->set_delta(nullptr);
+        _update_requested = true;
+        _auto_update_cv.notify_all();
+    }
 
-    // Construct jobs
-    for (sv_t p : _start_paths) {
-        // _root_path.starts_with(p)
-        if (_dumper->_root_path.size() >= p.size() &&
-            memcmp(p.data(), _dumper->_root_path.data(),
-                   sizeof(char_t) * p.size()) == 0)
-            p = _dumper->_root_path;
-
-        fs_data_iter it(_dumper.get(), p);
-        if (it == it.end()) // Invalid starting path
+    // Construct jobs; each start path is searched in each database. The root
+    // of a shard is in its parent's database as an empty directory, and is
+    // not iterated by the shard's own iterator, so no result is repeated.
+    for (sv_t start : _start_paths) {
+        for (size_t i = 0; i <= _shards.size(); ++i) {
+            const auto& dmp = i == 0 ? _dumper : _shards[i - 1];
+            if (dmp->chunk_count() == 0)
+                continue;
+            sv_t p = start;
+            // _root_path.starts_with(p)
+            if (dmp->_root_path.size() >= p.size() &&
+                memcmp(p.data(), dmp->_root_path.data(),
+                       sizeof(char_t) * p.size()) == 0)
+                p = dmp->_root_path;
+            // Skip shards outside the start path quickly
+            else if (i != 0 && !__is_under(p, dmp->_root_path))
+                continue;
+
+            fs_data_iter it(dmp.get(), p);
+            if (it == it.end()) // Invalid starting path
+                continue;
+
+            jobs.emplace_back(
+                dmp, // std::shared_ptr is internally thread safe
+                std::make_unique<
+                    pred_tree::async_job<fs_data_iter, sv_t>
+                >(it, it.end(), expr)
+            );
+        }
+        // Entries created since last updatedb, which are few
+        if (!use_delta)
             continue;
-
-        jobs.emplace_back(
-            _dumper, // std::shared_ptr is internally thread safe
-            std::make_unique<
-                pred_tree::async_job<fs_data_iter, sv_t>
-            >(it, it.end(), expr)
-        );
+        auto added = std::make_shared<const dmp::delta_entries>(
+            _delta->added_under(start));
+        if (added->empty())
+            continue;
+        fs_data_iter it(std::move(added));
+        jobs.emplace_back(nullptr, std::make_unique<
+            pred_tree::async_job<fs_data_iter, sv_t>>(it, it.end(), expr));
     }
     return jobs;
 }
 
+std::vector<str_t> app::shard_roots() const {
+    std::vector<str_t> res;
+    for (const auto& sh : _shards)
+        res.push_back(sh->_root_path);
+    return res;
+}
+
+str_t app::shard_db_path(const str_t& root) const {
+    // FNV-1a of the root path, so that names do not depend on shard order
+    uint64_t h = 14695981039346656037ull;
+    for (char_t c : root)
+        h = (h ^ static_cast<uint64_t>(c)) * 1099511628211ull;
+    char buf[20];
+    ::snprintf(buf, sizeof(buf), "_%016llx", static_cast<unsigned long long>(h));
+    str_t res = db_path();
+    res.insert(res.end(), buf, buf + ::strlen(buf));
+    return res;
+}
+
 app::app(fifo_thpool& p) : _pool(p) {}
 app::app(app&& rhs) noexcept
     : _conf_path(std::move(rhs._conf_path))
     , _start_paths(std::move(rhs._start_paths))
     // COPY rhs's dumper ptr since rhs's jobs are not finished
-    , _dumper(rhs._dumper), _pool(rhs._pool)
+    , _dumper(rhs._dumper), _shards(rhs._shards), _delta(std::move(rhs._delta))
+    , _watcher(std::move(rhs._watcher)), _watch(rhs._watch)
+    , _query_window(rhs._query_window), _pool(rhs._pool)
 {
     rhs.stop_auto_update();
     // Wait all rhs's jobs to finish
@@ -273,10 +676,57 @@ app& app::operator=(app&& r) noexcept {
 
 app::~app() { 
     stop_auto_update(); 
+    _watcher.reset();
     // Wait for other jobs to finish
     std::unique_lock __lck(_paths_mut);
 }
 
+app& app::configure_mounts() {
+    // Whether `p` is already ignored, or under an ignored path
+    auto ignored = [this] (const str_t& p) {
+        for (const str_t& ign : ignored_paths()) {
+            if (p.compare(0, ign.size(), ign) == 0 &&
+                (p.size() == ign.size() || p[ign.size()] == separator))
+                return true;
+        }
+        return false;
+    };
+    std::vector<dmp::mount_info> mnts = dmp::read_mounts();
+    std::string root_dev;
+    for (const dmp::mount_info& m : mnts)
+        if (m.path.size() == 1 && m.path[0] == separator)
+            root_dev = m.device;
+
+    for (const dmp::mount_info& m : mnts) {
+        if (ignored(m.path))
+            continue;
+        // Never ignore the root
+        bool is_root = m.path.size() == 1 && m.path[0] == separator;
+        if (m.pseudo && !is_root) {
+            add_ignored_path(m.path);
+            continue;
+        }
+        for (const str_t& p : m.hidden_paths)
+            if (!ignored(p))
+                add_ignored_path(p);
+        unsigned limit = dmp::device_concurrency(m);
+        if (limit == 1)
+            add_slow_path(m.path);
+        else if (limit > 1)
+            set_concur_limit(m.path, limit);
+
+        // Other block devices and network filesystems are indexed in their
+        // own shards, so that they are read in parallel.
+        bool other_dev = m.device != root_dev &&
+                         (m.network || m.device.compare(0, 2, "0:") != 0);
+        std::error_code ec;
+        // Bind mounted files are skipped
+        if (!is_root && other_dev && std::filesystem::is_directory(m.path, ec))
+            add_shard(m.path);
+    }
+    return *this;
+}
+
 #ifndef _WIN32
 app app::os_default(fifo_thpool& pool) {
     std::string conf_dir = ::getenv("HOME") ? ::getenv("HOME") : "/var/tmp";
@@ -306,10 +756,8 @@ app app::os_default(fifo_thpool& pool) {
        .write_conf();
 
 #else // GNU/Linux
-       .add_ignored_path("/proc")
-       .add_ignored_path("/run")
-       .add_ignored_path("/media")
-       .add_ignored_path("/mnt")
+       // Pseudo filesystems like /proc are found from mount points
+       .configure_mounts()
        .add_ignored_path("/tmp")
        .add_ignored_path("/var/tmp")
        .write_conf();
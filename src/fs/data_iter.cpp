@@ -1,5 +1,6 @@
 #include <orient/fs/data_iter.hpp>
 #include <orient/fs/trigram.hpp>
+#include <orient/fs/watcher.hpp>
 #include <stdexcept>
 #include <cstring>
 #include <cassert>
@@ -46,7 +47,6 @@ sv_t fs_data_record::change_batch(size_t batch) noexcept {
         _cur_chunk = ~uint32_t();
         return sv_t();
     }
-    // TODO: forward index files larger than 32bit limit?
     _cur_pos = _dumper->in_chunk_pos_of_batch(batch);
     _cur_chunk = _dumper->chunk_of_batch(batch);
     start_visit();
@@ -71,15 +71,26 @@ void fs_data_record::start_visit() {
 void fs_data_record::finish_visit() noexcept {
     if (!_is_viewing)
         return;
-    _dumper->finish_visit();
+    _dumper->finish_visit(_cur_chunk);
     _is_viewing = false;
 }
 
+void fs_data_record::__reveal_next_batch() {
+    size_t next = size_t(_cur_batch) + 1;
+    if (next < _dumper->batch_count() && _dumper->chunk_of_batch(next) == _cur_chunk)
+        _dumper->extend_visit(_cur_chunk, _dumper->in_chunk_pos_of_batch(next));
+}
+
 ptrdiff_t fs_data_record::increment() {
     assert(_is_viewing);
+    // Frames of chunks start at batches; the next one may be unreadable yet
+    bool batch_ends = _in_batch_pos + 1 == _dumper->nfile_in_batch;
+    if (__unlikely(batch_ends))
+        __reveal_next_batch();
     ptrdiff_t push_count = _category == dir_tag ? 1 : 0;
     size_t to_inc = sizeof(category_tag) + _name_len * sizeof(char_t) +
-                    sizeof(uint16_t); // Tag, name and name length
+                    sizeof(uint16_t) + // Tag, name and name length
+                    push_count * sizeof(uint64_t); // Dir change stamp
     _cur_pos += to_inc;
     _viewing += to_inc;
 
@@ -92,10 +103,12 @@ pop_dirs:
     }
     // A chunk will only end after dir_pop_tag
     if (__unlikely(_category == next_chunk_tag)) {
-        _dumper->finish_visit();
+        finish_visit();
         ++_cur_chunk;
         _cur_pos = 0;
-        _viewing = _dumper->start_visit(_cur_chunk, 0);
+        start_visit();
+        if (batch_ends)
+            __reveal_next_batch();
         goto pop_dirs;
     }
 
@@ -124,6 +137,13 @@ size_t fs_data_record::file_name_len() const noexcept {
     return size_t(_name_len);
 }
 
+uint64_t fs_data_record::dir_stamp() const noexcept {
+    assert(_is_viewing && _category == dir_tag);
+    uint64_t res;
+    ::memcpy(&res, _name_begin + _name_len, sizeof(uint64_t));
+    return res;
+}
+
 category_tag fs_data_record::file_type() const noexcept {
     assert(_is_viewing);
     return _category;
@@ -136,8 +156,10 @@ category_tag fs_data_record::file_type() const noexcept {
 fs_data_iter::fs_data_iter(dmp::dumper* dumper)
     : _cur_record(dumper), _push_count(1)
     , _recur(iter_mode::enable), _tag(dir_tag)
+    , _prefix_removed(false), _added_at(0)
 {
     if (!dumper) { _push_count = 0; return; }
+    _delta = dumper->delta();
     [[maybe_unused]] sv_t _empty = _cur_record.change_batch(0);
     assert(_empty.empty());
     ++*this;
@@ -147,6 +169,24 @@ fs_data_iter::fs_data_iter(dmp::dumper* dumper)
     _push_count = 1;
 }
 
+fs_data_iter::fs_data_iter(std::shared_ptr<const dmp::delta_entries> entries)
+    : _push_count(1), _root_path_len(0), _root_depth(0)
+    , _recur(iter_mode::all_disable), _tag(unknown_tag)
+    , _prefix_removed(false), _added(std::move(entries)), _added_at(0)
+{ __view_added(); }
+
+void fs_data_iter::__view_added() {
+    if (_added_at >= _added->size()) {
+        _push_count = 0;
+        _tag = unknown_tag;
+        return;
+    }
+    const auto& [fullpath, tag] = (*_added)[_added_at];
+    _tag = tag;
+    _prefix.assign(fullpath, 0, fullpath.find_last_of(separator) + 1);
+    _opt_fullpath.emplace(fullpath);
+}
+
 const str_t& fs_data_iter::path() const {
     if (_opt_fullpath.has_value())
         return _opt_fullpath.value();
@@ -155,12 +195,42 @@ const str_t& fs_data_iter::path() const {
 }
 
 fs_data_iter& fs_data_iter::operator++() {
+    if (_push_count == 0)
+        throw std::out_of_range("Incrementing end fs_data_iter");
+    if (__unlikely(_added != nullptr)) {
+        _opt_stat.reset();
+        ++_added_at;
+        __view_added();
+        return *this;
+    }
+    __increment();
+    __skip_removed();
+    return *this;
+}
+
+void fs_data_iter::__check_prefix() {
+    _prefix_removed = _delta->has_removed() && !_prefix.empty() &&
+        _delta->is_removed(sv_t(_prefix).substr(0, _prefix.size() - 1));
+}
+
+void fs_data_iter::__skip_removed() {
+    if (__likely(_delta == nullptr))
+        return;
+    // Entries in a deleted directory are all skipped along with it, and
+    // its remaining ones are checked on the way back
+    while (_push_count != 0 && (_prefix_removed ||
+           (_delta->may_be_removed(_cur_record.file_name_view()) &&
+            _delta->is_removed(path())))) {
+        disable_pending_recursion();
+        __increment();
+    }
+}
+
+void fs_data_iter::__increment() {
     if (__unlikely(!_cur_record.is_visiting()))
         _cur_record.start_visit();
     _opt_fullpath.reset(); _opt_stat.reset();
-    if (_push_count == 0)
-        throw std::out_of_range("Incrementing end fs_data_iter");
-        
+
     fs_data_record prev_rec(_cur_record);
     ptrdiff_t pushed = _cur_record.increment();
     while (__unlikely(_recur != iter_mode::enable) && pushed > 0)
@@ -170,9 +240,10 @@ fs_data_iter& fs_data_iter::operator++() {
     if (__unlikely(pushed + static_cast<ptrdiff_t>(_push_count) < 0)) {
         _push_count = 0;
         _cur_record.finish_visit();
-        return *this;
+        return;
     }
     else _push_count += pushed;
+    bool prefix_changed = pushed != 0;
 
     if (__unlikely(pushed == 1)) {
         prev_rec.start_visit();
@@ -186,10 +257,11 @@ fs_data_iter& fs_data_iter::operator++() {
         );
         ++pushed;
     }
+    if (__unlikely(prefix_changed && _delta != nullptr))
+        __check_prefix();
 
     if (__unlikely(_recur == iter_mode::temp_disable))
         _recur = iter_mode::enable;
-    return *this;
 }
 
 fs_data_iter& fs_data_iter::updir() {
@@ -228,6 +300,10 @@ void fs_data_iter::change_batch(size_t batch_at) noexcept {
                     - _root_depth + 1;  // Why the +1 is needed?
         (_prefix = dest).push_back(separator);
         _tag = _cur_record.file_type();
+        if (_delta != nullptr) {
+            __check_prefix();
+            __skip_removed();
+        }
     }
 }
 
@@ -303,6 +379,10 @@ done:
     (_prefix = root_new).push_back(separator);
     _root_path_len = root_new.size();
     _root_depth = std::count(root_new.begin(), root_new.end(), separator);
+    if (_delta != nullptr) {
+        __check_prefix();
+        __skip_removed();
+    }
     return *this;
 }
 
@@ -338,6 +418,8 @@ fs_data_iter fs_data_iter::current_dir_iter() const {
 bool fs_data_iter::operator==(const fs_data_iter& rhs) const noexcept {
     if (_push_count == 0 && rhs._push_count == 0)
         return true;
+    if (_added != nullptr || rhs._added != nullptr)
+        return _added == rhs._added && _added_at == rhs._added_at;
     return _push_count == rhs._push_count && _cur_record == rhs._cur_record;
 }
 
@@ -405,6 +487,8 @@ fs_data_iter::fs_data_iter(const fs_data_iter& rhs)
     , _prefix(rhs._prefix), _root_path_len(rhs._root_path_len)
     , _root_depth(rhs._root_depth), _recur(rhs._recur), _tag(rhs._tag)
     , _opt_fullpath(rhs._opt_fullpath), _opt_stat(rhs._opt_stat)
+    , _delta(rhs._delta), _prefix_removed(rhs._prefix_removed)
+    , _added(rhs._added), _added_at(rhs._added_at)
 {
     if (_push_count != 0 && !_opt_fullpath.has_value())
         _opt_fullpath.emplace(_prefix + str_t(rhs.basename()));
@@ -416,6 +500,8 @@ fs_data_iter::fs_data_iter(fs_data_iter&& rhs) noexcept
     , _root_depth(rhs._root_depth), _recur(rhs._recur), _tag(rhs._tag)
     , _opt_fullpath(std::move(rhs._opt_fullpath))
     , _opt_stat(std::move(rhs._opt_stat)) 
+    , _delta(std::move(rhs._delta)), _prefix_removed(rhs._prefix_removed)
+    , _added(std::move(rhs._added)), _added_at(rhs._added_at)
 { 
     if (_push_count != 0 && !_opt_fullpath.has_value())
         _opt_fullpath.emplace(_prefix + str_t(rhs.basename()));
@@ -1,7 +1,25 @@
 #include <orient/fs/dumper.hpp>
-#include <orient/fs/trigram.hpp> // for `place_trigram`
+#include <orient/fs/trigram.hpp> // for `trigram_placer`
+#include <orient/fs/data_iter.hpp> // for reading previous database
 #include <orient/util/charconv_t.hpp>
+#include <orient/util/uring.hpp>
 #include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <condition_variable>
+#include <exception>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <deque>
+
+#ifdef __linux__
+extern "C" {
+#include <sys/syscall.h> // for getdents64
+}
+#endif
 
 static void __place_a_name(orie::sv_t str, std::vector<std::byte>& d)
 {
@@ -12,47 +30,468 @@ static void __place_a_name(orie::sv_t str, std::vector<std::byte>& d)
     d.insert(d.cend(), ptr, ptr + sizeof(orie::char_t) * str.size());
 }
 
-static orie::char_t
-__handle_unknown_dtype(const orie::char_t* fullp) noexcept {
-    orie::stat_t stbuf;
-    if (orie::stat(fullp, &stbuf) != 0)
-        // Cannot stat? Dump it as a regular file
-        return DT_REG;
+static void __place_stamp(uint64_t stamp, std::vector<std::byte>& d)
+{
+    const std::byte* ptr = reinterpret_cast<const std::byte*>(&stamp);
+    d.insert(d.cend(), ptr, ptr + sizeof(uint64_t));
+}
+
+// Change stamp of a directory in nanoseconds, which is the later one of
+// its mtime and ctime. Entries added, removed or renamed change both.
+static uint64_t __stamp_of(const orie::stat_t& st) noexcept {
+#if defined(_WIN32)
+    // ctime is creation time on Windows
+    return uint64_t(st.st_mtime) * 1000000000;
+#elif defined(__APPLE__)
+    uint64_t m = uint64_t(st.st_mtimespec.tv_sec) * 1000000000 +
+                 st.st_mtimespec.tv_nsec;
+    uint64_t c = uint64_t(st.st_ctimespec.tv_sec) * 1000000000 +
+                 st.st_ctimespec.tv_nsec;
+    return std::max(m, c);
+#else
+    uint64_t m = uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    uint64_t c = uint64_t(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+    return std::max(m, c);
+#endif
+}
+
+#ifdef ORIE_HAVE_IO_URING
+static uint64_t __stamp_of(const struct statx& st) noexcept {
+    uint64_t m = uint64_t(st.stx_mtime.tv_sec) * 1000000000 +
+                 st.stx_mtime.tv_nsec;
+    uint64_t c = uint64_t(st.stx_ctime.tv_sec) * 1000000000 +
+                 st.stx_ctime.tv_nsec;
+    return std::max(m, c);
+}
+#endif
 
-    if (S_ISREG(stbuf.st_mode))
+// `name` is only for error message
+static orie::char_t
+__dtype_of_mode(orie::mode_t mode, const orie::char_t* name) noexcept {
+    if (S_ISREG(mode))
         return DT_REG;
-    if (S_ISDIR(stbuf.st_mode))
+    if (S_ISDIR(mode))
         return DT_DIR;
-    if (S_ISLNK(stbuf.st_mode))
+    if (S_ISLNK(mode))
         return DT_LNK;
-    if (S_ISFIFO(stbuf.st_mode))
+    if (S_ISFIFO(mode))
         return DT_FIFO;
-    if (S_ISCHR(stbuf.st_mode))
+    if (S_ISCHR(mode))
         return DT_CHR;
-    if (S_ISSOCK(stbuf.st_mode))
+    if (S_ISSOCK(mode))
         return orie::char_t(DT_SOCK); // On Windows these are negative values
-    if (S_ISBLK(stbuf.st_mode))
+    if (S_ISBLK(mode))
         return orie::char_t(DT_BLK);
     // Should not reach here, but don't crash so easily.
-    orie::NATIVE_STDERR << NATIVE_PATH("Unknown file type: ") << fullp << '\n';
+    orie::NATIVE_STDERR << NATIVE_PATH("Unknown file type: ") << name << '\n';
     return DT_REG;
 }
 
+#ifdef _WIN32
+static orie::char_t
+__handle_unknown_dtype(const orie::char_t* fullp) noexcept {
+    orie::stat_t stbuf;
+    if (orie::stat(fullp, &stbuf) != 0)
+        // Cannot stat? Dump it as a regular file
+        return DT_REG;
+    return __dtype_of_mode(stbuf.st_mode, fullp);
+}
+#endif
+
+// Add a directory entry to sub dirs or sub files of its parent
+template <class dir_info_t>
+static void __add_entry(dir_info_t& res, orie::char_t d_type,
+                        const orie::char_t* name) {
+    if (d_type == DT_DIR) {
+        res.add_subdir(name);
+        return;
+    }
+
+    // from d_type to orie::category_type
+    orie::category_tag tag;
+    switch (d_type) {
+    case DT_LNK:  tag = orie::link_tag; break;
+    case DT_BLK:  tag = orie::blk_tag; break;
+    case DT_FIFO: tag = orie::fifo_tag; break;
+    case DT_SOCK: tag = orie::sock_tag; break;
+    case DT_CHR:  tag = orie::char_tag; break;
+    case DT_REG:  tag = orie::file_tag; break;
+    default:
+        // Should not reach, but don't crash because of this
+        std::cerr << "Warning: unknown file type "
+                  << static_cast<int>(d_type) << '\n';
+        return; // Do not add it
+    }
+    res.add_file(tag, name);
+}
+
+#ifndef _WIN32
+static constexpr int __dir_open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+
+// Add entries of opened directory `fd` to `res`.
+// Entries of unknown types are put into `unknown` if it is given,
+// or stat'ed relative to `fd` one by one.
+template <class dir_info_t>
+static void __read_dir_fd(int fd, dir_info_t& res,
+                          std::vector<orie::str_t>* unknown)
+{
+    auto add = [&] (unsigned char d_type, const char* name) {
+        if (name[0] == '.' && (name[1] == '\0' ||
+                               (name[1] == '.' && name[2] == '\0')))
+            return;
+        if (d_type != DT_UNKNOWN)
+            return __add_entry(res, d_type, name);
+        if (unknown != nullptr)
+            return (void)unknown->emplace_back(name);
+        // Cannot stat? Dump it as a regular file
+        orie::stat_t stbuf;
+        d_type = ::fstatat(fd, name, &stbuf, 0) == 0 ?
+                 __dtype_of_mode(stbuf.st_mode, name) : orie::char_t(DT_REG);
+        __add_entry(res, d_type, name);
+    };
+
+#ifdef __linux__
+    // Names are parsed right from the buffer filled by getdents64, whose
+    // records are laid out as `struct dirent64` in glibc.
+    thread_local std::vector<char> buf;
+    buf.resize(65536);
+    for (;;) {
+        long len = ::syscall(SYS_getdents64, fd, buf.data(), buf.size());
+        if (len <= 0)
+            break;
+        for (long pos = 0; pos < len; ) {
+            const struct dirent64* ent =
+                reinterpret_cast<const struct dirent64*>(buf.data() + pos);
+            add(ent->d_type, ent->d_name);
+            pos += ent->d_reclen;
+        }
+    }
+#else
+    int dup_fd = ::dup(fd); // closed by `closedir`
+    orie::dir_t* dirp = dup_fd < 0 ? nullptr : ::fdopendir(dup_fd);
+    if (dirp == nullptr) {
+        if (dup_fd >= 0)
+            ::close(dup_fd);
+        return;
+    }
+    while (orie::dirent_t* ent = orie::readdir(dirp))
+        add(ent->d_type, ent->d_name);
+    orie::closedir(dirp);
+#endif
+}
+#endif
+
+static void __close_fd(int fd) noexcept {
+#ifndef _WIN32
+    if (fd >= 0)
+        ::close(fd);
+#else
+    (void)fd;
+#endif
+}
+
+// Position of the basename in `path`
+static size_t __basename_at(orie::sv_t path) noexcept {
+#ifdef _WIN32
+    size_t sep = path.find_last_of(L"\\/");
+#else
+    size_t sep = path.find_last_of(orie::separator);
+#endif
+    return sep == orie::sv_t::npos ? 0 : sep + 1;
+}
+
+// Forward index of generation `id` of the database at `db_path`;
+// its inverted index has an extra "_inv" suffix.
+static orie::str_t __generation_path(const orie::str_t& db_path, uint64_t id) {
+#ifdef _WIN32
+    return db_path + L'.' + std::to_wstring(id);
+#else
+    return db_path + '.' + std::to_string(id);
+#endif
+}
+
+// Whether `name` is a file of some generation of the database, whose
+// basename followed by '.' is `prefix`. If so, put the generation in `id`.
+static bool __generation_of(orie::sv_t name, orie::sv_t prefix, uint64_t& id) {
+    if (name.substr(0, prefix.size()) != prefix)
+        return false;
+    name.remove_prefix(prefix.size());
+    size_t ndigit = 0;
+    // At most 19 digits, which never overflow
+    for (id = 0; ndigit < std::min<size_t>(name.size(), 19) &&
+                 name[ndigit] >= '0' && name[ndigit] <= '9'; ++ndigit)
+        id = id * 10 + (name[ndigit] - '0');
+    if (ndigit == 0)
+        return false;
+    name.remove_prefix(ndigit);
+    return name.empty() || name == NATIVE_SV("_inv") || name == NATIVE_SV(".tmp");
+}
+
+// Read the manifest at `db_path`, which is formatted as
+//     orie-manifest 1
+//     generation <id>
+//     forward <basename of forward index>
+//     inverted <basename of inverted index>
+// Return false if it does not exist or is invalid.
+static bool __read_manifest(const orie::str_t& db_path, uint64_t& id,
+                            orie::str_t& fwd_path, orie::str_t& inv_path)
+{
+    std::ifstream ifs(std::filesystem::path(db_path), std::ios::binary);
+    std::string line;
+    if (!std::getline(ifs, line) || line != "orie-manifest 1")
+        return false; // Including databases written by older versions
+    orie::str_t dir = db_path.substr(0, __basename_at(db_path));
+    bool has_id = false;
+    fwd_path.clear();
+    inv_path.clear();
+    while (std::getline(ifs, line)) {
+        size_t space = line.find(' ');
+        if (space == std::string::npos)
+            continue;
+        std::string_view key(line.data(), space);
+        std::string val = line.substr(space + 1);
+        if (key == "generation") {
+            char* end;
+            id = std::strtoull(val.c_str(), &end, 10);
+            has_id = !val.empty() && *end == '\0';
+        } else if (key == "forward" || key == "inverted") {
+            // Files must be next to the manifest
+            if (val.empty() || val.find_first_of("/\\") != std::string::npos)
+                return false;
+            (key == "forward" ? fwd_path : inv_path) =
+                dir + orie::xxstrcpy<char, orie::char_t>(val);
+        }
+    }
+    return has_id && !fwd_path.empty() && !inv_path.empty();
+}
+
+// Whether `db_path` holds a forward index written before manifests, which
+// starts with the magic of either version instead of a manifest
+static bool __is_legacy_db(const orie::str_t& db_path) {
+    using orie::dmp::file_mem_chunk;
+    char head[sizeof(file_mem_chunk::magic)];
+    std::ifstream ifs(std::filesystem::path(db_path), std::ios::binary);
+    if (!ifs.read(head, sizeof(head)))
+        return false;
+    uint64_t v1_head;
+    memcpy(&v1_head, head, sizeof(v1_head));
+    return v1_head == file_mem_chunk::v1_magic_num ||
+           memcmp(head, file_mem_chunk::magic, sizeof(head)) == 0;
+}
+
+// Flush data of the file, or entries of the directory, at `path` to disk.
+// Throw runtime error on failure.
+static void __sync_path(const orie::str_t& path, bool is_dir = false) {
+#ifdef _WIN32
+    // Directory entries are flushed by renaming with MOVEFILE_WRITE_THROUGH
+    if (is_dir)
+        return;
+    HANDLE h = ::CreateFileW(path.c_str(), GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    bool ok = h != INVALID_HANDLE_VALUE && ::FlushFileBuffers(h);
+    if (h != INVALID_HANDLE_VALUE)
+        ::CloseHandle(h);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | (is_dir ? O_DIRECTORY : 0));
+    bool ok = fd >= 0 && ::fsync(fd) == 0;
+    __close_fd(fd);
+#endif
+    if (!ok)
+        throw std::runtime_error("Cannot sync " + orie::xxstrcpy(orie::sv_t(path)));
+}
+
 namespace orie {
 namespace dmp {
 
+// Buffers of destroyed listings, reused by listings created later on the
+// same thread. Listings are mostly created by reading threads but
+// destroyed by the serializing one, so a thread with too many buffers
+// hands a batch of them over to others through `shared`.
+struct dumper::dir_info_t::pool_t {
+    struct bufs_t {
+        std::vector<char_t> names;
+        std::vector<ent_t> subdirs;
+        std::vector<ent_t> files;
+    };
+    // Buffers kept by each thread, and moved to or from `shared` at once
+    static constexpr size_t local_cap = 64;
+    static constexpr size_t batch = 16;
+    static constexpr size_t shared_cap = 1024;
+    // Larger buffers are freed rather than kept
+    static constexpr size_t max_names = 65536;
+    static constexpr size_t max_ents = 4096;
+
+    std::vector<bufs_t> local;
+    static std::mutex shared_mut;
+    static std::vector<bufs_t> shared;
+
+    static pool_t& of_this_thread() {
+        thread_local pool_t pool;
+        return pool;
+    }
+
+    void take(dir_info_t& info) {
+        if (local.empty()) {
+            std::lock_guard __lck(shared_mut);
+            for (size_t i = 0; i < batch && !shared.empty(); ++i) {
+                local.push_back(std::move(shared.back()));
+                shared.pop_back();
+            }
+        }
+        if (local.empty())
+            return;
+        info._names = std::move(local.back().names);
+        info._subdirs = std::move(local.back().subdirs);
+        info._files = std::move(local.back().files);
+        local.pop_back();
+    }
+
+    void give(dir_info_t& info) {
+        if (info._names.capacity() == 0 || info._names.capacity() > max_names ||
+            info._subdirs.capacity() > max_ents ||
+            info._files.capacity() > max_ents)
+            return;
+        info._names.clear();
+        info._subdirs.clear();
+        info._files.clear();
+        local.push_back(bufs_t{ std::move(info._names),
+                                std::move(info._subdirs),
+                                std::move(info._files) });
+        if (local.size() < local_cap)
+            return;
+        std::lock_guard __lck(shared_mut);
+        for (size_t i = 0; i < batch && shared.size() < shared_cap; ++i) {
+            shared.push_back(std::move(local.back()));
+            local.pop_back();
+        }
+        // Too many buffers everywhere
+        if (local.size() >= local_cap)
+            local.pop_back();
+    }
+};
+
+std::mutex dumper::dir_info_t::pool_t::shared_mut;
+std::vector<dumper::dir_info_t::pool_t::bufs_t>
+dumper::dir_info_t::pool_t::shared;
+
+dumper::dir_info_t::dir_info_t() { pool_t::of_this_thread().take(*this); }
+dumper::dir_info_t::~dir_info_t() { pool_t::of_this_thread().give(*this); }
+
+dumper::dir_info_t& dumper::dir_info_t::operator=(dir_info_t&& rhs) noexcept {
+    _names.swap(rhs._names);
+    _subdirs.swap(rhs._subdirs);
+    _files.swap(rhs._files);
+    stamp = rhs.stamp;
+    return *this;
+}
+
+dumper::dir_info_t::ent_t dumper::dir_info_t::place(sv_t name) {
+    ent_t res{ static_cast<uint32_t>(_names.size()),
+               static_cast<uint32_t>(name.size()) };
+    _names.insert(_names.end(), name.begin(), name.end());
+    _names.push_back(char_t());
+    return res;
+}
+
+// Previously dumped directory: its change stamp, its record in previous
+// forward index and basenames of its sub directories
+struct dumper::prev_dirs_t {
+    struct dir_t {
+        uint64_t stamp;
+        fs_data_record rec;
+        std::vector<str_t> subdirs;
+    };
+    std::unordered_map<str_t, dir_t> dirs;
+};
+
+void dumper::load_prev_dirs(dumper& prev, prev_dirs_t& dest) {
+    if (prev.batch_count() == 0)
+        return;
+    using dir_ent_t = std::pair<const str_t, prev_dirs_t::dir_t>;
+    // Directories being visited; back() is parent of current record.
+    std::vector<dir_ent_t*> visiting;
+    fs_data_record rec(&prev);
+    rec.change_batch(0);
+
+    while (rec.file_type() != unknown_tag) {
+        ptrdiff_t is_dir = rec.file_type() == dir_tag ? 1 : 0;
+        if (is_dir) {
+            sv_t name = rec.file_name_view();
+            str_t fullpath = visiting.empty() ? str_t(name) :
+                (visiting.back()->first + separator) += name;
+            if (!visiting.empty())
+                visiting.back()->second.subdirs.emplace_back(name);
+            auto ins = dest.dirs.emplace(std::move(fullpath),
+                prev_dirs_t::dir_t{rec.dir_stamp(), rec, {}});
+            visiting.push_back(&*ins.first);
+        }
+        // Entered the directory (if any) and exited `pushed` directories
+        ptrdiff_t popped = is_dir - rec.increment();
+        for (; popped > 0 && !visiting.empty(); --popped)
+            visiting.pop_back();
+    }
+}
+
+bool dumper::fetch_prev_dir_info(const str_t& fullpath, dir_info_t& res) {
+    auto it = _prev_dirs->dirs.find(fullpath);
+    if (it == _prev_dirs->dirs.cend() || it->second.stamp != res.stamp ||
+        res.stamp == 0)
+        return false;
+
+    try {
+        fs_data_record rec(it->second.rec);
+        rec.start_visit();
+        // Sub files are placed right after the dir itself; the first sub dir
+        // or dir pop ends them.
+        if (rec.increment() == 1) {
+            while (rec.file_type() != dir_tag) {
+                res.add_file(rec.file_type(), rec.file_name_view());
+                if (rec.increment() != 0)
+                    break;
+            }
+        }
+    } catch (const std::exception&) {
+        uint64_t stamp = res.stamp;
+        res = dir_info_t();
+        res.stamp = stamp;
+        return false;
+    }
+    for (const str_t& subdir : it->second.subdirs)
+        res.add_subdir(subdir);
+    ++_reused_dirs;
+    return true;
+}
+
 dumper::dir_info_t
-dumper::fetch_dir_info(str_t& fullpath) {
-    const orie::char_t* c_fullpath = fullpath.c_str();
+dumper::fetch_dir_info(str_t& fullpath, int parent_fd, int* dir_fd) {
+    dir_info_t res;
+    orie::stat_t stbuf;
 #ifdef _WIN32
+    (void)parent_fd;
+    if (dir_fd != nullptr)
+        *dir_fd = -1;
+    const orie::char_t* c_fullpath = fullpath.c_str();
     if (c_fullpath[0] == separator)
         ++c_fullpath;
-#endif
+    if (_prev_dirs != nullptr) {
+        // A stat is enough to tell whether the previous listing is valid
+        if (orie::stat(c_fullpath, &stbuf) == 0)
+            res.stamp = __stamp_of(stbuf);
+        if (res.stamp >= _racy_since)
+            res.stamp = 0;
+        if (fetch_prev_dir_info(fullpath, res))
+            return res;
+    }
+
     orie::dir_t* dirp = orie::opendir(c_fullpath);
     if (dirp == nullptr)
         return dir_info_t();
     orie::dirent_t* ent;
-    dir_info_t res;
+    if (_prev_dirs == nullptr && orie::stat(c_fullpath, &stbuf) == 0)
+        res.stamp = __stamp_of(stbuf);
+    if (res.stamp >= _racy_since)
+        res.stamp = 0;
 
     while ((ent = orie::readdir(dirp)) != nullptr) {
         if (orie::strcmp(NATIVE_PATH("."), ent->d_name) == 0 ||
@@ -65,31 +504,196 @@ dumper::fetch_dir_info(str_t& fullpath) {
             ent->d_type = __handle_unknown_dtype(c_fullpath);
             fullpath.erase(len_orig);
         }
-        if (ent->d_type == DT_DIR) {
-            res.first.emplace_back(ent->d_name);
-            continue;
-        }
+        __add_entry(res, ent->d_type, ent->d_name);
+    }
+
+    orie::closedir(dirp);
+    return res;
+
+#else
+    if (dir_fd != nullptr)
+        *dir_fd = -1;
+    // Relative to parent if possible, or by full path
+    const char* name = fullpath.c_str();
+    if (parent_fd >= 0)
+        name += fullpath.rfind(separator) + 1;
+    else parent_fd = AT_FDCWD;
 
-        // from d_type to orie::category_type
-        category_tag tag;
-        switch (ent->d_type) {
-        case DT_LNK:  tag = orie::link_tag; break;
-        case DT_BLK:  tag = orie::blk_tag; break;
-        case DT_FIFO: tag = orie::fifo_tag; break;
-        case DT_SOCK: tag = orie::sock_tag; break;
-        case DT_CHR:  tag = orie::char_tag; break;
-        case DT_REG:  tag = orie::file_tag; break;
-        default:
-            // Should not reach, but don't crash because of this
-            std::cerr << "Warning: unknown file type "
-                      << static_cast<int>(ent->d_type) << '\n';
-            continue; // Do not add it
+    if (_prev_dirs != nullptr) {
+        // A stat is enough to tell whether the previous listing is valid
+        if (::fstatat(parent_fd, name, &stbuf, 0) == 0)
+            res.stamp = __stamp_of(stbuf);
+        if (res.stamp >= _racy_since)
+            res.stamp = 0;
+        if (fetch_prev_dir_info(fullpath, res)) {
+            // Sub directories may still be read relative to it
+            if (dir_fd != nullptr)
+                *dir_fd = ::openat(parent_fd, name, __dir_open_flags);
+            return res;
         }
-        res.second.emplace_back(1, orie::char_t(tag)) += ent->d_name;
     }
 
-    orie::closedir(dirp);
+    int fd = ::openat(parent_fd, name, __dir_open_flags);
+    if (fd < 0)
+        return dir_info_t();
+    if (_prev_dirs == nullptr && ::fstat(fd, &stbuf) == 0)
+        res.stamp = __stamp_of(stbuf);
+    if (res.stamp >= _racy_since)
+        res.stamp = 0;
+
+    __read_dir_fd(fd, res, nullptr);
+    if (dir_fd != nullptr)
+        *dir_fd = fd;
+    else ::close(fd);
     return res;
+#endif
+}
+
+void dumper::__release_dir_fd(int& fd) noexcept {
+    if (fd < 0)
+        return;
+    __close_fd(fd);
+    --_kept_dir_fds;
+    fd = -1;
+}
+
+void dumper::fetch_dir_infos(str_t& fullpath, int parent_fd,
+                             const dir_info_t& parent,
+                             size_t since, size_t until,
+                             std::vector<dir_info_t>& res,
+                             std::vector<int>& dir_fds)
+{
+    res.assign(until - since, dir_info_t());
+    dir_fds.assign(until - since, -1);
+    size_t len_orig = fullpath.size();
+    std::vector<const char_t*> todo; // Basenames of dirs to read
+    std::vector<size_t> todo_at; // Their subscripts in `res`
+    for (size_t i = since; i < until; ++i) {
+        fullpath += parent.subdir(i);
+        if (!is_pruned(fullpath)) {
+            todo.push_back(parent.subdir_cstr(i));
+            todo_at.push_back(i - since);
+        }
+        fullpath.erase(len_orig);
+    }
+
+    // Sub directories of `res[at]` are read relative to its `fd`, if any
+    auto keep_fd = [&] (size_t at, int fd) {
+        if (fd >= 0 && res[at].subdir_count() != 0 &&
+            _kept_dir_fds < max_kept_dir_fds) {
+            dir_fds[at] = fd;
+            ++_kept_dir_fds;
+        } else __close_fd(fd);
+    };
+    // Read synchronously since `k`th of `todo`
+    auto fallback = [&] (size_t k) {
+        for (; k < todo.size(); ++k) {
+            fullpath += todo[k];
+            int fd;
+            res[todo_at[k]] = fetch_dir_info(fullpath, parent_fd, &fd);
+            keep_fd(todo_at[k], fd);
+            fullpath.erase(len_orig);
+        }
+    };
+
+#ifdef ORIE_HAVE_IO_URING
+    if (_uring == nullptr)
+        return fallback(0);
+    int dir_fd = parent_fd >= 0 ? parent_fd :
+        ::open(fullpath.c_str(), __dir_open_flags);
+    if (dir_fd < 0)
+        return fallback(0);
+    // Close `dir_fd` if opened here
+    auto close_dir_fd = [dir_fd, parent_fd] {
+        if (dir_fd != parent_fd)
+            ::close(dir_fd);
+    };
+    std::vector<struct statx> stx;
+    std::vector<int> rets;
+    std::vector<bool> to_read(todo.size(), true);
+
+    if (_prev_dirs != nullptr) {
+        // Stat them all first; only changed ones are read, while unchanged
+        // ones with sub directories are only opened
+        if (!_uring->statx_all(dir_fd, todo, 0, STATX_MTIME | STATX_CTIME,
+                               stx, rets)) {
+            close_dir_fd();
+            _uring = nullptr; // Broken ring
+            return fallback(0);
+        }
+        size_t nopen = 0;
+        for (size_t k = 0; k < todo.size(); ++k) {
+            dir_info_t& info = res[todo_at[k]];
+            if (rets[k] == 0)
+                info.stamp = __stamp_of(stx[k]);
+            if (info.stamp >= _racy_since)
+                info.stamp = 0;
+            fullpath += todo[k];
+            bool unchanged = fetch_prev_dir_info(fullpath, info);
+            fullpath.erase(len_orig);
+            if (!unchanged || info.subdir_count() != 0) {
+                todo[nopen] = todo[k];
+                todo_at[nopen] = todo_at[k];
+                to_read[nopen++] = !unchanged;
+            }
+        }
+        todo.resize(nopen);
+        todo_at.resize(nopen);
+    }
+
+    std::vector<int> fds;
+    bool opened = _uring->openat_all(dir_fd, todo, __dir_open_flags, fds);
+    close_dir_fd();
+    if (!opened) {
+        _uring = nullptr; // Broken ring
+        return fallback(0);
+    }
+
+    std::vector<str_t> unknown; // Entries of unknown types
+    std::vector<const char_t*> unknown_c;
+    for (size_t k = 0; k < todo.size(); ++k) {
+        dir_info_t& info = res[todo_at[k]];
+        if (!to_read[k]) {
+            keep_fd(todo_at[k], fds[k]);
+            continue;
+        }
+        if (fds[k] < 0) {
+            // Unreadable, as in `fetch_dir_info`
+            info = dir_info_t();
+            continue;
+        }
+        orie::stat_t stbuf;
+        if (_prev_dirs == nullptr && ::fstat(fds[k], &stbuf) == 0)
+            info.stamp = __stamp_of(stbuf);
+        if (info.stamp >= _racy_since)
+            info.stamp = 0;
+
+        unknown.clear();
+        __read_dir_fd(fds[k], info, &unknown);
+
+        // Stat entries of unknown types in one batch
+        unknown_c.clear();
+        for (const str_t& name : unknown)
+            unknown_c.push_back(name.c_str());
+        if (!unknown.empty() && (_uring == nullptr || !_uring->statx_all(
+                fds[k], unknown_c, 0, STATX_TYPE, stx, rets))) {
+            _uring = nullptr;
+            rets.assign(unknown.size(), -1);
+        }
+        for (size_t u = 0; u < unknown.size(); ++u) {
+            char_t d_type = DT_REG; // Cannot stat? Dump it as a regular file
+            if (rets[u] == 0)
+                d_type = __dtype_of_mode(stx[u].stx_mode, unknown_c[u]);
+            else if (::fstatat(fds[k], unknown_c[u], &stbuf, 0) == 0)
+                // Not stat'ed in batch; stat it as usual
+                d_type = __dtype_of_mode(stbuf.st_mode, unknown_c[u]);
+            __add_entry(info, d_type, unknown_c[u]);
+        }
+        keep_fd(todo_at[k], fds[k]);
+    }
+#else
+    fallback(0);
+#endif
 }
 
 size_t dumper::dump_one(const str_t& fullpath, size_t basename_len, arr2d_writer& w,
@@ -98,29 +702,36 @@ size_t dumper::dump_one(const str_t& fullpath, size_t basename_len, arr2d_writer
     auto& d = _index._unplaced_dat; // aliase
     sv_t basename_view(fullpath.c_str() + fullpath.size() - basename_len,
                        basename_len);
+    sv_t parent_view(fullpath.c_str(), fullpath.size() == basename_len ?
+                     0 : fullpath.size() - basename_len - 1);
 
     // Dumps full path len and full path if group counter reaches `nfile_in_batch`
     if (nth_file % nfile_in_batch == 0) {
+        _index.mark_seek_point();
         _pos_of_batches.push_back(d.size());
         w.add_int(0, d.size());
         _chunk_of_batches.push_back(_index.chunk_count());
         w.add_int(1, _index.chunk_count());
-        sv_t parent_view(fullpath.c_str(), fullpath.size() == basename_len ?
-                         0 : fullpath.size() - basename_len - 1);
         d.push_back(std::byte(orie::next_group_tag));
         __place_a_name(parent_view, d);
     }
 
-    // Dump dir tag, basename len and basename first
+    // Dump dir tag, basename len, basename and change stamp first
     d.push_back(std::byte(orie::dir_tag));
     __place_a_name(basename_view, d);
-    place_trigram(basename_view, nth_file / nfile_in_batch, w);
+    __place_stamp(info.stamp, d);
+    _placer.place(basename_view, nth_file / nfile_in_batch, w);
+    _placer.place_short(basename_view, nth_file / nfile_in_batch, w);
+    _placer.place_anchors(basename_view, nth_file / nfile_in_batch, w);
+    _placer.place_ancestors(parent_view, nth_file / nfile_in_batch, w);
     ++nth_file;
 
     // For each sub file, dump its file type, name length and name and
     // dump parent path (which is `fullpath` here) if group counter reaches 24
-    for (const str_t& subfile_basename : info.second) {
-        if (nth_file % nfile_in_batch == 0) {
+    for (size_t i = 0; i < info.file_count(); ++i) {
+        bool new_batch = nth_file % nfile_in_batch == 0;
+        if (new_batch) {
+            _index.mark_seek_point();
             _pos_of_batches.push_back(d.size());
             w.add_int(0, d.size());
             _chunk_of_batches.push_back(_index.chunk_count());
@@ -129,33 +740,21 @@ size_t dumper::dump_one(const str_t& fullpath, size_t basename_len, arr2d_writer
             __place_a_name(sv_t(fullpath), d);
         }
 
-        d.push_back(std::byte(subfile_basename.front()));
-        basename_view = sv_t(subfile_basename.c_str() + 1,
-                             subfile_basename.size() - 1);
+        d.push_back(std::byte(info.file_tag(i)));
+        basename_view = info.file(i);
         __place_a_name(basename_view, d);
-        place_trigram(basename_view, nth_file / nfile_in_batch, w);
+        _placer.place(basename_view, nth_file / nfile_in_batch, w);
+        _placer.place_short(basename_view, nth_file / nfile_in_batch, w);
+        _placer.place_anchors(basename_view, nth_file / nfile_in_batch, w);
+        // Ancestors of files are the same in a batch
+        if (i == 0 || new_batch)
+            _placer.place_ancestors(fullpath, nth_file / nfile_in_batch, w);
         ++nth_file;
     }
     return nth_file;
 }
 
-size_t dumper::dump_noconcur(str_t& fullpath, size_t basename_len, arr2d_writer& w,
-                             const dir_info_t& info, size_t nth_file)
-{
-    nth_file = dump_one(fullpath, basename_len, w, info, nth_file);
-    // Dump sub directories
-    fullpath.push_back(separator);
-    size_t subname_since = fullpath.size();
-    for (const str_t& subdir_basename : info.first) {
-        fullpath += subdir_basename;
-        if (!is_pruned(fullpath))
-            nth_file = dump_noconcur(fullpath, subdir_basename.size(), w,
-                                     fetch_dir_info(fullpath), nth_file);
-        fullpath.erase(subname_since);
-    }
-
-    // Dump dir pop tag
-    fullpath.pop_back(); // Pop separator
+void dumper::dump_dir_pop(arr2d_writer& w) {
     auto& d = _index._unplaced_dat; // aliase
     d.push_back(std::byte(dir_pop_tag));
     if (d.size() >= chunk_size_hint) {
@@ -164,65 +763,415 @@ size_t dumper::dump_noconcur(str_t& fullpath, size_t basename_len, arr2d_writer&
         if (!(_index.chunk_count() & 15))
             w.append_pending_to_file();
     }
-    return nth_file;
 }
 
-size_t dumper::dump_concur(str_t& fullpath, size_t basename_len, arr2d_writer& w,
-                           const dir_info_t& info, size_t nth_file)
+size_t dumper::dump_noconcur(str_t& fullpath, size_t basename_len, arr2d_writer& w,
+                             const dir_info_t& info, size_t nth_file, int dir_fd)
 {
-    std::vector<std::future<dir_info_t>> sub_dir_infos(info.first.size());
-    str_t fullpath_cpy(fullpath + separator);
-    std::transform(info.first.begin(), info.first.end(), sub_dir_infos.begin(),
-                   [this, &fullpath_cpy] (const str_t& basename) {
-                    return _pool.enqueue([this, &fullpath_cpy, &basename] () {
-                        str_t p = fullpath_cpy + basename;
-                        if (is_pruned(p))
-                            return dir_info_t();
-                        return fetch_dir_info(p);
-                    });
-                   });
-
-    // Dump dir tag, basename len, basename and sub files
-    // while `fetch_dir_info` are running in background
     nth_file = dump_one(fullpath, basename_len, w, info, nth_file);
     // Dump sub directories
     fullpath.push_back(separator);
     size_t subname_since = fullpath.size();
-    for (ptrdiff_t i = sub_dir_infos.size() - 1; i >= 0; i--) {
-        const str_t& subdir_basename = info.first.at(i);
+    // With io_uring, sub directories are read `uring_queue_depth` at a time
+    bool batched = _uring != nullptr;
+    std::vector<dir_info_t> batch;
+    std::vector<int> batch_fds;
+    // Descriptors left in the batch are released even if dumping throws
+    struct fds_guard {
+        dumper& dmp;
+        std::vector<int>& fds;
+        ~fds_guard() {
+            for (int& fd : fds)
+                dmp.__release_dir_fd(fd);
+        }
+    } __guard{ *this, batch_fds };
+    for (size_t i = 0; i < info.subdir_count(); ++i) {
+        sv_t subdir_basename = info.subdir(i);
+        if (batched && i % uring_queue_depth == 0) {
+            fetch_dir_infos(fullpath, dir_fd, info, i, std::min<size_t>(
+                i + uring_queue_depth, info.subdir_count()), batch, batch_fds);
+        }
         fullpath += subdir_basename;
-        dir_info_t subdir_info = sub_dir_infos[i].get();
-        if (is_noconcur(fullpath))
+        if (batched && !is_pruned(fullpath)) {
+            dir_info_t& subdir_info = batch[i % uring_queue_depth];
+            int& subdir_fd = batch_fds[i % uring_queue_depth];
             nth_file = dump_noconcur(fullpath, subdir_basename.size(), w,
-                                     subdir_info, nth_file);
-        else
-            nth_file = dump_concur(fullpath, subdir_basename.size(), w,
-                                   subdir_info, nth_file);
+                                     subdir_info, nth_file, subdir_fd);
+            subdir_info = dir_info_t();
+            __release_dir_fd(subdir_fd);
+        } else if (!is_pruned(fullpath)) {
+            int subdir_fd;
+            dir_info_t subdir_info = fetch_dir_info(fullpath, dir_fd, &subdir_fd);
+            nth_file = dump_noconcur(fullpath, subdir_basename.size(), w,
+                                     subdir_info, nth_file, subdir_fd);
+            __close_fd(subdir_fd);
+        }
         fullpath.erase(subname_since);
     }
 
-    // Dump dir pop tag
-    auto& d = _index._unplaced_dat; // aliase
     fullpath.pop_back(); // Pop separator
-    d.push_back(std::byte(dir_pop_tag));
-    if (d.size() >= chunk_size_hint) {
-        d.push_back(std::byte(next_chunk_tag));
-        _index.add_last_chunk();
-        if (!(_index.chunk_count() & 15))
-            w.append_pending_to_file();
-    }
+    dump_dir_pop(w);
     return nth_file;
 }
 
-void dumper::rebuild_database() {
+// Reads directories ahead of serialization with a few worker threads.
+// Each worker owns a deque of directories to read. Reading a directory
+// pushes its sub directories to the back of the reader's deque; a worker
+// takes from the back of its own deque, going deeper like serialization
+// does, and steals from the front of others', taking larger subtrees.
+// The serializing thread reads a directory itself if no worker has
+// taken it yet, so that it never waits behind queued work.
+// Workers read at most as many directories of a device at a time as
+// `_concur_limits` allows.
+class dumper::concur_walker {
+public:
+    // Directories of a device in `_concur_limits` being read by workers
+    struct device_t {
+        unsigned limit = 0;
+        std::atomic<unsigned> nreading = 0;
+    };
+    struct node_t;
+    using node_ptr = std::shared_ptr<node_t>;
+    struct node_t {
+        enum state_t : int { pending, claimed, done };
+        str_t fullpath;
+        dir_info_t info;
+        // One for each sub dir of `info`; empty for noconcur directories
+        std::vector<node_ptr> children;
+        std::atomic<int> state = pending;
+        bool noconcur = false;
+        // Device with limited concurrency it is on; nullptr if unlimited
+        device_t* dev = nullptr;
+    };
+
+private:
+    struct deque_t {
+        std::mutex mut;
+        std::deque<node_ptr> q;
+    };
+
+    dumper& _dmp;
+    size_t _nworkers;
+    // One for each worker and the last one for the serializing thread
+    std::unique_ptr<deque_t[]> _deques;
+    // One for each of `_dmp._concur_limits`
+    std::unique_ptr<device_t[]> _devices;
+    std::vector<std::thread> _workers;
+    // Directories read but not serialized yet
+    std::atomic<size_t> _nfetched = 0;
+    // Workers looking for work or waiting for it
+    std::atomic<size_t> _nidle = 0;
+    std::atomic<bool> _stopped = false;
+    std::mutex _idle_mut, _done_mut;
+    std::condition_variable _idle_cv, _done_cv;
+    // Bumped under `_idle_mut` whenever idle workers may find work
+    uint64_t _wake_seq = 0;
+    // First exception thrown by a worker, under `_done_mut`
+    std::exception_ptr _error;
+
+    void wake_idle() {
+        { std::lock_guard __lck(_idle_mut); ++_wake_seq; }
+        _idle_cv.notify_all();
+    }
+
+    // Stop all workers and have the serializing thread throw `e`
+    void fail(std::exception_ptr e) {
+        {
+            std::lock_guard __lck(_done_mut);
+            if (_error == nullptr)
+                _error = std::move(e);
+        }
+        _stopped = true;
+        _done_cv.notify_all();
+        wake_idle();
+    }
+
+    [[noreturn]] void rethrow_error() {
+        std::lock_guard __lck(_done_mut);
+        std::rethrow_exception(_error);
+    }
+
+    bool claim(node_t& n) noexcept {
+        int expected = node_t::pending;
+        return n.state.compare_exchange_strong(expected, node_t::claimed);
+    }
+
+    void push(size_t id, node_ptr n) {
+        std::lock_guard __lck(_deques[id].mut);
+        _deques[id].q.push_back(std::move(n));
+    }
+
+    // Take a read slot of `dev`. The serializing thread never takes one
+    // so that it is never blocked, exceeding the limit by at most one.
+    bool acquire(device_t* dev) noexcept {
+        if (dev == nullptr)
+            return true;
+        unsigned cur = dev->nreading.load();
+        while (cur < dev->limit) {
+            if (dev->nreading.compare_exchange_weak(cur, cur + 1))
+                return true;
+        }
+        return false;
+    }
+
+    void release(device_t* dev) {
+        if (dev == nullptr)
+            return;
+        --dev->nreading;
+        if (_nidle > 0)
+            wake_idle();
+    }
+
+    // Device of `fullpath` being a sub directory of one on `parent_dev`
+    device_t* device_of(const str_t& fullpath, device_t* parent_dev) noexcept {
+        const auto& lims = _dmp._concur_limits;
+        for (size_t i = 0; i < lims.size(); ++i)
+            if (lims[i].first == fullpath)
+                return &_devices[i];
+        return parent_dev;
+    }
+
+    node_ptr pop_or_steal(size_t id) {
+        {
+            std::lock_guard __lck(_deques[id].mut);
+            if (!_deques[id].q.empty()) {
+                node_ptr res = std::move(_deques[id].q.back());
+                _deques[id].q.pop_back();
+                return res;
+            }
+        }
+        for (size_t i = 1; i <= _nworkers; ++i) {
+            deque_t& victim = _deques[(id + i) % (_nworkers + 1)];
+            std::lock_guard __lck(victim.mut);
+            if (!victim.q.empty()) {
+                node_ptr res = std::move(victim.q.front());
+                victim.q.pop_front();
+                return res;
+            }
+        }
+        return nullptr;
+    }
+
+    // Read a claimed directory on behalf of deque `id`
+    void fetch(node_t& n, size_t id) {
+        n.info = _dmp.fetch_dir_info(n.fullpath);
+        if (!n.noconcur) 
+            expand(n, id);
+        ++_nfetched;
+        n.state.store(node_t::done);
+        { std::lock_guard __lck(_done_mut); }
+        _done_cv.notify_all();
+    }
+
+    void run(size_t id) {
+        while (!_stopped) {
+            // Counted as idle before looking for work, so that whoever
+            // queues work it misses sees it and wakes it up
+            ++_nidle;
+            uint64_t seen;
+            {
+                std::lock_guard __lck(_idle_mut);
+                seen = _wake_seq;
+            }
+            node_ptr n;
+            if (_nfetched < max_lookahead_dirs)
+                n = pop_or_steal(id);
+            if (n != nullptr && n->state == node_t::pending &&
+                !acquire(n->dev))
+            {
+                // Its device is busy; leave it for later, to be stolen last
+                std::lock_guard __lck(_deques[id].mut);
+                _deques[id].q.push_front(std::move(n));
+            }
+
+            if (n == nullptr) {
+                std::unique_lock __lck(_idle_mut);
+                _idle_cv.wait(__lck, [this, seen] {
+                    return _wake_seq != seen || _stopped;
+                });
+                --_nidle;
+                continue;
+            }
+            --_nidle;
+            if (n->state == node_t::pending) {
+                if (claim(*n)) {
+                    try {
+                        fetch(*n, id);
+                    } catch (...) {
+                        fail(std::current_exception());
+                    }
+                }
+                release(n->dev);
+            }
+        }
+    }
+
+public:
+    concur_walker(dumper& dmp, size_t nworkers)
+        : _dmp(dmp), _nworkers(nworkers), _deques(new deque_t[nworkers + 1])
+        , _devices(new device_t[dmp._concur_limits.size()])
+    {
+        for (size_t i = 0; i < _dmp._concur_limits.size(); ++i)
+            _devices[i].limit = _dmp._concur_limits[i].second;
+        for (size_t i = 0; i < _nworkers; ++i)
+            _workers.emplace_back(&concur_walker::run, this, i);
+    }
+    ~concur_walker() {
+        _stopped = true;
+        wake_idle();
+        for (std::thread& t : _workers)
+            t.join();
+    }
+
+    // Device of the deepest mount point in `_concur_limits` being `path`
+    // or its parent directory; nullptr if none is.
+    device_t* device_at(sv_t path) noexcept {
+        const auto& lims = _dmp._concur_limits;
+        device_t* res = nullptr;
+        size_t res_len = 0;
+        for (size_t i = 0; i < lims.size(); ++i) {
+            sv_t mnt = lims[i].first;
+            // Root "/" is a parent of everything
+            if (mnt.size() == 1)
+                mnt = sv_t();
+            if (path.substr(0, mnt.size()) == mnt && (path.size() == mnt.size()
+                || path[mnt.size()] == separator) && mnt.size() >= res_len)
+            {
+                res = &_devices[i];
+                res_len = mnt.size();
+            }
+        }
+        return res;
+    }
+
+    // Create (and queue to deque `id`) nodes of sub directories of `n`
+    void expand(node_t& n, size_t id) {
+        str_t fullpath_cpy(n.fullpath + separator);
+        n.children.reserve(n.info.subdir_count());
+        size_t queued = 0;
+        for (size_t i = 0; i < n.info.subdir_count(); ++i) {
+            node_ptr c = std::make_shared<node_t>();
+            (c->fullpath = fullpath_cpy) += n.info.subdir(i);
+            // Pruned directories are dumped with no content
+            if (_dmp.is_pruned(c->fullpath)) {
+                c->state = node_t::done;
+                ++_nfetched;
+            } else {
+                c->noconcur = _dmp.is_noconcur(c->fullpath);
+                c->dev = device_of(c->fullpath, n.dev);
+                // Without workers, the serializing thread reads everything
+                // and nothing has to be queued.
+                if (_nworkers > 0) {
+                    push(id, c);
+                    ++queued;
+                }
+            }
+            n.children.push_back(std::move(c));
+        }
+        if (queued > 0 && _nidle > 0)
+            wake_idle();
+    }
+
+    // Serialize read directory `n` and its sub directories in depth-first
+    // order, as `dump_noconcur` does, while workers read ahead.
+    size_t dump(str_t& fullpath, size_t basename_len, arr2d_writer& w,
+                node_t& n, size_t nth_file)
+    {
+        nth_file = _dmp.dump_one(fullpath, basename_len, w, n.info, nth_file);
+        fullpath.push_back(separator);
+        size_t subname_since = fullpath.size();
+        for (ptrdiff_t i = n.children.size() - 1; i >= 0; i--) {
+            sv_t subdir_basename = n.info.subdir(i);
+            fullpath += subdir_basename;
+            node_t& c = *n.children[i];
+            // Workers only stop early if one of them failed
+            if (__unlikely(_stopped))
+                rethrow_error();
+            if (claim(c))
+                fetch(c, _nworkers);
+            else if (c.state != node_t::done) {
+                std::unique_lock __lck(_done_mut);
+                _done_cv.wait(__lck, [this, &c] {
+                    return c.state == node_t::done || _error != nullptr;
+                });
+                if (c.state != node_t::done)
+                    std::rethrow_exception(_error);
+            }
+
+            if (c.noconcur)
+                nth_file = _dmp.dump_noconcur(fullpath, subdir_basename.size(),
+                                              w, c.info, nth_file);
+            else nth_file = dump(fullpath, subdir_basename.size(), w, c, nth_file);
+            // Let workers read further ahead
+            if (_nfetched-- >= max_lookahead_dirs && _nidle > 0)
+                wake_idle();
+            // A stale pointer to it may remain in some deque for a while
+            c.info = dir_info_t();
+            n.children[i].reset();
+            fullpath.erase(subname_since);
+        }
+
+        fullpath.pop_back(); // Pop separator
+        _dmp.dump_dir_pop(w);
+        return nth_file;
+    }
+};
+
+size_t dumper::dump_concur(str_t& fullpath, size_t basename_len, arr2d_writer& w,
+                           const dir_info_t& info, size_t nth_file)
+{
+    concur_walker walker(*this, _pool.n_workers());
+    concur_walker::node_t root;
+    root.fullpath = fullpath;
+    root.info = info;
+    root.dev = walker.device_at(fullpath);
+    walker.expand(root, _pool.n_workers());
+    return walker.dump(fullpath, basename_len, w, root, nth_file);
+}
+
+void dumper::rebuild_database(dumper* prev) {
+    if (_gen.legacy)
+        throw std::runtime_error("Database of an older version is read only; "
+                                 "rebuild it into a new generation");
+    // Stamps are compared against those recorded by `prev`; racy ones are
+    // recorded as 0 so that they are always read again next time.
+    _racy_since = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count() - _racy_stamp_margin;
+    _reused_dirs = 0;
+    _kept_dir_fds = 0;
+    prev_dirs_t prev_dirs;
+    _prev_dirs = nullptr;
+    if (prev != nullptr && prev != this) {
+        try {
+            load_prev_dirs(*prev, prev_dirs);
+            _prev_dirs = &prev_dirs;
+        } catch (const std::exception&) {
+            // Unreadable previous database; do a full rebuild instead
+        }
+    }
+
+    if (!valid_trigram_bits(_trigram_bits))
+        throw std::runtime_error("Invalid trigram width: " +
+                                 std::to_string(_trigram_bits));
     _index.clear();
+    _index.set_build_params({ chunk_size_hint, nfile_in_batch,
+                              _trigram_bits, 1, 1, 1 });
     _invidx.clear();
 #ifdef _WIN32
     _invidx.close();
 #endif
     _pos_of_batches.clear();
     _chunk_of_batches.clear();
+    _placer.reset(_trigram_bits);
     arr2d_writer w(_invidx.saving_path());
+    // Slow paths are read with batched requests if possible
+    std::unique_ptr<uring> ring;
+    _uring = nullptr;
+    if (!_noconcur_paths.empty()) {
+        ring = std::make_unique<uring>(uring_queue_depth);
+        _uring = ring->ok() ? ring.get() : nullptr;
+    }
     size_t n_file;
 
     if (_root_path.size() == 1) {
@@ -236,11 +1185,12 @@ void dumper::rebuild_database() {
         w.add_int(0, 0);
         _chunk_of_batches.push_back(_index.chunk_count());
         w.add_int(1, 0);
-        // Parent path length (0), tag and name length (0)
+        // Parent path length (0), tag, name length (0) and stamp (0)
         _index._unplaced_dat.assign({
             std::byte(next_group_tag), std::byte(), std::byte(),
             std::byte(dir_tag), std::byte(), std::byte(),
-        }); 
+        });
+        __place_stamp(0, _index._unplaced_dat);
         n_file = 1;
 
         // All drives are its sub dir
@@ -259,19 +1209,22 @@ void dumper::rebuild_database() {
 
         _index._unplaced_dat.push_back(std::byte(dir_pop_tag));
 #else
-        dir_info_t root_info = fetch_dir_info(_root_path);
+        int root_fd;
+        dir_info_t root_info = fetch_dir_info(_root_path, -1, &root_fd);
         str_t dummy;
         if (is_noconcur(_root_path))
-            n_file = dump_noconcur(dummy, 0, w, root_info, 0);
+            n_file = dump_noconcur(dummy, 0, w, root_info, 0, root_fd);
         else n_file = dump_concur(dummy, 0, w, root_info, 0);
+        __close_fd(root_fd);
 #endif
 
     } else {
-        dir_info_t root_info = fetch_dir_info(_root_path);
+        int root_fd;
+        dir_info_t root_info = fetch_dir_info(_root_path, -1, &root_fd);
 #ifdef _WIN32
         // on Windows, if failed, append '\' and try again
         // since for Windows drives only, '\' must be present to fetch info
-        if (root_info.first.empty() && root_info.second.empty()) {
+        if (root_info.empty()) {
             _root_path.push_back(separator);
             root_info = fetch_dir_info(_root_path);
             _root_path.pop_back();
@@ -279,8 +1232,10 @@ void dumper::rebuild_database() {
 #endif
 
         if (is_noconcur(_root_path))
-            n_file = dump_noconcur(_root_path, _root_path.size(), w, root_info, 0);
+            n_file = dump_noconcur(_root_path, _root_path.size(), w,
+                                   root_info, 0, root_fd);
         else n_file = dump_concur(_root_path, _root_path.size(), w, root_info, 0);
+        __close_fd(root_fd);
     }
 
     if (n_file % nfile_in_batch == 0) {
@@ -290,27 +1245,132 @@ void dumper::rebuild_database() {
     }
     _index._unplaced_dat.push_back(std::byte(data_end_tag));
     _index.add_last_chunk();
+    _index.flush();
     w.append_pending_to_file();
+    // Data must be durable before the manifest points to them
+    __sync_path(_index.saving_path());
+    __sync_path(_invidx.saving_path());
     _invidx.refresh();
+    _prev_dirs = nullptr; // `prev_dirs` goes out of scope
+    _uring = nullptr; // So does `ring`
     assert(_pos_of_batches.size() == _chunk_of_batches.size());
+    assert(_kept_dir_fds == 0);
 
     // Having only a few files suggests permission errors while traversing 
     // filesystem. Due to internal implementation of `fs_data_iter`, a forward
     // index with only 1 file results undefined behavior.
     if (n_file <= 2)
         throw std::runtime_error("Too few files are read.");
+    publish();
 }
 
-dumper::dumper(sv_t database_path, fifo_thpool& pool)
-    : _root_path({ separator }), _pool(pool)
-    , _index(database_path, cached_chunk_cnt, false, false)
-    , _invidx(str_t(database_path) + NATIVE_PATH("_inv"))
-    , _pos_of_batches(arr2d_intersect::decompress_entire_line(0, &_invidx))
-    , _chunk_of_batches(arr2d_intersect::decompress_entire_line(1, &_invidx)) {}
+dumper::generation_t dumper::pick_generation(const str_t& db_path, bool next) {
+    generation_t res;
+    bool recorded = __read_manifest(db_path, res.id, res.fwd_path, res.inv_path);
+    if (recorded && !next) {
+        res.fresh = false;
+        return res;
+    }
+    if (!recorded && !next && __is_legacy_db(db_path)) {
+        // Read only, since older versions placed the inverted index here
+        res.fwd_path = db_path;
+        res.inv_path = db_path + NATIVE_PATH("_inv");
+        res.fresh = false;
+        res.legacy = true;
+        return res;
+    }
+    // Without a manifest, the next generation is 1 so that it never
+    // overwrites the generation 0 opened by others
+    res.id = recorded ? res.id + 1 : next;
+    res.fwd_path = __generation_path(db_path, res.id);
+    res.inv_path = res.fwd_path + NATIVE_PATH("_inv");
+    if (!next) {
+        // Generation 0 is shared by all openers until one publishes
+        res.fresh = false;
+        return res;
+    }
+    // Left by a rebuild that never got published
+    std::error_code ec;
+    std::filesystem::remove(res.fwd_path, ec);
+    std::filesystem::remove(res.inv_path, ec);
+    return res;
+}
+
+void dumper::publish() {
+    namespace fs = std::filesystem;
+    size_t base_at = __basename_at(_db_path);
+    str_t dir = base_at == 0 ? str_t(NATIVE_PATH(".")) : _db_path.substr(0, base_at);
+    str_t tmp_path = _gen.fwd_path + NATIVE_PATH(".tmp");
+
+    std::ofstream ofs(fs::path(tmp_path), std::ios::binary | std::ios::trunc);
+    ofs << "orie-manifest 1\ngeneration " << _gen.id
+        << "\nforward " << xxstrcpy(sv_t(_gen.fwd_path).substr(base_at))
+        << "\ninverted " << xxstrcpy(sv_t(_gen.inv_path).substr(base_at)) << '\n';
+    ofs.close();
+    std::error_code ec;
+    try {
+        if (!ofs)
+            throw std::runtime_error("Cannot write " + xxstrcpy(sv_t(tmp_path)));
+#ifndef _WIN32
+        // The manifest is as accessible as the data
+        stat_t st;
+        if (::stat(_gen.fwd_path.c_str(), &st) == 0)
+            ::chmod(tmp_path.c_str(), st.st_mode & 07777);
+#endif
+        __sync_path(tmp_path);
+#ifdef _WIN32
+        bool moved = ::MoveFileExW(tmp_path.c_str(), _db_path.c_str(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+        bool moved = ::rename(tmp_path.c_str(), _db_path.c_str()) == 0;
+#endif
+        if (!moved)
+            throw std::runtime_error("Cannot replace " + xxstrcpy(sv_t(_db_path)));
+    } catch (...) {
+        fs::remove(tmp_path, ec);
+        throw;
+    }
+    // Published already; failing now would get the generation in use
+    // removed as a failed build
+    try {
+        __sync_path(dir, true);
+    } catch (const std::runtime_error& e) {
+        NATIVE_STDERR << NATIVE_PATH("Warning: ") << e.what()
+                      << NATIVE_PATH("; the new database may be lost on "
+                                     "power failure\n");
+    }
+
+    // Readers of the previous generation may still be around
+    std::vector<fs::path> stale{ _db_path + NATIVE_PATH("_inv") }; // Older versions
+    str_t prefix = _db_path.substr(base_at) + NATIVE_PATH(".");
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        uint64_t id;
+        if (__generation_of(it->path().filename().native(), prefix, id) &&
+            id + 1 < _gen.id)
+            stale.push_back(it->path());
+    }
+    for (const fs::path& p : stale)
+        fs::remove(p, ec);
+}
 
-void dumper::move_file(str_t path) {
-    _index.move_file(path.c_str());
-    _invidx.move_file(std::move(path += NATIVE_PATH("_inv")));
+dumper::dumper(sv_t database_path, fifo_thpool& pool, bool next_generation)
+    : _root_path({ separator }), _trigram_bits(default_trigram_bits)
+    , _pool(pool), _db_path(database_path)
+    , _gen(pick_generation(_db_path, next_generation))
+    , _index(_gen.fwd_path, default_cache_budget, _gen.fresh, false)
+    , _invidx(_gen.inv_path)
+    , _pos_of_batches(arr2d_intersect::decompress_entire_line(0, &_invidx))
+    , _chunk_of_batches(arr2d_intersect::decompress_entire_line(1, &_invidx))
+{
+    // Batches are located by their index in the inverted index
+    uint32_t nfile = _index.build_params().nfile_in_batch;
+    if (nfile != 0 && nfile != nfile_in_batch)
+        throw std::runtime_error("Database is built with a different batch "
+                                 "size. Remove it and rebuild.");
+    _trigram_bits = trigram_bits();
+    if (!valid_trigram_bits(_trigram_bits))
+        throw std::runtime_error("Database is built with an unsupported "
+                                 "trigram width. Remove it and rebuild.");
 }
 
 bool dumper::is_pruned(const str_t& fullp) {
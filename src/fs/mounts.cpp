@@ -0,0 +1,154 @@
+#include <orient/fs/mounts.hpp>
+
+#ifdef __linux__
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+extern "C" {
+#include <stdlib.h>
+}
+
+// Filesystems with no real files, or with volatile ones only
+static const char* const __pseudo_fstypes[] = {
+    "proc", "sysfs", "cgroup", "cgroup2", "devpts", "devtmpfs", "tmpfs",
+    "ramfs", "securityfs", "debugfs", "tracefs", "pstore", "bpf", "configfs",
+    "fusectl", "hugetlbfs", "mqueue", "autofs", "binfmt_misc", "efivarfs",
+    "nsfs", "rpc_pipefs", "selinuxfs", "fuse.gvfsd-fuse", "fuse.portal",
+};
+
+static const char* const __network_fstypes[] = {
+    "nfs", "nfs4", "cifs", "smb3", "ceph", "glusterfs", "9p", "fuse.sshfs",
+};
+
+// Undo the octal escapes of ' ', '\t', '\n' and '\\' in mountinfo paths
+static std::string __unescape(const std::string& s) {
+    std::string res;
+    res.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '\\' && i + 3 < s.size() &&
+            std::all_of(s.begin() + i + 1, s.begin() + i + 4,
+                        [] (char c) { return c >= '0' && c <= '7'; }))
+        {
+            res.push_back(char(((s[i+1] - '0') << 6) | ((s[i+2] - '0') << 3) |
+                               (s[i+3] - '0')));
+            i += 3;
+        } else res.push_back(s[i]);
+    }
+    return res;
+}
+
+// Value of `key=` in comma separated `opts`; empty if absent
+static std::string __mount_opt(const std::string& opts, const std::string& key) {
+    size_t at = 0;
+    while (at < opts.size()) {
+        size_t end = opts.find(',', at);
+        if (end == std::string::npos)
+            end = opts.size();
+        if (opts.compare(at, key.size(), key) == 0 &&
+            at + key.size() < end && opts[at + key.size()] == '=')
+            return opts.substr(at + key.size() + 1, end - at - key.size() - 1);
+        at = end + 1;
+    }
+    return std::string();
+}
+
+// Read an unsigned integer from a sysfs attribute file
+static bool __read_attr(const std::string& path, unsigned& res) {
+    std::ifstream ifs(path);
+    return static_cast<bool>(ifs >> res);
+}
+
+// Fill device info of `m` from the block device `majmin` ("8:1")
+static void __fill_device(orie::dmp::mount_info& m, const std::string& sysfs,
+                          const std::string& majmin) {
+    std::string dev = sysfs + "/dev/block/" + majmin;
+    // Partitions have no queue; their parent disk does
+    std::string queue = dev + "/queue/";
+    unsigned rotational;
+    if (!__read_attr(queue + "rotational", rotational)) {
+        queue = dev + "/../queue/";
+        if (!__read_attr(queue + "rotational", rotational))
+            return;
+    }
+    m.rotational = rotational != 0;
+    if (!__read_attr(queue + "nr_requests", m.nr_requests))
+        m.nr_requests = 0;
+
+    char* real = ::realpath(dev.c_str(), nullptr);
+    if (real != nullptr) {
+        std::string name(real);
+        ::free(real);
+        name.erase(0, name.find_last_of('/') + 1);
+        m.nvme = name.compare(0, 4, "nvme") == 0;
+    }
+}
+
+namespace orie {
+namespace dmp {
+
+std::vector<mount_info> read_mounts(const char* mountinfo, const char* sysfs) {
+    std::vector<mount_info> res;
+    std::ifstream ifs(mountinfo);
+    std::string line;
+    while (std::getline(ifs, line)) {
+        // ID, parent ID, major:minor, root, mount point, options,
+        // optional fields, "-", fstype, source, super options
+        std::istringstream iss(line);
+        std::vector<std::string> fields;
+        std::string field;
+        while (iss >> field)
+            fields.push_back(std::move(field));
+        if (fields.size() < 7)
+            continue; // Malformed
+        auto sep = std::find(fields.begin() + 6, fields.end(), "-");
+        if (fields.end() - sep < 2)
+            continue;
+
+        mount_info m;
+        m.path = __unescape(fields[4]);
+        m.fstype = *(sep + 1);
+        m.device = fields[2];
+        m.pseudo = std::find(std::begin(__pseudo_fstypes),
+            std::end(__pseudo_fstypes), m.fstype) != std::end(__pseudo_fstypes);
+        m.network = std::find(std::begin(__network_fstypes),
+            std::end(__network_fstypes), m.fstype) != std::end(__network_fstypes);
+        if (m.fstype == "overlay" && fields.end() - sep >= 4) {
+            for (const char* key : { "upperdir", "workdir" }) {
+                std::string p = __unescape(__mount_opt(*(sep + 3), key));
+                if (!p.empty())
+                    m.hidden_paths.push_back(std::move(p));
+            }
+        }
+        // Major number 0 is for filesystems without a block device
+        if (!m.pseudo && m.device.compare(0, 2, "0:") != 0)
+            __fill_device(m, sysfs, m.device);
+        res.push_back(std::move(m));
+    }
+    return res;
+}
+
+unsigned device_concurrency(const mount_info& m) noexcept {
+    if (m.rotational)
+        return 1;
+    // NVMe drives serve many requests in parallel; more than
+    // `nr_requests / 32` directory reads in flight gain little.
+    if (m.nvme && m.nr_requests != 0)
+        return std::max(2u, m.nr_requests / 32);
+    return 0;
+}
+
+} // namespace dmp
+} // namespace orie
+
+#else // Not Linux
+namespace orie {
+namespace dmp {
+
+std::vector<mount_info> read_mounts(const char*, const char*) { return {}; }
+unsigned device_concurrency(const mount_info& m) noexcept {
+    return m.rotational ? 1 : 0;
+}
+
+} // namespace dmp
+} // namespace orie
+#endif // __linux__
@@ -1,24 +1,98 @@
 #include <orient/fs/trigram.hpp>
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <type_traits>
+
+// CRC of each byte at each position of a 32-bit word. The CRC in
+// `char_to_trigram` has no initial value or final xor, so the CRC of a word
+// is the xor of the CRCs of its 4 bytes.
+using __crc_table_t = std::array<std::array<uint32_t, 256>, 4>;
+static constexpr __crc_table_t __make_crc_table() noexcept {
+    __crc_table_t res{};
+    for (uint32_t pos = 0; pos < 4; ++pos) {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t crc = b << (pos * 8);
+            for (size_t i = 0; i < 32; i++) {
+                bool bit = crc & 0x80000000;
+                crc <<= 1;
+                if (bit)
+                    crc ^= 0x1edc6f41;
+            }
+            res[pos][b] = crc;
+        }
+    }
+    return res;
+}
+static constexpr __crc_table_t __crc_table = __make_crc_table();
+
+static inline uint32_t __crc_word(uint32_t w) noexcept {
+    return __crc_table[0][w & 255] ^ __crc_table[1][(w >> 8) & 255] ^
+           __crc_table[2][(w >> 16) & 255] ^ __crc_table[3][w >> 24];
+}
+
+// Lowercase letters' ASCII codes equal to their uppercase counterparts'
+// plus 32. After these bit-ors, lowercase and uppercase share the same
+// trigrams.
+static inline uint32_t __trigram_word(uint32_t low, uint32_t mid,
+                                      uint32_t high) noexcept {
+    return (low | 0b100000) + ((mid & ~uint32_t(0b100000)) << 8) +
+           ((high | 0b100000) << 16);
+}
+
+static inline uint32_t __key_mask(unsigned bits) noexcept {
+    return (uint32_t(1) << bits) - 1;
+}
+
+// Extensions are hashed a char at a time, each case folded like the low
+// and high chars of trigrams
+static inline uint32_t __ext_step(uint32_t h, orie::char_t c) noexcept {
+    using uchar_t = std::make_unsigned_t<orie::char_t>;
+    return __crc_word(h ^ (uint32_t(uchar_t(c)) | 0b100000));
+}
+
+// Case folded trigram of unsigned chars, which is below
+// `1 << exact_trigram_bits` if all of them fit in a byte
+static inline uint32_t __exact_word(orie::char_t low, orie::char_t mid,
+                                    orie::char_t high) noexcept {
+    using uchar_t = std::make_unsigned_t<orie::char_t>;
+    return __trigram_word(uchar_t(low), uchar_t(mid), uchar_t(high));
+}
+
+// Keys of exact width are the words themselves if they fit, which are never
+// 0 or 1 as lowercase bits are set. Trigrams of wider chars fall back to
+// the CRC, colliding with each other only.
+static inline uint32_t __exact_key(uint32_t word) noexcept {
+    using orie::dmp::exact_trigram_bits;
+    return (word >> exact_trigram_bits) == 0 ? word
+        : __crc_word(word) & __key_mask(exact_trigram_bits);
+}
 
 namespace orie {
 namespace dmp {
 
 // Simple trigram extraction
-size_t strstr_trigram_ext(sv_t name, uint32_t* out, size_t outsz) noexcept {
+size_t strstr_trigram_ext(sv_t name, uint32_t* out, size_t outsz,
+                          unsigned bits) noexcept {
     if (name.size() <= 2)
         return 0;
+    uint32_t hashes[trigram_window_batch];
     size_t outat = 0;
-    for (size_t i = 0; i < name.size() - 2 && outat < outsz; ++i) {
-        uint32_t to_add = char_to_trigram(name[i], name[i+1], name[i+2]) & 8191;
-        if (to_add > 1)
-            out[outat++] = to_add;
+    for (size_t i = 0; i < name.size() - 2 && outat < outsz; ) {
+        size_t nwin = std::min(name.size() - 2 - i, trigram_window_batch);
+        hash_trigrams(name.data() + i, nwin, hashes, bits);
+        for (size_t j = 0; j < nwin && outat < outsz; ++j)
+            if (hashes[j] > 1)
+                out[outat++] = hashes[j];
+        i += nwin;
     }
     return outat;
 }
 
 // Extract trigrams from glob patterns. Does not treat '/' specially
 std::pair<size_t, bool> // trigram size and is basename
-glob_trigram_ext(sv_t pat, uint32_t* out, const size_t outsz, bool full) noexcept {
+glob_trigram_ext(sv_t pat, uint32_t* out, const size_t outsz, bool full,
+                 unsigned bits) noexcept {
     char_t l = 0, m = 0, h = 0;
     bool escape = false;
     size_t outat = 0, oldsz = 0;
@@ -55,7 +129,7 @@ glob_trigram_ext(sv_t pat, uint32_t* out, const size_t outsz, bool full) noexcep
         l = m; m = h; h = *p;
         escape = false;
         if (l != 0 && outat < outsz) {
-            uint32_t toadd = char_to_trigram(l, m, h) & 8191;
+            uint32_t toadd = trigram_key(l, m, h, bits);
             if (toadd > 1)
                 out[outat++] = toadd;
         }
@@ -64,7 +138,8 @@ glob_trigram_ext(sv_t pat, uint32_t* out, const size_t outsz, bool full) noexcep
 }
 
 std::pair<size_t, bool> // trigram size and is basename
-fullpath_trigram_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz) {
+fullpath_trigram_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz,
+                     unsigned bits) {
     // Find the name with at least 1 trigram and as to the right as possible
     size_t cur_at = 0, res = 0;
     sv_t res_name;
@@ -75,8 +150,9 @@ fullpath_trigram_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz) {
             break;
 
         sv_t cur_name = pat.substr(cur_at, next_at - cur_at);
-        size_t cur_res = glob ? glob_trigram_ext(cur_name, out, outsz, true).first
-                              : strstr_trigram_ext(cur_name, out, outsz);
+        size_t cur_res = glob
+            ? glob_trigram_ext(cur_name, out, outsz, true, bits).first
+            : strstr_trigram_ext(cur_name, out, outsz, bits);
         if (cur_res != 0) {
             res = cur_res;
             res_name = cur_name;
@@ -89,8 +165,8 @@ fullpath_trigram_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz) {
     // is much faster than full path search.
     sv_t basename = pat.substr(cur_at);
     auto bn_res = glob 
-        ? glob_trigram_ext(basename, out, outsz, true)
-        : std::make_pair(strstr_trigram_ext(basename, out, outsz), false);
+        ? glob_trigram_ext(basename, out, outsz, true, bits)
+        : std::make_pair(strstr_trigram_ext(basename, out, outsz, bits), false);
     // As long as basename contains any trigram, it is used.
     if (bn_res.first != 0)
         return bn_res;
@@ -99,51 +175,757 @@ fullpath_trigram_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz) {
     return std::make_pair(res, false);
 }
 
+std::pair<size_t, size_t>
+path_trigram_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz,
+                 unsigned bits) noexcept {
+    char_t l = 0, m = 0, h = 0;
+    bool escape = false;
+    // Keys before the last wildcard or separator of a glob pattern,
+    // and before the last separator
+    size_t outat = 0, kept = 0, ancestor = 0;
+
+    for (const char_t* p = pat.data(), *p_end = p + pat.size(); p < p_end; ++p) {
+        if (glob && !escape) {
+            if (*p == char_t('*') || *p == char_t('?')) {
+                l = 0; m = 0; h = 0;
+                kept = outat;
+                continue;
+            } else if (*p == char_t('[')) {
+                // As fnmatch(3), ']' right after '[' or "[!" is in the set
+                const char_t* s = p + 1;
+                if (s < p_end && (*s == char_t('!') || *s == char_t('^')))
+                    ++s;
+                if (s < p_end && *s == char_t(']'))
+                    ++s;
+                while (s < p_end && *s != char_t(']'))
+                    s += (*s == char_t('\\') ? 2 : 1);
+                // Unpaired '[' is a normal char
+                if (s < p_end) {
+                    p = s;
+                    l = 0; m = 0; h = 0;
+                    kept = outat;
+                    continue;
+                }
+            } else if (*p == char_t('\\')) {
+                escape = true;
+                continue;
+            }
+        }
+        escape = false;
+        if (*p == separator) {
+            l = 0; m = 0; h = 0;
+            kept = ancestor = outat;
+            continue;
+        }
+
+        l = m; m = h; h = *p;
+        if (l != 0 && outat < outsz) {
+            uint32_t toadd = trigram_key(l, m, h, bits);
+            if (toadd > 1)
+                out[outat++] = toadd;
+        }
+    }
+    return std::make_pair(glob ? kept : outat, ancestor);
+}
+
+uint32_t bigram_hash(char_t low, char_t high, unsigned bits) noexcept {
+    return trigram_key(low, high, 0, bits);
+}
+
+uint32_t extension_hash(sv_t ext, unsigned bits) noexcept {
+    uint32_t h = 0;
+    for (char_t c : ext)
+        h = __ext_step(h, c);
+    return h & __key_mask(bits);
+}
+
+size_t short_key_ext(sv_t pat, bool glob, uint32_t* out, size_t outsz,
+                     unsigned bits) noexcept {
+    // The previous literal char, 0 after wildcards
+    char_t prev = 0;
+    bool escape = false;
+    // Hash and length of the literal after the last '.', which is the
+    // extension of matches if nothing but literals follows it
+    uint32_t ext = 0;
+    size_t ext_len = 0;
+    bool in_ext = false;
+    size_t outat = 0;
+
+    for (const char_t* p = pat.data(), *p_end = p + pat.size(); p < p_end; ++p) {
+        if (glob && !escape) {
+            if (*p == char_t('*') || *p == char_t('?')) {
+                prev = 0;
+                in_ext = false;
+                continue;
+            } else if (*p == char_t('[')) {
+                // As fnmatch(3), ']' right after '[' or "[!" is in the set
+                const char_t* s = p + 1;
+                if (s < p_end && (*s == char_t('!') || *s == char_t('^')))
+                    ++s;
+                if (s < p_end && *s == char_t(']'))
+                    ++s;
+                while (s < p_end && *s != char_t(']'))
+                    s += (*s == char_t('\\') ? 2 : 1);
+                // Unpaired '[' is a normal char
+                if (s < p_end) {
+                    p = s;
+                    prev = 0;
+                    in_ext = false;
+                    continue;
+                }
+            } else if (*p == char_t('\\')) {
+                escape = true;
+                continue;
+            }
+        }
+        escape = false;
+
+        if (*p == char_t('.')) {
+            ext = 0;
+            ext_len = 0;
+            in_ext = true;
+        } else if (in_ext) {
+            ext = __ext_step(ext, *p);
+            ++ext_len;
+        }
+        if (prev != 0 && outat < outsz)
+            out[outat++] = bigram_key(bigram_hash(prev, *p, bits), bits);
+        prev = *p;
+    }
+
+    if (glob && in_ext && ext_len != 0 && outsz != 0) {
+        outat -= outat == outsz;
+        out[outat++] = extension_key(ext & __key_mask(bits), bits);
+    }
+    return outat;
+}
+
+// Anchor keys of a string of `n` chars starting with `h0, h1` and ending
+// with `t0, t1`; 0 stands for a char of no key
+static size_t __anchor_keys(size_t n, char_t h0, char_t h1, char_t t0,
+                            char_t t1, uint32_t* out, size_t outsz,
+                            unsigned bits) noexcept {
+    size_t outat = 0;
+    auto add = [&] (char_t low, char_t mid, char_t high) {
+        uint32_t k = trigram_key(low, mid, high, bits);
+        if (k > 1 && outat < outsz)
+            out[outat++] = k;
+    };
+    if (n == 1 && h0 != 0)
+        add(separator, h0, separator);
+    else if (n >= 2) {
+        if (h0 != 0 && h1 != 0)
+            add(separator, h0, h1);
+        if (t0 != 0 && t1 != 0)
+            add(t0, t1, separator);
+    }
+    return outat;
+}
+
+size_t name_anchor_ext(sv_t name, uint32_t* out, size_t outsz,
+                       unsigned bits) noexcept {
+    size_t n = name.size();
+    if (n == 0)
+        return 0;
+    return __anchor_keys(n, name[0], n > 1 ? name[1] : 0,
+                         n > 1 ? name[n - 2] : 0, name[n - 1],
+                         out, outsz, bits);
+}
+
+size_t glob_anchor_ext(sv_t pat, uint32_t* out, size_t outsz,
+                       unsigned bits) noexcept {
+    // First and last 2 chars of the pattern, 0 for wildcards and sets
+    char_t head[2] = {}, tail[2] = {};
+    size_t ntok = 0;
+    for (const char_t* p = pat.data(), *p_end = p + pat.size(); p < p_end; ++p) {
+        char_t c = *p;
+        if (c == char_t('*') || c == char_t('?'))
+            c = 0;
+        else if (c == char_t('[')) {
+            // Same sets as `short_key_ext`
+            const char_t* s = p + 1;
+            if (s < p_end && (*s == char_t('!') || *s == char_t('^')))
+                ++s;
+            if (s < p_end && *s == char_t(']'))
+                ++s;
+            while (s < p_end && *s != char_t(']'))
+                s += (*s == char_t('\\') ? 2 : 1);
+            if (s < p_end) {
+                p = s;
+                c = 0;
+            }
+        } else if (c == char_t('\\'))
+            c = ++p < p_end ? *p : 0;
+        if (ntok < 2)
+            head[ntok] = c;
+        tail[0] = tail[1];
+        tail[1] = c;
+        ++ntok;
+    }
+    return __anchor_keys(ntok, head[0], head[1], tail[0], tail[1],
+                         out, outsz, bits);
+}
+
+// Recursive descent over the subset of PCRE2 syntax that literals are
+// extracted from. Anything not understood sets `_fail`, after which the
+// whole pattern requires nothing.
+class __regex_parser {
+    sv_t _pat;
+    size_t _at = 0;
+    bool _fail = false;
+
+    bool __end() const noexcept { return _at >= _pat.size(); }
+    char_t __peek(size_t off = 0) const noexcept {
+        return _at + off < _pat.size() ? _pat[_at + off] : char_t(0);
+    }
+    static bool __is_digit(char_t c) noexcept {
+        return c >= char_t('0') && c <= char_t('9');
+    }
+    static bool __is_alnum(char_t c) noexcept {
+        return __is_digit(c) || (c >= char_t('a') && c <= char_t('z')) ||
+               (c >= char_t('A') && c <= char_t('Z'));
+    }
+    // Skip past the next `close`, failing if there is none
+    void __skip_past(char_t close) noexcept {
+        while (!__end() && __peek() != close)
+            ++_at;
+        if (__end())
+            _fail = true;
+        else ++_at;
+    }
+
+    // Add `sub` to the AND node `res`, flattening ANDs
+    static void __and_push(regex_literals& res, regex_literals&& sub) {
+        if (sub.any())
+            return;
+        if (sub.is_or)
+            res.subs.push_back(std::move(sub));
+        else {
+            for (auto& l : sub.lits)
+                res.lits.push_back(std::move(l));
+            for (auto& s : sub.subs)
+                res.subs.push_back(std::move(s));
+        }
+    }
+    static void __end_run(regex_literals& res, str_t& run) {
+        if (run.size() >= 3)
+            res.lits.push_back(run);
+        run.clear();
+    }
+
+    // Parse a quantifier if any, returning its minimum count, or -1 if
+    // there is none. '{' not starting a quantifier is a literal.
+    long __quantifier() noexcept {
+        long min = -1;
+        char_t c = __peek();
+        if (c == char_t('*') || c == char_t('?')) {
+            min = 0; ++_at;
+        } else if (c == char_t('+')) {
+            min = 1; ++_at;
+        } else if (c == char_t('{')) {
+            size_t p = _at + 1;
+            long n = 0;
+            bool has_min = false, has_max = false, comma = false;
+            for (; p < _pat.size() && __is_digit(_pat[p]); ++p) {
+                n = std::min(n * 10 + long(_pat[p] - char_t('0')), 65536L);
+                has_min = true;
+            }
+            if (p < _pat.size() && _pat[p] == char_t(',')) {
+                comma = true;
+                for (++p; p < _pat.size() && __is_digit(_pat[p]); ++p)
+                    has_max = true;
+            }
+            if (p < _pat.size() && _pat[p] == char_t('}') &&
+                (has_min || (comma && has_max)))
+            {
+                min = has_min ? n : 0;
+                _at = p + 1;
+            }
+        }
+        // Lazy or possessive
+        if (min >= 0 && (__peek() == char_t('?') || __peek() == char_t('+')))
+            ++_at;
+        return min;
+    }
+
+    // Skip a character class. The opening '[' is consumed.
+    void __skip_class() noexcept {
+        if (__peek() == char_t('^'))
+            ++_at;
+        if (__peek() == char_t(']'))
+            ++_at;
+        while (!__end() && __peek() != char_t(']')) {
+            if (__peek() == char_t('\\'))
+                _at += 2;
+            else if (__peek() == char_t('[') && __peek(1) == char_t(':')) {
+                _at += 2;
+                while (!__end() && !(__peek() == char_t(':') &&
+                                     __peek(1) == char_t(']')))
+                    ++_at;
+                _at += 2;
+            } else ++_at;
+        }
+        if (__end())
+            _fail = true;
+        else ++_at;
+    }
+
+    // Skip arguments of an escape `\e` that is not a literal. `\e` is
+    // consumed.
+    void __skip_escape_args(char_t e) noexcept {
+        char_t c = __peek();
+        if (c == char_t('{'))
+            return __skip_past(char_t('}'));
+        switch (e) {
+        case char_t('k'):
+            if (c == char_t('<'))
+                __skip_past(char_t('>'));
+            else if (c == char_t('\''))
+                ++_at, __skip_past(char_t('\''));
+            else _fail = true;
+            break;
+        case char_t('g'):
+            if (c == char_t('<'))
+                __skip_past(char_t('>'));
+            else if (c == char_t('\''))
+                ++_at, __skip_past(char_t('\''));
+            else {
+                if (c == char_t('-') || c == char_t('+'))
+                    ++_at;
+                while (__is_digit(__peek()))
+                    ++_at;
+            }
+            break;
+        case char_t('c'): case char_t('p'): case char_t('P'):
+            if (__end())
+                _fail = true;
+            else ++_at;
+            break;
+        case char_t('x'):
+            for (int i = 0; i < 2 && __is_alnum(__peek()); ++i)
+                ++_at;
+            break;
+        default:
+            if (__is_digit(e))
+                while (__is_digit(__peek()))
+                    ++_at;
+        }
+    }
+
+    // Concatenation of atoms till '|', ')' or the end
+    regex_literals __concat() {
+        regex_literals res;
+        str_t run;
+        while (!_fail && !__end() && __peek() != char_t('|') &&
+               __peek() != char_t(')'))
+        {
+            char_t c = _pat[_at++];
+            // Literal chars just appended to `run`, or a group parsed
+            size_t nlit = 0;
+            std::optional<regex_literals> group;
+
+            if (c == char_t('\\')) {
+                if (__end()) {
+                    _fail = true;
+                    break;
+                }
+                char_t e = _pat[_at++];
+                if (e == char_t('Q')) {
+                    for (; !__end(); ++_at, ++nlit) {
+                        if (__peek() == char_t('\\') && __peek(1) == char_t('E'))
+                            break;
+                        run.push_back(__peek());
+                    }
+                    _at += 2;
+                    if (nlit == 0)
+                        continue;
+                } else if (e == char_t('E'))
+                    continue;
+                else if (__is_alnum(e))
+                    // Classes, assertions, backreferences and char codes
+                    __skip_escape_args(e);
+                else {
+                    run.push_back(e);
+                    nlit = 1;
+                }
+            } else if (c == char_t('[')) {
+                __skip_class();
+            } else if (c == char_t('(')) {
+                group = __group();
+                if (_fail)
+                    break;
+            } else if (c == char_t('.') || c == char_t('^') ||
+                       c == char_t('$') || c == char_t('*') ||
+                       c == char_t('+') || c == char_t('?')) {
+                // Not literals
+            } else {
+                run.push_back(c);
+                nlit = 1;
+            }
+
+            long min = __quantifier();
+            if (nlit != 0) {
+                if (min == 0)
+                    run.pop_back();
+                if (min >= 0) {
+                    // The repeated char is still next to what follows
+                    char_t last = run.empty() ? char_t(0) : run.back();
+                    __end_run(res, run);
+                    if (min > 0)
+                        run.push_back(last);
+                }
+                continue;
+            }
+            __end_run(res, run);
+            if (group.has_value() && min != 0)
+                __and_push(res, std::move(*group));
+        }
+        __end_run(res, run);
+        if (res.lits.empty() && res.subs.size() == 1) {
+            regex_literals only = std::move(res.subs[0]);
+            return only;
+        }
+        return res;
+    }
+
+    // Group after the consumed '('. Lookarounds, comments and option
+    // settings require nothing.
+    std::optional<regex_literals> __group() {
+        bool capture = true;
+        if (__peek() == char_t('*')) {
+            // Verbs
+            _fail = true;
+            return std::nullopt;
+        }
+        if (__peek() == char_t('?')) {
+            ++_at;
+            char_t c = __peek();
+            if (c == char_t(':') || c == char_t('|') || c == char_t('>')) {
+                ++_at;
+            } else if (c == char_t('#')) {
+                __skip_past(char_t(')'));
+                return std::nullopt;
+            } else if (c == char_t('=') || c == char_t('!') ||
+                       (c == char_t('<') && (__peek(1) == char_t('=') ||
+                                             __peek(1) == char_t('!')))) {
+                // Lookarounds are parsed only to find their ends
+                _at += c == char_t('<') ? 2 : 1;
+                capture = false;
+            } else if (c == char_t('<') || c == char_t('\'')) {
+                ++_at;
+                __skip_past(c == char_t('<') ? char_t('>') : char_t('\''));
+            } else if (c == char_t('P') && __peek(1) == char_t('<')) {
+                _at += 2;
+                __skip_past(char_t('>'));
+            } else {
+                // Options, which must not enable extended mode
+                while (__is_alnum(__peek()) || __peek() == char_t('-') ||
+                       __peek() == char_t('^')) {
+                    if (__peek() == char_t('x') || __is_digit(__peek()))
+                        _fail = true;
+                    ++_at;
+                }
+                if (__peek() == char_t(')')) {
+                    ++_at;
+                    return std::nullopt;
+                }
+                if (__peek() != char_t(':'))
+                    _fail = true;
+                ++_at;
+            }
+        }
+        if (_fail)
+            return std::nullopt;
+
+        regex_literals res = __alternation();
+        if (__peek() != char_t(')'))
+            _fail = true;
+        ++_at;
+        if (!capture)
+            return std::nullopt;
+        return res;
+    }
+
+    regex_literals __alternation() {
+        regex_literals res;
+        res.is_or = true;
+        bool any = false;
+        while (true) {
+            regex_literals alt = __concat();
+            if (alt.any())
+                any = true;
+            else if (!alt.is_or && alt.subs.empty() && alt.lits.size() == 1)
+                res.lits.push_back(std::move(alt.lits[0]));
+            else if (alt.is_or) {
+                for (auto& l : alt.lits)
+                    res.lits.push_back(std::move(l));
+                for (auto& s : alt.subs)
+                    res.subs.push_back(std::move(s));
+            } else res.subs.push_back(std::move(alt));
+
+            if (_fail || __peek() != char_t('|'))
+                break;
+            ++_at;
+        }
+        if (any)
+            return regex_literals();
+        if (res.lits.size() + res.subs.size() == 1) {
+            if (!res.lits.empty()) {
+                res.is_or = false;
+                return res;
+            }
+            return std::move(res.subs[0]);
+        }
+        return res;
+    }
+
+public:
+    regex_literals parse() {
+        regex_literals res = __alternation();
+        if (_fail || !__end())
+            return regex_literals();
+        return res;
+    }
+    explicit __regex_parser(sv_t pat) noexcept : _pat(pat) {}
+};
+
+regex_literals regex_literal_ext(sv_t pat) {
+    return __regex_parser(pat).parse();
+}
+
 uint32_t char_to_trigram(uint32_t low, uint32_t mid, uint32_t high) noexcept {
-    low |= 0b100000; // Trick: Lowercase letters' ASCII codes equal to their
-    mid &= ~(0b100000); // uppercase counterparts' plus 32. After these bit-ors,
-    high |= 0b100000; // lowercase and uppercase share the same trigrams.
-    uint32_t crc = low + (mid << 8) + (high << 16);
-    for (size_t i = 0; i < 32; i++) {
-        bool bit = crc & 0x80000000;
-        crc <<= 1;
-        if (bit)
-            crc ^= 0x1edc6f41;
+    return __crc_word(__trigram_word(low, mid, high));
+}
+
+uint32_t trigram_key(char_t low, char_t mid, char_t high, unsigned bits) noexcept {
+    if (bits >= exact_trigram_bits)
+        return __exact_key(__exact_word(low, mid, high));
+    return char_to_trigram(low, mid, high) & __key_mask(bits);
+}
+
+void hash_trigrams(const char_t* p, size_t nwin, uint32_t* out,
+                   unsigned bits) noexcept {
+    if (bits >= exact_trigram_bits) {
+        for (size_t i = 0; i < nwin; ++i)
+            out[i] = __exact_key(__exact_word(p[i], p[i+1], p[i+2]));
+        return;
     }
-    return crc;
+    uint32_t mask = __key_mask(bits);
+    // No dependency between windows; lets the compiler interleave lookups
+    for (size_t i = 0; i < nwin; ++i)
+        out[i] = __crc_word(__trigram_word(p[i], p[i+1], p[i+2])) & mask;
 }
 
-void place_trigram(sv_t name, uint32_t batch, arr2d_writer& w) {
-    for (size_t i = 2; i < name.size(); ++i) {
-        uint32_t to_add = char_to_trigram(name[i-2], name[i-1], name[i]) & 8191;
-        if (to_add > 1)
-            w.add_int(to_add, batch);
+void place_trigram(sv_t name, uint32_t batch, arr2d_writer& w, unsigned bits) {
+    uint32_t hashes[trigram_window_batch];
+    for (size_t i = 2; i < name.size(); ) {
+        size_t nwin = std::min(name.size() - i, trigram_window_batch);
+        hash_trigrams(name.data() + i - 2, nwin, hashes, bits);
+        for (size_t j = 0; j < nwin; ++j)
+            if (hashes[j] > 1)
+                w.add_int(hashes[j], batch);
+        i += nwin;
     }
 }
 
-void trigram_query::reset_strstr_needle(sv_t needle, bool is_full) {
-    _is_full = is_full;
+void trigram_placer::__start_batch(uint32_t batch) {
+    if (_placed.empty())
+        reset(_bits);
+    if (batch != _batch) {
+        for (uint32_t k : _placed_keys)
+            _placed[k / 64] &= ~(uint64_t(1) << (k % 64));
+        _placed_keys.clear();
+        _batch = batch;
+    }
+}
+
+void trigram_placer::place(sv_t name, uint32_t batch, arr2d_writer& w) {
+    __start_batch(batch);
+    uint32_t hashes[trigram_window_batch];
+    for (size_t i = 2; i < name.size(); ) {
+        size_t nwin = std::min(name.size() - i, trigram_window_batch);
+        hash_trigrams(name.data() + i - 2, nwin, hashes, _bits);
+        for (size_t j = 0; j < nwin; ++j) {
+            uint32_t k = hashes[j];
+            uint64_t bit = uint64_t(1) << (k % 64);
+            if (k <= 1 || (_placed[k / 64] & bit))
+                continue;
+            _placed[k / 64] |= bit;
+            _placed_keys.push_back(k);
+            w.add_int(k, batch);
+        }
+        i += nwin;
+    }
+}
+
+void trigram_placer::place_ancestors(sv_t dir, uint32_t batch, arr2d_writer& w) {
+    __start_batch(batch);
+    uint32_t hashes[trigram_window_batch];
+    for (size_t i = 2; i < dir.size(); ) {
+        size_t nwin = std::min(dir.size() - i, trigram_window_batch);
+        const char_t* win = dir.data() + i - 2;
+        hash_trigrams(win, nwin, hashes, _bits);
+        for (size_t j = 0; j < nwin; ++j) {
+            // Trigrams are of names, not across separators
+            if (win[j] == separator || win[j + 1] == separator ||
+                win[j + 2] == separator || hashes[j] <= 1)
+                continue;
+            uint32_t k = ancestor_key(hashes[j], _bits);
+            uint64_t bit = uint64_t(1) << (k % 64);
+            if (_placed[k / 64] & bit)
+                continue;
+            _placed[k / 64] |= bit;
+            _placed_keys.push_back(k);
+            w.add_int(k, batch);
+        }
+        i += nwin;
+    }
+}
+
+void trigram_placer::place_short(sv_t name, uint32_t batch, arr2d_writer& w) {
+    __start_batch(batch);
+    auto place_key = [this, batch, &w] (uint32_t k) {
+        uint64_t bit = uint64_t(1) << (k % 64);
+        if (_placed[k / 64] & bit)
+            return;
+        _placed[k / 64] |= bit;
+        _placed_keys.push_back(k);
+        w.add_int(k, batch);
+    };
+    for (size_t i = 1; i < name.size(); ++i)
+        place_key(bigram_key(bigram_hash(name[i - 1], name[i], _bits), _bits));
+    size_t dot = name.rfind(char_t('.'));
+    if (dot != sv_t::npos && dot + 1 < name.size())
+        place_key(extension_key(extension_hash(name.substr(dot + 1), _bits),
+                                _bits));
+}
+
+void trigram_placer::place_anchors(sv_t name, uint32_t batch, arr2d_writer& w) {
+    __start_batch(batch);
+    uint32_t keys[2];
+    for (size_t i = 0, n = name_anchor_ext(name, keys, 2, _bits); i < n; ++i) {
+        uint32_t k = keys[i];
+        uint64_t bit = uint64_t(1) << (k % 64);
+        if (_placed[k / 64] & bit)
+            continue;
+        _placed[k / 64] |= bit;
+        _placed_keys.push_back(k);
+        w.add_int(k, batch);
+    }
+}
+
+void trigram_placer::reset(unsigned bits) {
+    if (!valid_trigram_bits(bits))
+        throw std::out_of_range("Invalid trigram width");
+    // Keys, their `ancestor_key`s, `bigram_key`s and `extension_key`s
+    _placed.assign((size_t(4) << bits) / 64, 0);
+    _placed_keys.clear();
+    _batch = uint32_t(-1);
+    _bits = bits;
+}
+
+void trigram_query::__extract() {
     auto& lns = _query._lines_to_query;
     lns.resize(32);
 
-    size_t tgr_sz = is_full ?
-        fullpath_trigram_ext(needle, false, lns.data(), 32).first :
-        strstr_trigram_ext(needle, lns.data(), 32);
-    lns.resize(tgr_sz);
+    if (_needle_glob) {
+        auto tgr_sz = _needle_full ?
+            fullpath_trigram_ext(_needle, true, lns.data(), 32, _bits) :
+            glob_trigram_ext(_needle, lns.data(), 32, false, _bits);
+        lns.resize(tgr_sz.first);
+        _is_full = !tgr_sz.second && tgr_sz.first != 0;
+        // Where matches start and end narrows batches most, so first
+        uint32_t anchors[2];
+        size_t nanchor = !_needle_full && _anchor_keys ?
+            glob_anchor_ext(_needle, anchors, 2, _bits) : 0;
+        lns.insert(lns.begin(), anchors, anchors + nanchor);
+        lns.resize(std::min(lns.size(), size_t(32)));
+    } else {
+        size_t tgr_sz = _needle_full ?
+            fullpath_trigram_ext(_needle, false, lns.data(), 32, _bits).first :
+            strstr_trigram_ext(_needle, lns.data(), 32, _bits);
+        lns.resize(tgr_sz);
+        _is_full = _needle_full;
+    }
+
+    // Every literal of the needle is in a name along the path of a match.
+    // Ancestor keys take the place of trigrams from which the subtrees of
+    // directories would be scanned; those anchored in basenames stay.
+    // Literals after the last separator are in the basename or an ancestor.
+    auto& pairs = _query._line_pairs_to_query;
+    pairs.clear();
+    uint32_t path[32];
+    auto [npath, nancestor] = _needle_full && _ancestors ?
+        path_trigram_ext(_needle, _needle_glob, path, 32, _bits) :
+        std::make_pair(size_t(0), size_t(0));
+    if (npath != 0) {
+        if (_is_full)
+            lns.clear();
+        for (size_t i = 0; i < nancestor && lns.size() < 32; ++i)
+            lns.push_back(ancestor_key(path[i], _bits));
+        for (size_t i = nancestor; i < npath; ++i)
+            pairs.emplace_back(path[i], ancestor_key(path[i], _bits));
+        _is_full = false;
+    }
+
+    // Needles too short for trigrams
+    _short.clear();
+    if (lns.empty() && pairs.empty() && !_needle_full) {
+        _short.resize(32);
+        _short.resize(short_key_ext(_needle, _needle_glob,
+                                    _short.data(), 32, _bits));
+    }
+    __plan_short();
     _query.rewind();
 }
 
-void trigram_query::reset_glob_needle(sv_t needle, bool is_full) {
+void trigram_query::__plan_short() {
+    if (_short.empty())
+        return;
     auto& lns = _query._lines_to_query;
-    lns.resize(32);
+    lns.clear();
+    const arr2d_reader* reader = _query.reader();
+    if (!_short_keys || reader == nullptr)
+        return;
 
-    auto tgr_sz = is_full ?
-        fullpath_trigram_ext(needle, true, lns.data(), 32) :
-        glob_trigram_ext(needle, lns.data(), 32, false);
-    lns.resize(tgr_sz.first);
-    _is_full = !tgr_sz.second && tgr_sz.first != 0;
+    // Row 0 has an integer for each batch
+    uint32_t lines[33] = { 0 };
+    size_t totals[33];
+    std::copy(_short.begin(), _short.end(), lines + 1);
+    reader->line_totals(lines, _short.size() + 1, totals);
+    size_t least = *std::min_element(totals + 1, totals + _short.size() + 1);
+    if (least * short_key_max_density <= totals[0])
+        lns = _short;
     _query.rewind();
 }
 
+void trigram_query::reset_reader(const arr2d_reader* reader, unsigned bits,
+                                 bool ancestors, bool short_keys,
+                                 bool anchor_keys) {
+    _query.set_reader(reader);
+    if (bits != _bits || ancestors != _ancestors ||
+        short_keys != _short_keys || anchor_keys != _anchor_keys) {
+        _bits = bits;
+        _ancestors = ancestors;
+        _short_keys = short_keys;
+        _anchor_keys = anchor_keys;
+        __extract();
+    } else __plan_short();
+}
+
+void trigram_query::reset_strstr_needle(sv_t needle, bool is_full) {
+    _needle = needle;
+    _needle_glob = false;
+    _needle_full = is_full;
+    __extract();
+}
+
+void trigram_query::reset_glob_needle(sv_t needle, bool is_full) {
+    _needle = needle;
+    _needle_glob = true;
+    _needle_full = is_full;
+    __extract();
+}
+
 } // namespace dmp
 } // namespace orie
@@ -0,0 +1,320 @@
+#include <orient/fs/watcher.hpp>
+#include <algorithm>
+#include <mutex>
+
+#ifdef __linux__
+extern "C" {
+#include <sys/inotify.h>
+#include <poll.h>
+}
+#endif
+
+// Whether `path` is `dir` or under it
+static bool __is_under(orie::sv_t path, orie::sv_t dir) noexcept {
+    if (dir.empty())
+        return true;
+    if (path.substr(0, dir.size()) != dir)
+        return false;
+    return path.size() == dir.size() || path[dir.size()] == orie::separator ||
+           dir.back() == orie::separator;
+}
+
+static orie::str_t __join(const orie::str_t& dir, orie::sv_t name) {
+    orie::str_t res(dir);
+    if (res.empty() || res.back() != orie::separator)
+        res.push_back(orie::separator);
+    return res += name;
+}
+
+namespace orie {
+namespace dmp {
+
+void delta_segment::add(str_t path, category_tag tag) {
+    std::unique_lock __lck(_mut);
+    _added.insert_or_assign(std::move(path), std::make_pair(tag, _epoch));
+}
+
+std::pair<delta_segment::added_map::const_iterator,
+          delta_segment::added_map::const_iterator>
+delta_segment::__added_below(sv_t dir) const {
+    if (dir.empty())
+        return { _added.begin(), _added.end() };
+    // Paths under `dir` start with `dir` and a separator, which the root
+    // path already ends with; they sort before any path with a greater
+    // character there.
+    str_t lo(dir);
+    if (lo.back() != separator)
+        lo.push_back(separator);
+    str_t hi(lo);
+    ++hi.back();
+    return { _added.lower_bound(lo), _added.lower_bound(hi) };
+}
+
+void delta_segment::remove(str_t path) {
+    std::unique_lock __lck(_mut);
+    auto [below_beg, below_end] = __added_below(path);
+    _added.erase(below_beg, below_end);
+    _added.erase(path);
+    size_t bit = __name_bit(sv_t(path).substr(path.find_last_of(separator) + 1));
+    _removed_names[bit / 64] |= uint64_t(1) << (bit % 64);
+    _removed.insert_or_assign(std::move(path), _epoch);
+    _nremoved = _removed.size();
+}
+
+size_t delta_segment::__name_bit(sv_t name) noexcept {
+    return std::hash<sv_t>{}(name) % (64 * 64);
+}
+
+void delta_segment::__index_removed() noexcept {
+    for (auto& w : _removed_names)
+        w.store(0, std::memory_order_relaxed);
+    for (const auto& [path, epoch] : _removed) {
+        size_t bit = __name_bit(
+            sv_t(path).substr(path.find_last_of(separator) + 1));
+        _removed_names[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+    _nremoved = _removed.size();
+}
+
+bool delta_segment::is_removed(sv_t path) const {
+    if (_nremoved == 0)
+        return false;
+    std::shared_lock __lck(_mut, std::defer_lock);
+    // Check the path itself and each of its parents, locking only if one
+    // of their names may have been deleted
+    while (!path.empty()) {
+        size_t sep_at = path.find_last_of(separator);
+        if (may_be_removed(sep_at == sv_t::npos ? path
+                                                : path.substr(sep_at + 1))) {
+            if (!__lck.owns_lock())
+                __lck.lock();
+            if (_removed.count(str_t(path)))
+                return true;
+        }
+        if (sep_at == sv_t::npos)
+            break;
+        path = path.substr(0, sep_at);
+    }
+    return false;
+}
+
+delta_entries delta_segment::added_under(sv_t prefix) const {
+    delta_entries res;
+    std::shared_lock __lck(_mut);
+    if (!prefix.empty()) {
+        auto it = _added.find(str_t(prefix));
+        if (it != _added.end())
+            res.emplace_back(it->first, it->second.first);
+    }
+    // Sorted already, and `prefix` sorts before entries under it
+    auto [below_beg, below_end] = __added_below(prefix);
+    for (auto it = below_beg; it != below_end; ++it)
+        res.emplace_back(it->first, it->second.first);
+    return res;
+}
+
+bool delta_segment::empty() const noexcept {
+    std::shared_lock __lck(_mut);
+    return _added.empty() && _removed.empty();
+}
+
+uint64_t delta_segment::new_epoch() noexcept {
+    std::unique_lock __lck(_mut);
+    return ++_epoch;
+}
+
+void delta_segment::drop_before(uint64_t epoch,
+                                const std::function<bool(sv_t)>& dumped) {
+    std::unique_lock __lck(_mut);
+    for (auto it = _added.begin(); it != _added.end(); ) {
+        if (it->second.second < epoch && (!dumped || dumped(it->first)))
+            it = _added.erase(it);
+        else ++it;
+    }
+    for (auto it = _removed.begin(); it != _removed.end(); ) {
+        if (it->second < epoch && (!dumped || dumped(it->first)))
+            it = _removed.erase(it);
+        else ++it;
+    }
+    __index_removed();
+}
+
+void delta_segment::forget_added(const std::vector<str_t>& paths) {
+    std::unique_lock __lck(_mut);
+    for (const str_t& p : paths)
+        if (!_removed.count(p))
+            _added.erase(p);
+}
+
+void delta_segment::clear() noexcept {
+    std::unique_lock __lck(_mut);
+    _added.clear();
+    _removed.clear();
+    __index_removed();
+    _overflowed = false;
+}
+
+bool fs_watcher::is_pruned(const str_t& fullp) const {
+    return std::find(_pruned_paths.cbegin(), _pruned_paths.cend(),
+                     fullp) != _pruned_paths.cend();
+}
+
+#ifdef __linux__
+static constexpr uint32_t __watch_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+    IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+static category_tag __tag_of(const str_t& path) noexcept {
+    struct stat stbuf;
+    if (::lstat(path.c_str(), &stbuf) != 0)
+        return file_tag;
+    if (S_ISDIR(stbuf.st_mode)) return dir_tag;
+    if (S_ISLNK(stbuf.st_mode)) return link_tag;
+    if (S_ISFIFO(stbuf.st_mode)) return fifo_tag;
+    if (S_ISCHR(stbuf.st_mode)) return char_tag;
+    if (S_ISBLK(stbuf.st_mode)) return blk_tag;
+    if (S_ISSOCK(stbuf.st_mode)) return sock_tag;
+    return file_tag;
+}
+
+void fs_watcher::__add_watch_recursive(const str_t& path, bool record) {
+    int wd = ::inotify_add_watch(_fd, path.empty() ? "/" : path.c_str(),
+                                 __watch_mask);
+    if (wd < 0) {
+        if (errno == ENOSPC)
+            NATIVE_STDERR << "inotify watch limit reached; " << path
+                          << " is not watched\n";
+        return;
+    }
+    // An existing watch is returned if the dir is already watched, as is
+    // the case when a watched dir is moved.
+    _wd_paths.insert_or_assign(wd, path);
+    _nwatches = _wd_paths.size();
+
+    orie::dir_t* dirp = orie::opendir(path.empty() ? "/" : path.c_str());
+    if (dirp == nullptr)
+        return;
+    std::vector<str_t> subdirs;
+    while (orie::dirent_t* ent = orie::readdir(dirp)) {
+        if (::strcmp(".", ent->d_name) == 0 || ::strcmp("..", ent->d_name) == 0)
+            continue;
+        str_t child = __join(path, ent->d_name);
+        bool is_dir = ent->d_type == DT_DIR ||
+            (ent->d_type == DT_UNKNOWN && __tag_of(child) == dir_tag);
+        if (record)
+            _delta->add(child, is_dir ? dir_tag : __tag_of(child));
+        if (is_dir && !is_pruned(child))
+            subdirs.push_back(std::move(child));
+    }
+    orie::closedir(dirp);
+    for (const str_t& sub : subdirs)
+        __add_watch_recursive(sub, record);
+}
+
+void fs_watcher::__rm_watch_recursive(const str_t& path) {
+    for (auto it = _wd_paths.begin(); it != _wd_paths.end(); ) {
+        if (__is_under(it->second, path)) {
+            ::inotify_rm_watch(_fd, it->first);
+            it = _wd_paths.erase(it);
+        } else ++it;
+    }
+    _nwatches = _wd_paths.size();
+}
+
+void fs_watcher::__watch_loop() {
+    // Buffer aligned to `inotify_event` as inotify(7) suggests
+    alignas(struct inotify_event) char buf[65536];
+    while (!_stopped) {
+        struct pollfd pfd = { _fd, POLLIN, 0 };
+        // Check `_stopped` at least 10 times a second
+        if (::poll(&pfd, 1, 100) <= 0)
+            continue;
+        ssize_t len = ::read(_fd, buf, sizeof(buf));
+        if (len <= 0)
+            continue;
+
+        for (char* p = buf; p < buf + len; ) {
+            const struct inotify_event* ev =
+                reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                NATIVE_STDERR << "inotify queue overflowed; changes are lost "
+                                 "until next updatedb\n";
+                _delta->set_overflowed();
+                continue;
+            }
+            auto wd_it = _wd_paths.find(ev->wd);
+            if (wd_it == _wd_paths.end())
+                continue;
+            if (ev->mask & IN_IGNORED) {
+                _wd_paths.erase(wd_it);
+                _nwatches = _wd_paths.size();
+                continue;
+            }
+            if (ev->len == 0)
+                continue;
+
+            str_t path = __join(wd_it->second, ev->name);
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                // A moved-away dir is watched again if moved to a watched
+                // dir, in which case IN_MOVED_TO follows.
+                if (ev->mask & IN_ISDIR)
+                    __rm_watch_recursive(path);
+                _delta->remove(std::move(path));
+            } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if (is_pruned(path))
+                    continue;
+                category_tag tag = (ev->mask & IN_ISDIR) ? dir_tag
+                                                         : __tag_of(path);
+                _delta->add(path, tag);
+                // Entries created before the watch is set up are recorded
+                // by scanning the new dir.
+                if (tag == dir_tag)
+                    __add_watch_recursive(path, true);
+            }
+        }
+    }
+}
+
+bool fs_watcher::start(str_t root, std::vector<str_t> pruned) {
+    stop();
+    _fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd < 0)
+        return false;
+    _pruned_paths = std::move(pruned);
+    // Root path "/" is represented as an empty string, as in `dumper`
+    if (root.size() == 1 && root[0] == separator)
+        root.clear();
+    __add_watch_recursive(root, false);
+    if (_wd_paths.empty()) {
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+
+    _stopped = false;
+    _watch_thread = std::thread(&fs_watcher::__watch_loop, this);
+    return true;
+}
+
+void fs_watcher::stop() noexcept {
+    _stopped = true;
+    if (_watch_thread.joinable())
+        _watch_thread.join();
+    if (_fd >= 0) {
+        ::close(_fd); // Also removes all watches
+        _fd = -1;
+    }
+    _wd_paths.clear();
+    _nwatches = 0;
+}
+
+#else // Not Linux
+bool fs_watcher::start(str_t, std::vector<str_t>) { return false; }
+void fs_watcher::stop() noexcept {}
+void fs_watcher::__add_watch_recursive(const str_t&, bool) {}
+void fs_watcher::__rm_watch_recursive(const str_t&) {}
+void fs_watcher::__watch_loop() {}
+#endif // __linux__
+
+} // namespace dmp
+} // namespace orie
@@ -4,6 +4,26 @@
 namespace orie {
 namespace pred_tree {
 
+trigram_plan::trigram_plan(const dmp::trigram_query& query,
+                           const fs_data_iter& it, size_t fuzz_thresh)
+    : _query(query), _fuzz_thresh(fuzz_thresh)
+{ it.dumper()->to_query_of_this_index(_query); }
+
+uint32_t trigram_plan::next_from(uint32_t at) {
+    while (!_started || _head < at) {
+        _head = _fuzz_thresh == 0 ? _query.next_batch_possible() :
+            _query.next_fuzz_possible(static_cast<uint32_t>(_fuzz_thresh));
+        _started = true;
+    }
+    return _head;
+}
+
+void trigram_plan::step(fs_data_iter& it, fs_plan& cands) {
+    ++it;
+    if (it.depth() != 0 && it.record().in_batch_pos() == 0)
+        it.change_batch(cands.next_from(it.record().at_batch()));
+}
+
 glob_node::glob_node(bool full, bool lname, bool icase)
     : _is_fullpath(full), _is_lname(lname), _is_icase(icase)
     , _query(nullptr), _last_match(nullptr), _full_match_depth(999999)
@@ -12,7 +32,7 @@ glob_node::glob_node(bool full, bool lname, bool icase)
 glob_node::glob_node(const glob_node& rhs)
     : _pattern(rhs._pattern), _is_fullpath(rhs._is_fullpath)
     , _is_lname(rhs._is_lname), _is_icase(rhs._is_icase)
-    , _query(nullptr, sv_t(_pattern.data()), true, _is_fullpath)
+    , _query(rhs._query)
     , _last_match(nullptr), _full_match_depth(999999) {}
 
 glob_node& glob_node::operator=(const glob_node& r) {
@@ -58,7 +78,7 @@ bool glob_node::apply_blocked(fs_data_iter& it) {
 
 void glob_node::next(fs_data_iter& it, const fs_data_iter&, bool t) {
     // Not supporting trigrams? Just iteration :)
-    if (__unlikely(!t || _is_lname || !_query.trigram_size())) {
+    if (__unlikely(!t || _is_lname || !_query.indexable())) {
         while (it.depth() != 0) {
             if (apply_blocked(it))
                 goto done;
@@ -69,12 +89,19 @@ void glob_node::next(fs_data_iter& it, const fs_data_iter&, bool t) {
 
     // Not the same iterator as before?
     if (__unlikely(_last_match != &it)) {
-        it.dumper()->to_query_of_this_index(_query);
+        if (it.dumper() != nullptr)
+            it.dumper()->to_query_of_this_index(_query);
         _last_match = &it;
         _full_match_depth = 999999;
     }
     else if (it.depth() > 0)
         ++it;
+    // Entries not in any database are not indexed
+    if (__unlikely(it.dumper() == nullptr)) {
+        while (it.depth() != 0 && !apply_blocked(it))
+            ++it;
+        goto done;
+    }
 
     // Iterate through potential leftover since previous full path match
     // as trigrams only match basenames but fullpath patterns not necessarily
@@ -96,13 +123,25 @@ void glob_node::next(fs_data_iter& it, const fs_data_iter&, bool t) {
             }
             ++it;
         } while (it.record().in_batch_pos() != 0 && it.depth() != 0);
-        if (it.depth() != 0)
+        // Keys of short needles may be too dense to look up
+        if (it.depth() != 0 && _query.trigram_size())
             it.change_batch(_query);
     }
 done:
     it.close_index_view();
 }
 
+std::unique_ptr<fs_plan> glob_node::plan(fs_data_iter& it) {
+    if (_is_lname || !_query.indexable() || it.depth() == 0 ||
+        it.dumper() == nullptr)
+        return nullptr;
+    auto res = std::make_unique<trigram_plan>(_query, it);
+    // Subtrees of candidates would have to be scanned as well
+    if (res->query().is_fullpath() || !res->query().trigram_size())
+        return nullptr;
+    return res;
+}
+
 bool glob_node::__next_param_impl(sv_t param) {
     if (_pattern[0] != '\0')
         return false;
@@ -129,14 +168,15 @@ bool glob_node::__next_param_impl(sv_t param) {
 
 bool glob_node::next_param(sv_t param) {
     bool res = __next_param_impl(param);
-    if (res && param.size() >= 3 && param[0] != '-' && param[1] != '-')
+    // Short patterns look up bigram and extension keys
+    if (res && param.substr(0, 2) != NATIVE_SV("--"))
         _query.reset_glob_needle(param, _is_fullpath);
     return res;
 }
 
 bool strstr_node::next_param(sv_t param) {
     bool res = __next_param_impl(param);
-    if (res && param.size() >= 3 && param[0] != '-' && param[1] != '-')
+    if (res && param.substr(0, 2) != NATIVE_SV("--"))
         _query.reset_strstr_needle(param, _is_fullpath);
     return res;
 }
@@ -242,9 +282,72 @@ bool regex_node::next_param(sv_t param) {
                 std::basic_string_view(errbuf, msg_len)
             ));
     }
+    _lits = std::make_shared<const dmp::regex_literals>(
+        dmp::regex_literal_ext(param));
     return true;
 }
 
+std::unique_ptr<fs_plan> regex_node::__plan_of(
+    const dmp::regex_literals& lits, fs_data_iter& it) const
+{
+    std::unique_ptr<fs_plan> res;
+    // Literals without candidates are skipped in AND but fail OR
+    auto add = [&res, &lits] (std::unique_ptr<fs_plan> p) {
+        if (p == nullptr)
+            return !lits.is_or;
+        res = res == nullptr ? std::move(p) : merged_plan<fs_data_iter>::merge(
+            std::move(res), std::move(p), lits.is_or);
+        return true;
+    };
+
+    for (const str_t& lit : lits.lits) {
+        auto p = std::make_unique<trigram_plan>(
+            dmp::trigram_query(nullptr, lit, false, _is_full), it);
+        // Subtrees of candidates would have to be scanned as well
+        if (p->query().is_fullpath() || !p->query().trigram_size())
+            p.reset();
+        if (!add(std::move(p)))
+            return nullptr;
+    }
+    for (const dmp::regex_literals& sub : lits.subs)
+        if (!add(__plan_of(sub, it)))
+            return nullptr;
+    return res;
+}
+
+std::unique_ptr<fs_plan> regex_node::plan(fs_data_iter& it) {
+    if (_is_lname || _lits == nullptr || _lits->any() || it.depth() == 0 ||
+        it.dumper() == nullptr)
+        return nullptr;
+    return __plan_of(*_lits, it);
+}
+
+void regex_node::next(fs_data_iter& it, const fs_data_iter& end, bool t) {
+    // Not supporting trigrams? Just iteration :)
+    if (__unlikely(!faster_with_next(t)))
+        return fs_node::next(it, end, t);
+
+    // Not the same iterator as before?
+    if (__unlikely(_last_match != &it)) {
+        _plan = plan(it);
+        _last_match = &it;
+    }
+    else if (it.depth() > 0) {
+        if (_plan != nullptr)
+            _plan->step(it, *_plan);
+        else ++it;
+    }
+
+    if (_plan == nullptr) {
+        while (it.depth() != 0 && !apply_blocked(it))
+            ++it;
+        return;
+    }
+    while (it.depth() != 0 && !apply_blocked(it))
+        _plan->step(it, *_plan);
+    _plan->stop(it);
+}
+
 fuzz_node::fuzz_node(bool full, bool lname)
     : _is_full(full), _is_lname(lname), _next_cutoff(false)
     , _cutoff(85.0), _query(nullptr), _last_match(nullptr)
@@ -278,11 +381,18 @@ void fuzz_node::next(fs_data_iter& it, const fs_data_iter&, bool t) {
 
     // Not the same iterator as before?
     if (__unlikely(_last_match != &it)) {
-        it.dumper()->to_query_of_this_index(_query);
+        if (it.dumper() != nullptr)
+            it.dumper()->to_query_of_this_index(_query);
         _last_match = &it;
     }
     else if (it.depth() > 0)
         ++it;
+    // Entries not in any database are not indexed
+    if (__unlikely(it.dumper() == nullptr)) {
+        while (it.depth() != 0 && !apply_blocked(it))
+            ++it;
+        goto done;
+    }
 
     while (it.depth() != 0) {
         // Iterate over current batch
@@ -298,6 +408,14 @@ done:
     it.close_index_view();
 }
 
+std::unique_ptr<fs_plan> fuzz_node::plan(fs_data_iter& it) {
+    size_t fuzz_threth = _query.trigram_size() >> 1;
+    if (_is_full || fuzz_threth < 2 || _is_lname || it.depth() == 0 ||
+        it.dumper() == nullptr)
+        return nullptr;
+    return std::make_unique<trigram_plan>(_query, it, fuzz_threth);
+}
+
 bool fuzz_node::apply_blocked(fs_data_iter& it) {
     if (!_matcher.has_value())
         throw orie::pred_tree::uninitialized_node(NATIVE_SV("-fuzz"));
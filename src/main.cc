@@ -97,6 +97,9 @@ try {
         app.add_start_path(::getcwd(cwd_buf, orie::path_max));
 #endif
     }
+    // Every match is printed, so pages of the index are worth evaluating
+    // ahead on the pool
+    app.set_query_window(static_cast<unsigned>(pool.n_workers()));
     app.run(*builder.get(), callback);
 
 } catch (std::exception& e) {
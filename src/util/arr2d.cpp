@@ -8,22 +8,68 @@ extern "C" {
 }
 #endif // _WIN32
 
+#include <orient/util/fifo_thpool.hpp>
 #include <algorithm>
+#include <atomic>
 #include <mutex>
+#include <tuple>
 // Return values of `munmap(2)` are NOT checked because:
 // https://stackoverflow.com/questions/22779556/linux-error-from-munmap
 
 // A legitimate empty array containing 1 page and 0 lines.
 static const uint32_t dummy[2] = {0, 0};
 
+// First word of a sparse page is its number of rows with this bit set.
+// Dense pages never have this many rows.
+static constexpr uint32_t __sparse_page_tag = 0x80000000;
+
 void arr2d_writer::add_int(size_t row, uint32_t val) {
-    if (row >= _data_pending.size())
-        _data_pending.insert(_data_pending.cend(), row - _data_pending.size() + 1,
-                             std::vector<uint32_t>());
+    std::vector<uint32_t>* dest;
+    if (row >= dense_rows)
+        dest = &_sparse_pending[static_cast<uint32_t>(row)];
+    else {
+        if (row >= _data_pending.size())
+            _data_pending.insert(_data_pending.cend(),
+                                 row - _data_pending.size() + 1,
+                                 std::vector<uint32_t>());
+        dest = &_data_pending[row];
+    }
 
     // Check if the value is already placed, ensuring the arrays are ascending
-    if (row <= 1 || _data_pending[row].empty() || _data_pending[row].back() < val)
-        _data_pending[row].push_back(val);
+    if (row <= 1 || dest->empty() || dest->back() < val)
+        dest->push_back(val);
+}
+
+// Layout of a sparse page, in 4 byte words from the page start:
+// [n | __sparse_page_tag][offset of next page][(row, offset of row) * n]
+// followed by row data like dense pages. Rows are ascending and not empty.
+static std::vector<uint32_t> __sparse_page(arr2d_writer& w) {
+    std::vector<std::pair<uint32_t, std::vector<uint32_t>*>> rows;
+    for (size_t i = 0; i < w._data_pending.size(); ++i)
+        if (!w._data_pending[i].empty())
+            rows.emplace_back(static_cast<uint32_t>(i), &w._data_pending[i]);
+    size_t ndense = rows.size();
+    for (auto& [row, d] : w._sparse_pending)
+        if (!d.empty())
+            rows.emplace_back(row, &d);
+    std::sort(rows.begin() + ndense, rows.end());
+
+    std::vector<uint32_t> res(2 + 2 * rows.size());
+    res[0] = static_cast<uint32_t>(rows.size()) | __sparse_page_tag;
+    compressionLib::fastPForCodec codec;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        std::vector<uint32_t>& d = *rows[i].second;
+        res[2 + 2 * i] = rows[i].first;
+        res[3 + 2 * i] = static_cast<uint32_t>(res.size());
+        res.push_back(static_cast<uint32_t>(d.size()));
+        size_t at = res.size();
+        res.resize(at + d.size() + 128);
+        size_t cmprs_len = d.size() + 128;
+        codec.encodeArray(d.data(), d.size(), res.data() + at, cmprs_len);
+        res.resize(at + cmprs_len);
+    }
+    res[1] = static_cast<uint32_t>(res.size());
+    return res;
 }
 
 void arr2d_writer::append_pending_to_file() {
@@ -50,6 +96,30 @@ void arr2d_writer::append_pending_to_file() {
 #endif
     fseek(fp, 0, SEEK_END);
 
+    if (!_sparse_pending.empty()) {
+        std::vector<uint32_t> page;
+        try {
+            page = __sparse_page(*this);
+        } catch (...) {
+            fclose(fp);
+            throw;
+        }
+        bool ok = fwrite(page.data(), sizeof(uint32_t), page.size(), fp)
+                  == page.size();
+        fclose(fp);
+        if (!ok)
+#ifdef _WIN32
+            throw std::runtime_error("Write failed: " +
+                                     orie::xxstrcpy(orie::sv_t(_saving_path)));
+#else
+            throw std::runtime_error("Write failed: " + _saving_path);
+#endif
+        for (auto& d : _data_pending)
+            d.clear();
+        _sparse_pending.clear();
+        return;
+    }
+
     // Write number of rows; only std::bad_alloc exception since then
     uint32_t towrite = static_cast<uint32_t>(_data_pending.size());
     fwrite(&towrite, sizeof(uint32_t), 1, fp);
@@ -179,6 +249,7 @@ void arr2d_reader::refresh() {
     if (st_size.QuadPart == 0) {
         _mapped_sz = 0;
         _mapped_data = dummy;
+        __index_pages();
         if (old_sz != 0)
             UnmapViewOfFile(const_cast<uint32_t*>(old_dat));
         return;
@@ -197,6 +268,7 @@ void arr2d_reader::refresh() {
     if (_mapped_sz != 0) // Previous map was not empty
         UnmapViewOfFile(const_cast<uint32_t*>(old_dat));
     _mapped_sz = static_cast<size_t>(st_size.QuadPart);
+    __index_pages();
 
 #else
     struct stat stbuf;
@@ -209,6 +281,7 @@ void arr2d_reader::refresh() {
         _mapped_sz = 0;
         // The first 0 bytes are definitely correct so no undefined behaviors
         _mapped_data = dummy;
+        __index_pages();
         if (old_sz != 0) // Previous map was not empty
             munmap(const_cast<uint32_t*>(old_dat), old_sz);
         return;
@@ -226,6 +299,7 @@ void arr2d_reader::refresh() {
     if (_mapped_sz != 0) // Previous map was not empty
         munmap(const_cast<uint32_t*>(old_dat), _mapped_sz);
     _mapped_sz = static_cast<size_t>(stbuf.st_size);
+    __index_pages();
 #endif
 }
 
@@ -237,8 +311,7 @@ arr2d_reader::arr2d_reader(orie::str_t fpath)
     , _map_descriptor(-1)
 #endif
     , _map_path(std::move(fpath))
-    , _mapped_data(nullptr) , _mapped_sz(0)
-    , _cache_page_idx(0), _cache_page_offset(0) { refresh(); }
+    , _mapped_data(nullptr) , _mapped_sz(0) { refresh(); }
 
 arr2d_reader::~arr2d_reader() noexcept {
     close();
@@ -257,6 +330,7 @@ void arr2d_reader::close() noexcept {
         UnmapViewOfFile(const_cast<uint32_t*>(_mapped_data));
         _mapped_sz = 0;
         _mapped_data = dummy;
+        _page_offs.assign(1, 0);
     }
     if (_map_descriptor != INVALID_HANDLE_VALUE) {
         CloseHandle(_map_descriptor);
@@ -268,6 +342,7 @@ void arr2d_reader::close() noexcept {
         munmap(const_cast<uint32_t*>(_mapped_data), _mapped_sz);
         _mapped_sz = 0;
         _mapped_data = dummy;
+        _page_offs.assign(1, 0);
     }
     if (_map_descriptor >= 0) {
         ::close(_map_descriptor);
@@ -276,42 +351,32 @@ void arr2d_reader::close() noexcept {
 #endif // _WIN32
 }
 
-// No locks needed inside implementation: all callers to the function
-// obtain locks before this calling it.
-uint32_t arr2d_reader::page_offset(size_t page) const noexcept {
-    // Copy shared cache to local stack to reduce locking
-    _cache_mut.lock();
-    uint32_t cache_page_idx = _cache_page_idx;
-    uint32_t cache_page_offset = _cache_page_offset;
-    _cache_mut.unlock();
-    // If the cached page offset is what we want, don't bother visiting data
-    // Repeated access to a same page is th fastest
-    if (__likely(cache_page_idx == page))
-        return cache_page_offset;
-    // If the cached page is smaller than what we want, iterate from cached
-    // page instead of the beginning.
-    if (cache_page_idx > page)
-        cache_page_idx = (cache_page_offset = 0);
-
-    while (cache_page_idx != page) {
-        // Lines this page +1
-        uint32_t nlinep1 = _mapped_data[cache_page_offset] + 1;
-        // Offset of beginning of next page
-        uint32_t next_off = _mapped_data[cache_page_offset + nlinep1]
-                            + cache_page_offset;
-        if (next_off >= _mapped_sz / sizeof(uint32_t))
-            return ~uint32_t();
-        ++cache_page_idx;
-        cache_page_offset = next_off;
+void arr2d_reader::__index_pages() {
+    // An empty array still has its 0th page
+    _page_offs.assign(1, 0);
+    size_t nword = _mapped_sz / sizeof(uint32_t);
+    if (nword == 0)
+        return;
+    while (true) {
+        uint32_t off = _page_offs.back();
+        uint32_t nline = _mapped_data[off];
+        // A truncated or broken chain ends here
+        if (off + 2 > nword || (!(nline & __sparse_page_tag) &&
+                                off + nline + 2 > nword))
+            break;
+        // Offset of beginning of next page, which follows the line
+        // offsets of dense pages and the page size of sparse ones
+        uint32_t next_off = off + ((nline & __sparse_page_tag)
+            ? _mapped_data[off + 1] : _mapped_data[off + nline + 1]);
+        if (next_off >= nword || next_off <= off)
+            break;
+        _page_offs.push_back(next_off);
     }
+}
 
-    // cache_page_offset now points at beginning of required page
-    // Write back cache
-    _cache_mut.lock();
-    _cache_page_idx = cache_page_idx;
-    _cache_page_offset = cache_page_offset;
-    _cache_mut.unlock();
-    return cache_page_offset;
+size_t arr2d_reader::page_count() const noexcept {
+    std::shared_lock __lck(_access_mut);
+    return _page_offs.size();
 }
 
 // No locks needed inside implementation: all callers to the function
@@ -321,7 +386,28 @@ arr2d_reader::raw_line_data(size_t line, size_t page) const noexcept {
     uint32_t page_off = page_offset(page);
     if (page_off == ~uint32_t())  // Outbound page
         return std::make_tuple(0, ~uint32_t(), ~uint32_t());
-    else if (_mapped_data[page_off] <= line) // Outbound Line
+
+    uint32_t nline = _mapped_data[page_off];
+    if (nline & __sparse_page_tag) {
+        nline &= ~__sparse_page_tag;
+        // Binary search the directory of (line, offset) pairs
+        const uint32_t* dir = _mapped_data + page_off + 2;
+        size_t lo = 0, hi = nline;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (dir[2 * mid] < line)
+                lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == nline || dir[2 * lo] != line) // Empty line
+            return std::make_tuple(0, 0, 0);
+        uint32_t off = dir[2 * lo + 1];
+        uint32_t end = lo + 1 < nline ? dir[2 * lo + 3]
+                                      : _mapped_data[page_off + 1];
+        return std::make_tuple(page_off + off + 1, end - off - 1,
+                               _mapped_data[page_off + off]);
+    }
+    if (nline <= line) // Outbound Line
         return std::make_tuple(0, 0, 0);
 
     uint32_t line_off = page_off + line + 1;
@@ -339,6 +425,22 @@ uint32_t arr2d_reader::uncmprs_size(size_t line, size_t page) const noexcept {
     return std::get<2>(raw_line_data(line, page));
 }
 
+void arr2d_reader::uncmprs_sizes(const uint32_t* lines, size_t nline,
+                                 size_t page, uint32_t* out) const noexcept {
+    std::shared_lock __lck(_access_mut);
+    for (size_t i = 0; i < nline; ++i)
+        out[i] = std::get<2>(raw_line_data(lines[i], page));
+}
+
+void arr2d_reader::line_totals(const uint32_t* lines, size_t nline,
+                               size_t* out) const noexcept {
+    std::shared_lock __lck(_access_mut);
+    std::fill(out, out + nline, 0);
+    for (size_t page = 0; page < _page_offs.size(); ++page)
+        for (size_t i = 0; i < nline; ++i)
+            out[i] += std::get<2>(raw_line_data(lines[i], page));
+}
+
 size_t arr2d_reader::line_data(compressionLib::fastPForCodec &co, uint32_t *out,
                                size_t outsz, size_t line, size_t page) const
 {
@@ -382,84 +484,6 @@ bool arr2d_reader::line_data(compressionLib::fastPForCodec &co,
     return true;
 }
 
-uint32_t arr2d_intersect::next_intersect(size_t redundancy) {
-    if (_reader == nullptr || _lines_to_query.empty())
-        return ~uint32_t();
-    if (!_cur_page_res.empty())
-        goto retrive;
-
-    while (_cur_page_res.empty()) {
-        // Sort the numbers by number of elements in current page ascending
-        std::sort(_lines_to_query.begin(), _lines_to_query.end(),
-                  [this](uint32_t l, uint32_t r) {
-                      return _reader->uncmprs_size(l, _next_page_idx) <
-                             _reader->uncmprs_size(r, _next_page_idx);
-                  });
-        _lines_to_query.erase(std::unique(
-            _lines_to_query.begin(), _lines_to_query.end()
-        ), _lines_to_query.end());
-
-        // Decompress the `_lines_to_query[0]`th line in current page
-        if (!_reader->line_data(_codec, _cur_page_res, _lines_to_query[0],
-                                _next_page_idx))
-            return ~uint32_t(); // No more pages; intersection finished
-        if (_cur_page_res.empty()) {
-            // Trying to intersect an empty line; no result in this page
-            ++_next_page_idx;
-            continue;
-        }
-
-        std::vector<uint32_t> decode_buf, next_res;
-        for (size_t i = 1; i < _lines_to_query.size() &&
-             _cur_page_res.size() > redundancy; ++i)
-        {
-            // Decode next line
-            _reader->line_data(_codec, decode_buf, _lines_to_query[i],
-                               _next_page_idx); // Always returns true
-
-            // Prepare space for intersection
-            next_res.resize(_cur_page_res.size() + 4);
-            // Intersect with previous results
-            size_t inters_sz = compressionLib::i32_intersect(
-                decode_buf.data(), decode_buf.size(),
-                _cur_page_res.data(), _cur_page_res.size(), next_res.data());
-            next_res.resize(inters_sz);
-
-            // Swap preserves buffer allocated
-            std::swap(next_res, _cur_page_res);
-        }
-        // _cur_page_res should be in descending order, so back()s
-        // return ascending values
-        ++_next_page_idx;
-    }
-    std::reverse(_cur_page_res.begin(), _cur_page_res.end());
-
-retrive:
-    uint32_t res = _cur_page_res.back();
-    _cur_page_res.pop_back();
-    return res;
-}
-
-std::vector<uint32_t>
-arr2d_intersect::decompress_entire_line(uint32_t line, const arr2d_reader* r) {
-    std::vector<uint32_t> res;
-    if (r == nullptr)
-        return res;
-    arr2d_intersect q(r);
-    q._lines_to_query.assign({line});
-
-    while (r->uncmprs_size(line, q._next_page_idx) != ~uint32_t()) {
-        uint32_t first = q.next_intersect();
-        if (first != ~uint32_t()) {
-            res.push_back(first);
-            res.insert(res.cend(), q._cur_page_res.crbegin(),
-                       q._cur_page_res.crend());
-            q._cur_page_res.clear();
-        }
-    }
-    return res;
-}
-
 // A simple uint-to-uint flat map for obtaining frequency data
 // in fuzzy matching. Difference between max and min key must be within 1M.
 class flatmap_bad {
@@ -502,31 +526,286 @@ void flatmap_bad::get_frequent_nums(uint32_t threshold,
     }
 }
 
+struct arr2d_intersect::page_buf {
+    compressionLib::fastPForCodec codec;
+    // Lines of the terms and their sizes in the page
+    std::vector<uint32_t> term_lines;
+    std::vector<uint32_t> line_sizes;
+    // Terms with their sizes; the two lines of a single line term are equal
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> sized_terms;
+    std::vector<uint32_t> decode_buf;
+    std::vector<uint32_t> union_buf[2];
+    std::vector<uint32_t> next_res;
+    flatmap_bad freqs;
+};
+
+struct arr2d_intersect::page_job {
+    uint32_t page;
+    std::atomic<bool> claimed{false};
+    bool exists = false;
+    std::vector<uint32_t> res;
+    // Ready when the worker returns, whether it evaluated the page or not
+    std::future<void> done;
+};
+
+// Decode the union of `line1` and `line2` in `page` into `res`
+static bool __union_data(const arr2d_reader& reader,
+    compressionLib::fastPForCodec& codec, std::vector<uint32_t> (&bufs)[2],
+    uint32_t line1, uint32_t line2, size_t page, std::vector<uint32_t>& res)
+{
+    if (line1 == line2)
+        return reader.line_data(codec, res, line1, page);
+    if (!reader.line_data(codec, bufs[0], line1, page))
+        return false;
+    reader.line_data(codec, bufs[1], line2, page);
+    res.resize(bufs[0].size() + bufs[1].size());
+    res.erase(std::set_union(bufs[0].begin(), bufs[0].end(),
+                             bufs[1].begin(), bufs[1].end(), res.begin()),
+              res.end());
+    return true;
+}
+
+bool arr2d_intersect::__intersect_page(const arr2d_reader& reader,
+    const std::vector<uint32_t>& lines,
+    const std::vector<std::pair<uint32_t, uint32_t>>& pairs,
+    size_t page, size_t redundancy, page_buf& buf, std::vector<uint32_t>& res)
+{
+    // Sort the terms by number of elements in current page ascending,
+    // with sizes read at once instead of by each comparison. A pair is
+    // sized as the sum of its lines.
+    buf.term_lines = lines;
+    for (const auto& p : pairs) {
+        buf.term_lines.push_back(p.first);
+        buf.term_lines.push_back(p.second);
+    }
+    buf.line_sizes.resize(buf.term_lines.size());
+    reader.uncmprs_sizes(buf.term_lines.data(), buf.term_lines.size(), page,
+                         buf.line_sizes.data());
+    buf.sized_terms.clear();
+    for (size_t i = 0; i < lines.size(); ++i)
+        buf.sized_terms.emplace_back(buf.line_sizes[i], lines[i], lines[i]);
+    for (size_t i = lines.size(); i < buf.term_lines.size(); i += 2)
+        buf.sized_terms.emplace_back(
+            buf.line_sizes[i] + buf.line_sizes[i + 1],
+            buf.term_lines[i], buf.term_lines[i + 1]);
+    std::sort(buf.sized_terms.begin(), buf.sized_terms.end());
+    buf.sized_terms.erase(std::unique(
+        buf.sized_terms.begin(), buf.sized_terms.end()
+    ), buf.sized_terms.end());
+
+    // Decompress the smallest term in current page
+    if (!__union_data(reader, buf.codec, buf.union_buf,
+                      std::get<1>(buf.sized_terms[0]),
+                      std::get<2>(buf.sized_terms[0]), page, res))
+        return false; // No more pages; intersection finished
+
+    for (size_t i = 1; i < buf.sized_terms.size() &&
+                       res.size() > redundancy; ++i) {
+        // Decode next term
+        __union_data(reader, buf.codec, buf.union_buf,
+                     std::get<1>(buf.sized_terms[i]),
+                     std::get<2>(buf.sized_terms[i]), page,
+                     buf.decode_buf); // Always returns true
+
+        // Prepare space for intersection
+        buf.next_res.resize(res.size() + compressionLib::i32_intersect_slack);
+        // Intersect with previous results
+        size_t inters_sz = compressionLib::i32_intersect_adaptive(
+            buf.decode_buf.data(), buf.decode_buf.size(),
+            res.data(), res.size(), buf.next_res.data());
+        buf.next_res.resize(inters_sz);
+
+        // Swap preserves buffer allocated
+        std::swap(buf.next_res, res);
+    }
+    // Results should be in descending order, so back()s
+    // return ascending values
+    std::reverse(res.begin(), res.end());
+    return true;
+}
+
+bool arr2d_intersect::__frequent_page(const arr2d_reader& reader,
+    const std::vector<uint32_t>& lines, size_t page, uint32_t min_freq,
+    page_buf& buf, std::vector<uint32_t>& res)
+{
+    res.clear();
+    buf.freqs.clear();
+    for (uint32_t line : lines) {
+        // Uncompress this line and +1 frequency for each elem in it
+        if (!reader.line_data(buf.codec, buf.decode_buf, line, page))
+            return false; // No more pages
+        for (uint32_t elem : buf.decode_buf)
+            ++buf.freqs[elem];
+    }
+    buf.freqs.get_frequent_nums(min_freq, res);
+    return true;
+}
+
+uint32_t arr2d_intersect::next_intersect(size_t redundancy) {
+    if (_reader == nullptr ||
+        (_lines_to_query.empty() && _line_pairs_to_query.empty()))
+        return ~uint32_t();
+    while (_cur_page_res.empty()) {
+        if (_window != 0) {
+            if (!__next_page_parallel(false,
+                                      static_cast<uint32_t>(redundancy)))
+                return ~uint32_t();
+            continue;
+        }
+        if (!__intersect_page(*_reader, _lines_to_query, _line_pairs_to_query,
+                              _next_page_idx, redundancy, *_buf,
+                              _cur_page_res))
+            return ~uint32_t();
+        ++_next_page_idx;
+    }
+
+    uint32_t res = _cur_page_res.back();
+    _cur_page_res.pop_back();
+    return res;
+}
+
 uint32_t arr2d_intersect::next_frequent(uint32_t min_freq) {
     if (_reader == nullptr || _lines_to_query.empty())
         return ~uint32_t();
-    if (__likely(!_cur_page_res.empty()))
-        goto retrive;
-
-{   std::vector<uint32_t> decode_buf;
-    flatmap_bad cur_page_freqs;
     while (_cur_page_res.empty()) {
-        for (uint32_t line : _lines_to_query) {
-            // Uncompress this line and +1 frequency for each elem in it
-            if (!_reader->line_data(_codec, decode_buf, line,
-                                    _next_page_idx))
-                return ~uint32_t(); // No more pages
-            for (uint32_t elem : decode_buf)
-                ++cur_page_freqs[elem];
+        if (_window != 0) {
+            if (!__next_page_parallel(true, min_freq))
+                return ~uint32_t();
+            continue;
         }
+        if (!__frequent_page(*_reader, _lines_to_query, _next_page_idx,
+                             min_freq, *_buf, _cur_page_res))
+            return ~uint32_t();
         ++_next_page_idx;
-        cur_page_freqs.get_frequent_nums(min_freq, _cur_page_res);
-        cur_page_freqs.clear();
     }
-}
 
-retrive:
     uint32_t res = _cur_page_res.back();
     _cur_page_res.pop_back();
     return res;
 }
+
+bool arr2d_intersect::__next_page_parallel(bool frequent, uint32_t param) {
+    // Jobs of other lines or parameters are of no use
+    if (!_jobs.empty() && (_job_frequent != frequent || _job_param != param ||
+                           *_job_lines != _lines_to_query ||
+                           *_job_pairs != _line_pairs_to_query))
+        __cancel_jobs();
+    if (_jobs.empty()) {
+        _job_lines = std::make_shared<const std::vector<uint32_t>>(
+            _lines_to_query);
+        _job_pairs = std::make_shared<
+            const std::vector<std::pair<uint32_t, uint32_t>>>(
+                _line_pairs_to_query);
+        _job_frequent = frequent;
+        _job_param = param;
+    }
+
+    // Keep `_window` pages in flight, not past the last page
+    uint32_t to_submit = _jobs.empty() ? _next_page_idx
+                                       : _jobs.back()->page + 1;
+    size_t npage = _reader->page_count();
+    while (_jobs.size() < _window && to_submit < npage) {
+        auto job = std::make_shared<page_job>();
+        job->page = to_submit++;
+        job->done = _pool->enqueue(
+            [job, lines = _job_lines, pairs = _job_pairs, reader = _reader,
+             frequent, param] {
+                if (job->claimed.exchange(true))
+                    return; // Taken back by the query
+                thread_local page_buf buf;
+                job->exists = frequent ?
+                    __frequent_page(*reader, *lines, job->page, param,
+                                    buf, job->res) :
+                    __intersect_page(*reader, *lines, *pairs, job->page,
+                                     param, buf, job->res);
+            });
+        _jobs.push_back(std::move(job));
+    }
+
+    if (_jobs.empty()) {
+        // Past the last page, or the reader has just grown
+        bool exists = frequent ?
+            __frequent_page(*_reader, _lines_to_query, _next_page_idx, param,
+                            *_buf, _cur_page_res) :
+            __intersect_page(*_reader, _lines_to_query, _line_pairs_to_query,
+                             _next_page_idx, param, *_buf, _cur_page_res);
+        _next_page_idx += exists;
+        return exists;
+    }
+
+    std::shared_ptr<page_job> job = std::move(_jobs.front());
+    _jobs.pop_front();
+    if (!job->claimed.exchange(true)) {
+        // Not started by any worker, which may all be waiting like us
+        job->exists = frequent ?
+            __frequent_page(*_reader, *_job_lines, job->page, param,
+                            *_buf, job->res) :
+            __intersect_page(*_reader, *_job_lines, *_job_pairs, job->page,
+                             param, *_buf, job->res);
+    } else job->done.get(); // Rethrows what the worker threw
+    std::swap(_cur_page_res, job->res);
+    _next_page_idx += job->exists;
+    return job->exists;
+}
+
+void arr2d_intersect::__cancel_jobs() noexcept {
+    for (auto& job : _jobs)
+        if (job->claimed.exchange(true))
+            job->done.wait(); // Being evaluated; it still uses the reader
+    _jobs.clear();
+}
+
+void arr2d_intersect::set_parallel(orie::fifo_thpool* pool,
+                                   size_t window) noexcept {
+    __cancel_jobs();
+    _pool = pool;
+    if (pool == nullptr || pool->n_workers() == 0)
+        _window = 0;
+    else _window = window != 0 ? window : pool->n_workers();
+}
+
+arr2d_intersect::arr2d_intersect(const arr2d_reader* reader)
+    : _reader(reader), _next_page_idx(0), _buf(new page_buf) {}
+
+arr2d_intersect::arr2d_intersect(const arr2d_intersect& rhs)
+    : _reader(rhs._reader), _cur_page_res(rhs._cur_page_res)
+    , _next_page_idx(rhs._next_page_idx), _buf(new page_buf)
+    , _pool(rhs._pool), _window(rhs._window)
+    , _lines_to_query(rhs._lines_to_query)
+    , _line_pairs_to_query(rhs._line_pairs_to_query) {}
+
+arr2d_intersect& arr2d_intersect::operator=(const arr2d_intersect& rhs) {
+    if (&rhs != this) {
+        __cancel_jobs();
+        _reader = rhs._reader;
+        _cur_page_res = rhs._cur_page_res;
+        _next_page_idx = rhs._next_page_idx;
+        _pool = rhs._pool;
+        _window = rhs._window;
+        _lines_to_query = rhs._lines_to_query;
+        _line_pairs_to_query = rhs._line_pairs_to_query;
+    }
+    return *this;
+}
+
+arr2d_intersect::~arr2d_intersect() noexcept { __cancel_jobs(); }
+
+std::vector<uint32_t>
+arr2d_intersect::decompress_entire_line(uint32_t line, const arr2d_reader* r) {
+    std::vector<uint32_t> res;
+    if (r == nullptr)
+        return res;
+    arr2d_intersect q(r);
+    q._lines_to_query.assign({line});
+
+    while (r->uncmprs_size(line, q._next_page_idx) != ~uint32_t()) {
+        uint32_t first = q.next_intersect();
+        if (first != ~uint32_t()) {
+            res.push_back(first);
+            res.insert(res.cend(), q._cur_page_res.crbegin(),
+                       q._cur_page_res.crend());
+            q._cur_page_res.clear();
+        }
+    }
+    return res;
+}
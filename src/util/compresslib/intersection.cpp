@@ -5,6 +5,15 @@
  */
 
 #include <orient/util/compresslib/intersection.h>
+#include <algorithm>
+#include <array>
+
+// Kernels of wider vectors are compiled for their targets only and chosen
+// at runtime, so that the library runs on any x86-64 CPU.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define ORIE_X86_TARGETS
+#endif
 
 namespace compressionLib {
 
@@ -112,4 +121,199 @@ size_t i32_intersect(const uint32_t *A, const size_t s_a,
   return out - initout;
 }
 
+/**
+ * Scalar intersection of what is left after SIMD kernels.
+ */
+static uint32_t *scalar_tail(const uint32_t *A, size_t i_a, const size_t s_a,
+                             const uint32_t *B, size_t i_b, const size_t s_b,
+                             uint32_t *out) {
+  while (i_a < s_a && i_b < s_b) {
+    if (A[i_a] < B[i_b]) {
+      i_a++;
+    } else if (B[i_b] < A[i_a]) {
+      i_b++;
+    } else {
+      *out++ = B[i_b];
+      i_a++;
+      i_b++;
+    }
+  }
+  return out;
+}
+
+size_t i32_intersect_galloping(const uint32_t *A, const size_t s_a,
+                               const uint32_t *B, const size_t s_b,
+                               uint32_t *out) {
+  if (s_a > s_b)
+    return i32_intersect_galloping(B, s_b, A, s_a, out);
+  const uint32_t *const initout(out);
+  size_t i_b = 0;
+  for (size_t i_a = 0; i_a < s_a && i_b < s_b; ++i_a) {
+    const uint32_t x = A[i_a];
+    if (B[i_b] < x) {
+      // Double the step until passing x, then binary search the last step
+      size_t lo = i_b, step = 1;
+      while (lo + step < s_b && B[lo + step] < x) {
+        lo += step;
+        step *= 2;
+      }
+      i_b = std::lower_bound(B + lo + 1, B + std::min(lo + step + 1, s_b), x)
+            - B;
+      if (i_b == s_b)
+        break;
+    }
+    if (B[i_b] == x) {
+      *out++ = x;
+      i_b++;
+    }
+  }
+  return out - initout;
+}
+
+#ifdef ORIE_X86_TARGETS
+/**
+ * Permutation moving the integers selected by each 8-bit mask to the front
+ */
+struct compress_table_t {
+  alignas(32) uint32_t idx[256][8];
+};
+static constexpr compress_table_t make_compress_table() {
+  compress_table_t res{};
+  for (uint32_t mask = 0; mask < 256; ++mask) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < 8; ++i)
+      if (mask & (1 << i))
+        res.idx[mask][n++] = i;
+  }
+  return res;
+}
+static constexpr compress_table_t compress_table = make_compress_table();
+
+__attribute__((target("avx2,popcnt")))
+size_t i32_intersect_avx2(const uint32_t *A, const size_t s_a,
+                          const uint32_t *B, const size_t s_b, uint32_t *out) {
+  assert(out != A);
+  assert(out != B);
+  const uint32_t *const initout(out);
+  size_t i_a = 0, i_b = 0;
+  // trim lengths to be a multiple of 8
+  size_t st_a = (s_a / 8) * 8;
+  size_t st_b = (s_b / 8) * 8;
+  if (i_a < st_a && i_b < st_b) {
+    const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    __m256i v_a = _mm256_loadu_si256((const __m256i *)&A[i_a]);
+    __m256i v_b = _mm256_loadu_si256((const __m256i *)&B[i_b]);
+    while (true) {
+      // Compare all pairs by rotating v_b 7 times
+      __m256i cmp_mask = _mm256_cmpeq_epi32(v_a, v_b);
+      __m256i rotated = v_b;
+      for (int i = 1; i < 8; ++i) {
+        rotated = _mm256_permutevar8x32_epi32(rotated, rotate);
+        cmp_mask = _mm256_or_si256(cmp_mask, _mm256_cmpeq_epi32(v_a, rotated));
+      }
+      const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(cmp_mask));
+      // copy out common elements
+      const __m256i perm =
+          _mm256_load_si256((const __m256i *)compress_table.idx[mask]);
+      _mm256_storeu_si256((__m256i *)out,
+                          _mm256_permutevar8x32_epi32(v_a, perm));
+      out += _mm_popcnt_u32(mask);
+
+      const uint32_t a_max = A[i_a + 7];
+      const uint32_t b_max = B[i_b + 7];
+      if (a_max <= b_max) {
+        i_a += 8;
+        if (i_a >= st_a)
+          break;
+        v_a = _mm256_loadu_si256((const __m256i *)&A[i_a]);
+      }
+      if (a_max >= b_max) {
+        i_b += 8;
+        if (i_b >= st_b)
+          break;
+        v_b = _mm256_loadu_si256((const __m256i *)&B[i_b]);
+      }
+    }
+  }
+  return scalar_tail(A, i_a, s_a, B, i_b, s_b, out) - initout;
+}
+
+__attribute__((target("avx512f,popcnt")))
+size_t i32_intersect_avx512(const uint32_t *A, const size_t s_a,
+                            const uint32_t *B, const size_t s_b, uint32_t *out) {
+  assert(out != A);
+  assert(out != B);
+  const uint32_t *const initout(out);
+  size_t i_a = 0, i_b = 0;
+  // trim lengths to be a multiple of 16
+  size_t st_a = (s_a / 16) * 16;
+  size_t st_b = (s_b / 16) * 16;
+  if (i_a < st_a && i_b < st_b) {
+    const __m512i rotate = _mm512_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                             11, 12, 13, 14, 15, 0);
+    __m512i v_a = _mm512_loadu_si512(&A[i_a]);
+    __m512i v_b = _mm512_loadu_si512(&B[i_b]);
+    while (true) {
+      // Compare all pairs by rotating v_b 15 times
+      __mmask16 mask = _mm512_cmpeq_epi32_mask(v_a, v_b);
+      __m512i rotated = v_b;
+      for (int i = 1; i < 16; ++i) {
+        // Masked to avoid a false uninitialized warning of GCC
+        rotated = _mm512_maskz_permutexvar_epi32(0xFFFF, rotate, rotated);
+        mask |= _mm512_cmpeq_epi32_mask(v_a, rotated);
+      }
+      // copy out common elements
+      _mm512_mask_compressstoreu_epi32(out, mask, v_a);
+      out += _mm_popcnt_u32(mask);
+
+      const uint32_t a_max = A[i_a + 15];
+      const uint32_t b_max = B[i_b + 15];
+      if (a_max <= b_max) {
+        i_a += 16;
+        if (i_a >= st_a)
+          break;
+        v_a = _mm512_loadu_si512(&A[i_a]);
+      }
+      if (a_max >= b_max) {
+        i_b += 16;
+        if (i_b >= st_b)
+          break;
+        v_b = _mm512_loadu_si512(&B[i_b]);
+      }
+    }
+  }
+  return scalar_tail(A, i_a, s_a, B, i_b, s_b, out) - initout;
+}
+
+bool cpu_has_avx2() noexcept { return __builtin_cpu_supports("avx2"); }
+bool cpu_has_avx512() noexcept { return __builtin_cpu_supports("avx512f"); }
+
+#else
+size_t i32_intersect_avx2(const uint32_t *A, const size_t s_a,
+                          const uint32_t *B, const size_t s_b, uint32_t *out) {
+  return i32_intersect(A, s_a, B, s_b, out);
+}
+size_t i32_intersect_avx512(const uint32_t *A, const size_t s_a,
+                            const uint32_t *B, const size_t s_b, uint32_t *out) {
+  return i32_intersect(A, s_a, B, s_b, out);
+}
+bool cpu_has_avx2() noexcept { return false; }
+bool cpu_has_avx512() noexcept { return false; }
+#endif // ORIE_X86_TARGETS
+
+using intersect_fn = size_t (*)(const uint32_t *, const size_t,
+                                const uint32_t *, const size_t, uint32_t *);
+
+size_t i32_intersect_adaptive(const uint32_t *A, const size_t s_a,
+                              const uint32_t *B, const size_t s_b,
+                              uint32_t *out) {
+  // The AVX-512 kernel does twice the comparisons of the AVX2 one per
+  // block and measured slower on posting lists, so AVX2 is preferred.
+  static const intersect_fn simd = cpu_has_avx2() ? i32_intersect_avx2
+                                                  : i32_intersect;
+  if (std::min(s_a, s_b) * i32_gallop_ratio < std::max(s_a, s_b))
+    return i32_intersect_galloping(A, s_a, B, s_b, out);
+  return simd(A, s_a, B, s_b, out);
+}
+
 } // namespace SIMDCompressionLib
@@ -1,126 +1,903 @@
 #include <orient/util/file_mem_chunk.hpp>
+#include <algorithm>
+#include <functional>
 #ifdef _WIN32
 #define fopen _wfopen
+#else
+extern "C" {
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+}
+#endif
+
+// Header of files of version 2 and later. Fields are in native byte order.
+struct __header_t {
+    char magic[8];
+    uint32_t version;
+    // Where chunks start
+    uint32_t header_size;
+    uint64_t chunk_count;
+    // Where the table of `chunk_count + 1` offset presums starts
+    uint64_t table_offset;
+    uint64_t chunk_size_hint;
+    uint32_t nfile_in_batch;
+    // 0 in files written before it was recorded
+    uint32_t trigram_bits;
+    // 0 in files written before it was recorded
+    uint32_t ancestor_keys;
+    // 0 in files written before it was recorded
+    uint32_t short_keys;
+    // 0 in files written before it was recorded
+    uint32_t anchor_keys;
+    uint32_t reserved;
+};
+static_assert(sizeof(__header_t) == 64);
+
+// Version 1 files have a fixed table of 4096 presums ahead of chunks
+static constexpr size_t __v1_table_len = 4096;
+
+// Since version 3, a chunk starts with its frame count `n`, `n + 1` raw
+// offsets of frames, ending with the raw size, and `n + 1` offsets of
+// compressed frames from the chunk start, ending with the chunk size.
+static size_t __frame_table_size(uint64_t nframe) noexcept {
+    return static_cast<size_t>((2 * nframe + 3) * sizeof(uint64_t));
+}
+// Largest zstd frame header, which tells the raw size of the frame
+static constexpr size_t __zstd_header_max = 18;
+
+// 64-bit `fseek`, since `long` is 32-bit on Windows
+static bool __seek(FILE* fp, uint64_t off, int whence = SEEK_SET) noexcept {
+#ifdef _WIN32
+    return ::_fseeki64(fp, static_cast<__int64>(off), whence) == 0;
+#else
+    return ::fseeko(fp, static_cast<off_t>(off), whence) == 0;
+#endif
+}
+
+static uint64_t __tell(FILE* fp) noexcept {
+#ifdef _WIN32
+    return static_cast<uint64_t>(::_ftelli64(fp));
+#else
+    return static_cast<uint64_t>(::ftello(fp));
 #endif
+}
 
 namespace orie {
 namespace dmp {
 
-const std::byte* file_mem_chunk::start_visit(uint32_t chunk_idx, size_t at) {
-    if (chunk_idx >= _chunk_num)
-        throw std::out_of_range("Chunk Index Out of Range");
-    uint8_t in_which_cache;
-
-cache_read:
-    __writer_lock(); // Cache table is shared (critical section) therefore lock
-    // Read cache table. If this chunk is already in, return it
-    in_which_cache = _chunkid_to_cacheid[chunk_idx];
-    if (__unlikely(in_which_cache >= 8))
-        goto cache_write;
-    if (at >= _cached_dat[in_which_cache].size()) {
-        finish_visit();
-        throw std::out_of_range("Chunk Visit Out of Range");
+// Set in `pins` of entries being evicted or free; readers seeing it
+// unpin and retry
+static constexpr uint32_t __evicting = uint32_t(1) << 31;
+
+struct file_mem_chunk::entry_t {
+    // Raw data, allocated as a whole but decompressed by frames
+    std::unique_ptr<std::byte[]> dat;
+    size_t size = 0;
+    // Raw offsets of frames followed by `size`, and offsets of compressed
+    // frames in file followed by their end; the latter is empty if all
+    // frames are decompressed
+    std::vector<uint64_t> raw_at, cmprs_at;
+    std::unique_ptr<std::atomic<bool>[]> decoded;
+    // Bytes of decompressed frames; guarded by `_cache_mut`
+    size_t decoded_bytes = 0;
+    // Number of readers pinning it, plus `__evicting`
+    std::atomic<uint32_t> pins{ __evicting };
+    std::atomic<uint32_t> chunk{ ~uint32_t() };
+    // Visited since the clock hand passed
+    std::atomic<bool> referenced{ false };
+    // In `_protected` rather than `_probation`; guarded by `_cache_mut`
+    bool is_protected = false;
+};
+
+file_mem_chunk::entry_t* file_mem_chunk::__pin(uint32_t chunk_idx) noexcept {
+    for (;;) {
+        entry_t* e = __slot(chunk_idx).load(std::memory_order_acquire);
+        if (e == nullptr)
+            return nullptr;
+        uint32_t prev = e->pins.fetch_add(1, std::memory_order_acquire);
+        // Not evicted, nor reused for another chunk, after being loaded
+        if (!(prev & __evicting) &&
+            e->chunk.load(std::memory_order_relaxed) == chunk_idx) {
+            if (!e->referenced.load(std::memory_order_relaxed))
+                e->referenced.store(true, std::memory_order_relaxed);
+            return e;
+        }
+        e->pins.fetch_sub(1, std::memory_order_release);
+        std::this_thread::yield(); // The slot is being cleared
+    }
+}
+
+#ifndef _WIN32
+template <class fn_t>
+void file_mem_chunk::__with_data(uint64_t at, size_t n, fn_t fn) {
+    uint64_t end = _data_offset + at + n;
+    std::shared_lock __lck(_file_mut);
+    if (end > _map_valid) {
+        __lck.unlock();
+        {
+            std::lock_guard __map_lck(_file_mut);
+            if (end > _map_valid)
+                __remap(end);
+        }
+        __lck.lock();
     }
-    return _cached_dat[in_which_cache].data() + at;
-
-cache_write: {
-    finish_visit();
-    std::lock_guard __lck(_buf_mut);
-    // Needed data may already been filled during waiting
-    in_which_cache = _chunkid_to_cacheid[chunk_idx];
-    if (in_which_cache < 8)
-        goto cache_read;
-
-    // Only do cache swapping if not in cache
-    size_t beg = _chunk_size_presum[chunk_idx],
-           end = _chunk_size_presum[chunk_idx + 1],
-           read_sz = end - beg;
-    // C-style binary file read
-    FILE *fp = fopen(_saving_path.c_str(), NATIVE_PATH("rb")); 
-    if (fp == nullptr || end == ~size_t())
+    fn(_map + _data_offset + at);
+}
+
+void file_mem_chunk::__remap(uint64_t end) {
+    int fd = ::open(_saving_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
         throw std::runtime_error("Cannot read database");
-    // TODO: Magic number
-    fseek(fp, sizeof(size_t) * 4096 + beg, SEEK_SET);
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < end) {
+        ::close(fd);
+        throw std::runtime_error("Encountered bad data within database");
+    }
+    size_t fsize = static_cast<size_t>(st.st_size);
+    // Still within the mapping, which is larger than the file
+    if (fsize <= _map_len) {
+        ::close(fd);
+        _map_valid = fsize;
+        return;
+    }
+    // Room for the file to grow while being written, so that it is only
+    // remapped a few times. Pages beyond the file are never touched.
+    size_t len = std::max(2 * fsize, size_t(1) << 24);
+    void* p = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("Cannot map database");
+    __unmap();
+    _map = static_cast<const std::byte*>(p);
+    _map_len = len;
+    _map_valid = fsize;
+}
+
+void file_mem_chunk::__unmap() noexcept {
+    if (_map != nullptr)
+        ::munmap(const_cast<std::byte*>(_map), _map_len);
+    _map = nullptr;
+    _map_len = _map_valid = 0;
+}
+#else // No mapping; read into a temporary buffer
+template <class fn_t>
+void file_mem_chunk::__with_data(uint64_t at, size_t n, fn_t fn) {
+    std::vector<std::byte> buf(n);
+    {
+        // C-style binary file read
+        std::shared_lock __file_lck(_file_mut);
+        FILE *fp = fopen(_saving_path.c_str(), NATIVE_PATH("rb"));
+        if (fp == nullptr)
+            throw std::runtime_error("Cannot read database");
+        bool read_ok = __seek(fp, _data_offset + at) &&
+                       fread(buf.data(), 1, n, fp) == n;
+        fclose(fp);
+        if (!read_ok)
+            throw std::runtime_error("Encountered bad data within database");
+    }
+    fn(buf.data());
+}
+
+void file_mem_chunk::__remap(uint64_t) {}
+void file_mem_chunk::__unmap() noexcept {}
+#endif
+
+void file_mem_chunk::__read_frame_table(uint32_t chunk_idx,
+                                        std::vector<uint64_t>& raw_at,
+                                        std::vector<uint64_t>& cmprs_at)
+{
+    auto [beg, end] = __wait_written(chunk_idx);
+    size_t chunk_sz = static_cast<size_t>(end - beg);
+    if (_version >= 3) {
+        uint64_t nframe = 0;
+        if (chunk_sz >= sizeof(nframe))
+            __with_data(beg, sizeof(nframe), [&nframe] (const std::byte* p) {
+                memcpy(&nframe, p, sizeof(nframe)); });
+        if (nframe == 0 || nframe > chunk_sz || __frame_table_size(nframe) > chunk_sz)
+            throw std::runtime_error("Encountered bad data within database");
+        size_t table_sz = __frame_table_size(nframe);
+        raw_at.resize(nframe + 1);
+        cmprs_at.resize(nframe + 1);
+        __with_data(beg, table_sz, [&] (const std::byte* p) {
+            memcpy(raw_at.data(), p + sizeof(uint64_t),
+                   raw_at.size() * sizeof(uint64_t));
+            memcpy(cmprs_at.data(), p + (nframe + 2) * sizeof(uint64_t),
+                   cmprs_at.size() * sizeof(uint64_t));
+        });
+        if (raw_at[0] != 0 || cmprs_at[0] != table_sz ||
+            cmprs_at.back() != chunk_sz ||
+            std::adjacent_find(raw_at.begin(), raw_at.end(),
+                               std::greater_equal<uint64_t>()) != raw_at.end() ||
+            !std::is_sorted(cmprs_at.begin(), cmprs_at.end()))
+            throw std::runtime_error("Encountered bad data within database");
+    } else {
+        // A single frame, whose header tells the raw size
+        size_t head_sz = std::min(chunk_sz, __zstd_header_max);
+        unsigned long long raw_sz = ZSTD_CONTENTSIZE_ERROR;
+        __with_data(beg, head_sz, [&] (const std::byte* p) {
+            raw_sz = ZSTD_getFrameContentSize(p, head_sz); });
+        if (raw_sz == ZSTD_CONTENTSIZE_ERROR || raw_sz == ZSTD_CONTENTSIZE_UNKNOWN ||
+            raw_sz == 0)
+            throw std::runtime_error("Encountered bad data within database");
+        raw_at = { 0, raw_sz };
+        cmprs_at = { 0, chunk_sz };
+    }
+    for (uint64_t& c : cmprs_at)
+        c += beg;
+}
 
-    // Remove previous cache info
-    in_which_cache = (_next_overwrite++ % _cache_num);
-    _chunkid_to_cacheid[_cacheid_to_chunkid[in_which_cache]] = ~uint8_t();
-    _cacheid_to_chunkid[in_which_cache] = chunk_idx;
-    _chunkid_to_cacheid[chunk_idx] = in_which_cache;
+file_mem_chunk::entry_t* file_mem_chunk::__load(uint32_t chunk_idx, size_t at) {
+    size_t shard = chunk_idx % load_shards;
+    std::unique_lock __lck(_load_muts[shard]);
+    // Loaded by another reader while waiting
+    if (entry_t* e = __pin(chunk_idx)) {
+        __lck.unlock();
+        try {
+            __reveal(e, chunk_idx, at);
+        } catch (...) {
+            e->pins.fetch_sub(1, std::memory_order_release);
+            throw;
+        }
+        return e;
+    }
+
+    std::vector<uint64_t> raw_at, cmprs_at;
+    __read_frame_table(chunk_idx, raw_at, cmprs_at);
 
     // TODO: May throw when out of memory
-    // Temporary buffer for Decompression
-    std::vector<std::byte> cmprs_buf(read_sz, std::byte());
-    // Read file data
-    if (fread(cmprs_buf.data(), 1, read_sz, fp) != read_sz)
+    // Pages of frames never decompressed are never touched
+    entry_t* e = __make_room(chunk_idx, 0);
+    e->size = static_cast<size_t>(raw_at.back());
+    e->dat.reset(new std::byte[e->size]);
+    e->decoded.reset(new std::atomic<bool>[raw_at.size() - 1]());
+    e->raw_at = std::move(raw_at);
+    e->cmprs_at = std::move(cmprs_at);
+    __publish(e, chunk_idx, 1);
+    try {
+        if (at < e->size)
+            __decode_frame(e, std::upper_bound(e->raw_at.begin(), e->raw_at.end(),
+                                               at) - e->raw_at.begin() - 1, shard);
+    } catch (...) {
+        e->pins.fetch_sub(1, std::memory_order_release);
+        throw;
+    }
+    return e;
+}
+
+void file_mem_chunk::__reveal(entry_t* e, uint32_t chunk_idx, size_t at) {
+    if (at >= e->size)
+        return;
+    size_t f = std::upper_bound(e->raw_at.begin(), e->raw_at.end(), at) -
+               e->raw_at.begin() - 1;
+    if (e->decoded[f].load(std::memory_order_acquire))
+        return;
+    size_t shard = chunk_idx % load_shards;
+    std::lock_guard __lck(_load_muts[shard]);
+    if (!e->decoded[f].load(std::memory_order_relaxed))
+        __decode_frame(e, f, shard);
+}
+
+void file_mem_chunk::__decode_frame(entry_t* e, size_t f, size_t shard) {
+    size_t read_sz = static_cast<size_t>(e->cmprs_at[f + 1] - e->cmprs_at[f]);
+    size_t raw_sz = static_cast<size_t>(e->raw_at[f + 1] - e->raw_at[f]);
+    size_t res;
+    __with_data(e->cmprs_at[f], read_sz, [&] (const std::byte* src) {
+        res = ZSTD_decompressDCtx(_dctxs[shard], e->dat.get() + e->raw_at[f],
+                                  raw_sz, src, read_sz);
+    });
+    if (ZSTD_isError(res) || res != raw_sz)
         throw std::runtime_error("Encountered bad data within database");
-    fclose(fp);
-    
-    // Decompress and place it to cache TODO: error handling
-    size_t cmprs_sz = ZSTD_getFrameContentSize(cmprs_buf.data(), read_sz);
-    _cached_dat[in_which_cache].assign(cmprs_sz, std::byte());
-    ZSTD_decompressDCtx(_dctx, _cached_dat[in_which_cache].data(), cmprs_sz,
-                        cmprs_buf.data(), cmprs_buf.size());
+    e->decoded[f].store(true, std::memory_order_release);
+    __account(e, raw_sz);
+}
+
+void file_mem_chunk::__account(entry_t* e, size_t bytes) {
+    std::lock_guard __lck(_cache_mut);
+    e->decoded_bytes += bytes;
+    _cached_bytes += bytes;
+    if (!e->is_protected)
+        _probation_bytes += bytes;
+    // `e` is pinned and never evicted here
+    while (_cached_bytes > _cache_budget && __evict_one())
+        ;
+}
+
+file_mem_chunk::entry_t*
+file_mem_chunk::__make_room(uint32_t chunk_idx, size_t bytes) {
+    std::lock_guard __lck(_cache_mut);
+    while (_cached_bytes + bytes > _cache_budget && __evict_one())
+        ;
+    entry_t* e;
+    if (_free_entries.empty()) {
+        _entries.push_back(std::make_unique<entry_t>());
+        e = _entries.back().get();
+    } else {
+        e = _free_entries.back();
+        _free_entries.pop_back();
+    }
+
+    // Loaded again soon after eviction; worth protecting
+    auto ghost = std::find(_ghosts.begin(), _ghosts.end(), chunk_idx);
+    e->is_protected = ghost != _ghosts.end();
+    if (e->is_protected) {
+        _ghosts.erase(ghost);
+        _protected.push_back(e);
+    } else {
+        _probation.push_back(e);
+        _probation_bytes += bytes;
+    }
+    e->referenced.store(false, std::memory_order_relaxed);
+    _cached_bytes += bytes;
+    return e;
 }
-    goto cache_read;
+
+bool file_mem_chunk::__evict_one() noexcept {
+    auto try_evict = [this] (entry_t* e) {
+        uint32_t unpinned = 0;
+        if (!e->pins.compare_exchange_strong(unpinned, __evicting,
+                                             std::memory_order_acquire))
+            return false;
+        uint32_t chunk_idx = e->chunk.load(std::memory_order_relaxed);
+        __slot(chunk_idx).store(nullptr, std::memory_order_release);
+        _cached_bytes -= e->decoded_bytes;
+        if (!e->is_protected) {
+            _probation_bytes -= e->decoded_bytes;
+            _ghosts.push_back(chunk_idx);
+            // As many ghosts as entries in memory
+            while (_ghosts.size() > _probation.size() + _protected.size())
+                _ghosts.pop_front();
+        }
+        e->dat.reset();
+        e->decoded.reset();
+        e->size = e->decoded_bytes = 0;
+        e->raw_at.clear();
+        e->cmprs_at.clear();
+        _free_entries.push_back(e);
+        return true;
+    };
+    auto evict_probation = [&] () {
+        for (size_t n = _probation.size(); n != 0; --n) {
+            entry_t* e = _probation.front();
+            _probation.pop_front();
+            if (try_evict(e))
+                return true;
+            _probation.push_back(e); // Pinned
+        }
+        return false;
+    };
+    auto evict_protected = [&] () {
+        // Every entry gets a second chance
+        for (size_t n = 2 * _protected.size(); n != 0; --n) {
+            if (_clock_hand >= _protected.size())
+                _clock_hand = 0;
+            entry_t* e = _protected[_clock_hand];
+            if (!e->referenced.exchange(false, std::memory_order_relaxed) &&
+                try_evict(e)) {
+                _protected[_clock_hand] = _protected.back();
+                _protected.pop_back();
+                return true;
+            }
+            ++_clock_hand;
+        }
+        return false;
+    };
+
+    // Probation takes at least a quarter of the budget if needed
+    if (_probation_bytes > _cache_budget / 4 || _protected.empty())
+        return evict_probation() || evict_protected();
+    return evict_protected() || evict_probation();
 }
 
+void file_mem_chunk::__publish(entry_t* e, uint32_t chunk_idx,
+                               uint32_t pins) noexcept {
+    e->chunk.store(chunk_idx, std::memory_order_relaxed);
+    // Readers failing to pin it while free have undone their counts
+    e->pins.fetch_add(pins - __evicting, std::memory_order_release);
+    __slot(chunk_idx).store(e, std::memory_order_release);
+}
+
+void file_mem_chunk::__drop_cache() noexcept {
+    std::lock_guard __lck(_cache_mut);
+    for (auto& e : _entries) {
+        uint32_t chunk_idx = e->chunk.load(std::memory_order_relaxed);
+        if (!(e->pins.load(std::memory_order_relaxed) & __evicting))
+            __slot(chunk_idx).store(nullptr, std::memory_order_relaxed);
+    }
+    _entries.clear();
+    _free_entries.clear();
+    _probation.clear();
+    _protected.clear();
+    _ghosts.clear();
+    _clock_hand = 0;
+    _cached_bytes = _probation_bytes = 0;
+}
+
+const std::byte* file_mem_chunk::start_visit(uint32_t chunk_idx, size_t at) {
+    if (chunk_idx >= _chunk_num.load(std::memory_order_acquire))
+        throw std::out_of_range("Chunk Index Out of Range");
+    if (chunk_idx < _hot_chunks) {
+        if (at >= _hot_at[chunk_idx + 1] - _hot_at[chunk_idx])
+            throw std::out_of_range("Chunk Visit Out of Range");
+        return _hot + _hot_at[chunk_idx] + at;
+    }
+    entry_t* e = __pin(chunk_idx);
+    if (__unlikely(e == nullptr))
+        e = __load(chunk_idx, at);
+    else try {
+        __reveal(e, chunk_idx, at);
+    } catch (...) {
+        e->pins.fetch_sub(1, std::memory_order_release);
+        throw;
+    }
+    if (at >= e->size) {
+        e->pins.fetch_sub(1, std::memory_order_release);
+        throw std::out_of_range("Chunk Visit Out of Range");
+    }
+    // Likely reached from the end of the previous chunk
+    if (at == 0 && chunk_idx != 0 && _readahead.load(std::memory_order_relaxed) &&
+        __slot(chunk_idx - 1).load(std::memory_order_relaxed) != nullptr)
+        __prefetch(chunk_idx);
+    return e->dat.get() + at;
+}
+
+void file_mem_chunk::__prefetch(uint32_t chunk_idx) {
+    uint32_t last = static_cast<uint32_t>(std::min<uint64_t>(
+        _chunk_num.load(), uint64_t(chunk_idx) + 1 + _readahead.load()));
+    std::lock_guard __lck(_prefetch_mut);
+    if (!_prefetcher.joinable()) {
+        _prefetch_stop = false;
+        _prefetcher = std::thread(&file_mem_chunk::__prefetch_loop, this);
+    }
+    for (uint32_t i = chunk_idx; i < last; ++i)
+        if (std::find(_prefetch_queue.begin(), _prefetch_queue.end(), i) ==
+            _prefetch_queue.end())
+            _prefetch_queue.push_back(i);
+    // Those left behind by readers are of no use
+    while (_prefetch_queue.size() > last - chunk_idx)
+        _prefetch_queue.pop_front();
+    _prefetch_cv.notify_one();
+}
+
+void file_mem_chunk::__prefetch_loop() {
+    std::unique_lock __lck(_prefetch_mut);
+    for (;;) {
+        _prefetch_cv.wait(__lck, [this] {
+            return _prefetch_stop || !_prefetch_queue.empty(); });
+        if (_prefetch_stop)
+            break;
+        uint32_t chunk_idx = _prefetch_queue.front();
+        _prefetch_queue.pop_front();
+        __lck.unlock();
+
+        try {
+            entry_t* e = __pin(chunk_idx);
+            if (e == nullptr)
+                e = __load(chunk_idx, 0);
+            try {
+                for (size_t f = 0; f + 1 < e->raw_at.size(); ++f)
+                    __reveal(e, chunk_idx, e->raw_at[f]);
+            } catch (...) {
+                e->pins.fetch_sub(1, std::memory_order_release);
+                throw;
+            }
+            e->pins.fetch_sub(1, std::memory_order_release);
+        } catch (const std::exception&) {} // Left to readers to find
+        __lck.lock();
+    }
+}
+
+void file_mem_chunk::__stop_prefetch() noexcept {
+    std::unique_lock __lck(_prefetch_mut);
+    _prefetch_queue.clear();
+    if (!_prefetcher.joinable())
+        return;
+    _prefetch_stop = true;
+    _prefetch_cv.notify_all();
+    __lck.unlock();
+    _prefetcher.join();
+}
+
+void file_mem_chunk::extend_visit(uint32_t chunk_idx, size_t at) {
+    if (chunk_idx < _hot_chunks)
+        return;
+    // Pinned entries stay in their slots
+    __reveal(__slot(chunk_idx).load(std::memory_order_relaxed), chunk_idx, at);
+}
+
+void file_mem_chunk::finish_visit(uint32_t chunk_idx) noexcept {
+    if (chunk_idx < _hot_chunks)
+        return;
+    // Pinned entries stay in their slots
+    __slot(chunk_idx).load(std::memory_order_relaxed)
+        ->pins.fetch_sub(1, std::memory_order_release);
+}
+
+void file_mem_chunk::make_hot(const str_t& dir) {
+#ifdef _WIN32
+    (void)dir;
+    throw std::runtime_error("Hot forward index is not supported on Windows");
+#else
+    flush();
+    __stop_prefetch();
+    uint32_t nchunk = _chunk_num.load();
+    std::vector<std::vector<uint64_t>> raw_ats(nchunk), cmprs_ats(nchunk);
+    std::vector<uint64_t> hot_at{ 0 };
+    for (uint32_t i = 0; i < nchunk; ++i) {
+        __read_frame_table(i, raw_ats[i], cmprs_ats[i]);
+        hot_at.push_back(hot_at.back() + raw_ats[i].back());
+    }
+
+    size_t len = std::max<size_t>(hot_at.back(), 1);
+    int fd = -1;
+    if (!dir.empty()) {
+        str_t tmpl = dir + NATIVE_PATH("/orient-hot-XXXXXX");
+        if ((fd = ::mkstemp(tmpl.data())) < 0)
+            throw std::runtime_error("Cannot create hot forward index");
+        // Freed once unmapped
+        ::unlink(tmpl.c_str());
+        if (::ftruncate(fd, static_cast<off_t>(len)) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot create hot forward index");
+        }
+    }
+    void* p = fd < 0 ?
+        ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) :
+        ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd >= 0)
+        ::close(fd);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("Cannot map hot forward index");
+    std::byte* hot = static_cast<std::byte*>(p);
+
+    try {
+        std::lock_guard __lck(_load_muts[0]);
+        for (uint32_t i = 0; i < nchunk; ++i) {
+            const auto& raw_at = raw_ats[i];
+            const auto& cmprs_at = cmprs_ats[i];
+            for (size_t f = 0; f + 1 < raw_at.size(); ++f) {
+                size_t read_sz = static_cast<size_t>(cmprs_at[f + 1] - cmprs_at[f]);
+                size_t raw_sz = static_cast<size_t>(raw_at[f + 1] - raw_at[f]);
+                size_t res;
+                __with_data(cmprs_at[f], read_sz, [&] (const std::byte* src) {
+                    res = ZSTD_decompressDCtx(_dctxs[0],
+                        hot + hot_at[i] + raw_at[f], raw_sz, src, read_sz);
+                });
+                if (ZSTD_isError(res) || res != raw_sz)
+                    throw std::runtime_error("Encountered bad data within database");
+            }
+        }
+        if (::mprotect(p, len, PROT_READ) != 0)
+            throw std::runtime_error("Cannot map hot forward index");
+    } catch (...) {
+        ::munmap(p, len);
+        throw;
+    }
+
+    drop_hot();
+    __drop_cache();
+    _hot = hot;
+    _hot_len = len;
+    _hot_at = std::move(hot_at);
+    _hot_chunks = nchunk;
+#endif
+}
+
+void file_mem_chunk::drop_hot() noexcept {
+    __stop_prefetch();
+#ifndef _WIN32
+    if (_hot != nullptr)
+        ::munmap(_hot, _hot_len);
+#endif
+    _hot = nullptr;
+    _hot_len = 0;
+    _hot_at.clear();
+    _hot_chunks = 0;
+}
+
+void file_mem_chunk::set_cache_budget(size_t bytes) {
+    std::lock_guard __lck(_cache_mut);
+    _cache_budget = bytes;
+    while (_cached_bytes > _cache_budget && __evict_one())
+        ;
+}
+
+size_t file_mem_chunk::cached_bytes() const {
+    std::lock_guard __lck(_cache_mut);
+    return _cached_bytes;
+}
+
+// An added chunk and its compressed data
+struct file_mem_chunk::pending_t {
+    enum state_t { queued, compressing, compressed };
+    uint32_t id;
+    std::vector<std::byte> raw;
+    std::vector<uint64_t> frame_starts;
+    std::vector<std::byte> cmprs;
+    size_t cmprs_sz = 0;
+    state_t state = queued;
+};
+
 void file_mem_chunk::add_last_chunk() {
     if (_unplaced_dat.empty())
         return;
-    if (_chunk_num == 4095)
+    if (read_only())
+        throw std::runtime_error("Cannot add to a database of an older version");
+    uint32_t id = _chunk_num.load(std::memory_order_relaxed);
+    if (id == max_chunks)
         throw std::out_of_range("Max chunk count reached");
+    if (_slot_pages[id / slot_page] == nullptr)
+        _slot_pages[id / slot_page].reset(new std::atomic<entry_t*>[slot_page]());
 
-    std::lock_guard __lck(_buf_mut);
-    // Remove previous cache info
-    uint8_t in_which_cache = (_next_overwrite++ % _cache_num);
-    _chunkid_to_cacheid[_cacheid_to_chunkid[in_which_cache]] = ~uint8_t();
-    _cacheid_to_chunkid[in_which_cache] = _chunk_num;
-    _chunkid_to_cacheid[_chunk_num] = in_which_cache;
-
-    // Synchonize to file by writing data
-    // Move RAW data to cache
-    auto& c = _cached_dat[in_which_cache]; // aliase to cache dest
-    c = std::move(_unplaced_dat);
-    _unplaced_dat.clear();
+    // Copy RAW data to cache, which may be evicted before the chunk is
+    // compressed. Move it to the compressing job.
+    // Seek points at the end start no frame
+    while (_frame_starts.back() >= _unplaced_dat.size())
+        _frame_starts.pop_back();
+    size_t nframe = _frame_starts.size();
+    entry_t* e = __make_room(id, _unplaced_dat.size());
+    e->size = e->decoded_bytes = _unplaced_dat.size();
+    e->dat.reset(new std::byte[e->size]);
+    std::copy(_unplaced_dat.cbegin(), _unplaced_dat.cend(), e->dat.get());
+    e->raw_at = _frame_starts;
+    e->raw_at.push_back(e->size);
+    e->decoded.reset(new std::atomic<bool>[nframe]());
+    for (size_t f = 0; f < nframe; ++f)
+        e->decoded[f].store(true, std::memory_order_relaxed);
+    __publish(e, id, 0);
+    _chunk_num.store(id + 1, std::memory_order_release);
+    _table_stale = true;
 
-    // Make `unplaced_dat` temporarily store compressed dat
-    _unplaced_dat.assign(ZSTD_compressBound(c.size()), std::byte());
-    size_t cmprs_sz = ZSTD_compressCCtx(_cctx,
-        _unplaced_dat.data(), _unplaced_dat.size(),
-        c.data(), c.size(), 1);
-    _chunk_size_presum[_chunk_num + 1] = 
-        _chunk_size_presum[_chunk_num] + cmprs_sz;
-    if (ZSTD_isError(cmprs_sz))
-        throw std::runtime_error(ZSTD_getErrorName(cmprs_sz));
-
-    // Write metadata first. TODO: Magic Number
-    FILE *fp = fopen(_saving_path.c_str(), NATIVE_PATH("rb+"));
-    if (fp == nullptr)
-        throw std::runtime_error("Cannot write database");
-    fseek(fp, (_chunk_num + 1) * sizeof(size_t), SEEK_SET);
-    fwrite(_chunk_size_presum + _chunk_num + 1, sizeof(size_t), 1, fp);
-    fseek(fp, 0, SEEK_END);
-    fwrite(_unplaced_dat.data(), 1, cmprs_sz, fp);
-    fclose(fp);
-    ++_chunk_num;
+    auto job = std::make_unique<pending_t>();
+    job->id = id;
+    job->raw = std::move(_unplaced_dat);
+    job->frame_starts = std::move(_frame_starts);
+    _frame_starts.assign(1, 0);
     _unplaced_dat.clear();
+    _unplaced_dat.reserve(job->raw.size());
+
+    std::unique_lock __lck(_pipe_mut);
+    if (!_writer.joinable()) {
+        _pipe_stop = false;
+        for (unsigned i = 0; i < compress_threads; ++i)
+            _compressors.emplace_back(&file_mem_chunk::__compress_loop, this);
+        _writer = std::thread(&file_mem_chunk::__write_loop, this);
+    }
+    _pipe_cv.wait(__lck, [this] { 
+        return _pending.size() < max_pending_chunks; });
+    _pending.push_back(std::move(job));
+    _pipe_cv.notify_all();
 }
 
-file_mem_chunk::file_mem_chunk(sv_t fpath, uint8_t cache_cnt,
-                               bool empty, bool rm)
-    : _chunkid_to_cacheid(new uint8_t[4096 * (1 + sizeof(size_t))])
-    , _chunk_size_presum(reinterpret_cast<size_t*>(_chunkid_to_cacheid + 4096))
-    , _cctx(ZSTD_createCCtx()), _dctx(ZSTD_createDCtx())
-    , _saving_path(fpath), _chunk_num(0) , _next_overwrite(0)
-    , _cache_num(cache_cnt), _rmfile_on_dtor(rm)
+// Compress each frame of `raw` starting at `starts` independently, after
+// the frame table, to `cmprs`. Return the chunk size, or a zstd error code.
+static size_t __compress_frames(ZSTD_CCtx* cctx, const std::vector<std::byte>& raw,
+                                std::vector<uint64_t> starts,
+                                std::vector<std::byte>& cmprs)
 {
-    // *reinterpret_cast<uint64_t*>(_cacheid_to_chunkid) = ~uint64_t();
-    for (size_t i = 0; i < 8; ++i)
-        _cacheid_to_chunkid[i] = 4095;
-    memset(_chunkid_to_cacheid, -1, 4096 * (1 + sizeof(size_t)));
-    _chunk_size_presum[0] = 0;
+    size_t nframe = starts.size();
+    starts.push_back(raw.size());
+    size_t table_sz = __frame_table_size(nframe);
+    size_t bound = table_sz;
+    for (size_t f = 0; f < nframe; ++f)
+        bound += ZSTD_compressBound(starts[f + 1] - starts[f]);
+    cmprs.resize(bound);
+
+    std::vector<uint64_t> table{ nframe };
+    table.insert(table.end(), starts.begin(), starts.end());
+    table.push_back(table_sz);
+    for (size_t f = 0; f < nframe; ++f) {
+        size_t at = table.back();
+        size_t sz = ZSTD_compressCCtx(cctx,
+            cmprs.data() + at, cmprs.size() - at,
+            raw.data() + starts[f], starts[f + 1] - starts[f], 1);
+        if (ZSTD_isError(sz))
+            return sz;
+        table.push_back(at + sz);
+    }
+    memcpy(cmprs.data(), table.data(), table_sz);
+    return table.back();
+}
+
+void file_mem_chunk::__compress_loop() {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    std::unique_lock __lck(_pipe_mut);
+    for (;;) {
+        pending_t* job = nullptr;
+        _pipe_cv.wait(__lck, [this, &job] {
+            for (auto& p : _pending) {
+                if (p->state == pending_t::queued) {
+                    job = p.get();
+                    return true;
+                }
+            }
+            return _pipe_stop;
+        });
+        if (job == nullptr)
+            break; // Stopped and nothing left
+
+        // Jobs are only popped by the writer after compressed
+        job->state = pending_t::compressing;
+        __lck.unlock();
+        size_t cmprs_sz = __compress_frames(cctx, job->raw,
+                                            job->frame_starts, job->cmprs);
+        std::vector<std::byte>().swap(job->raw);
+        __lck.lock();
 
+        if (ZSTD_isError(cmprs_sz) && _pipe_error.empty())
+            _pipe_error = ZSTD_getErrorName(cmprs_sz);
+        job->cmprs_sz = ZSTD_isError(cmprs_sz) ? 0 : cmprs_sz;
+        job->state = pending_t::compressed;
+        _pipe_cv.notify_all();
+    }
+    ZSTD_freeCCtx(cctx);
+}
+
+void file_mem_chunk::__write_loop() {
+    FILE* fp = nullptr;
+    std::unique_lock __lck(_pipe_mut);
+    for (;;) {
+        _pipe_cv.wait(__lck, [this] {
+            return (!_pending.empty() &&
+                    _pending.front()->state == pending_t::compressed) ||
+                   (_pipe_stop && _pending.empty());
+        });
+        if (_pending.empty())
+            break;
+        std::unique_ptr<pending_t> job = std::move(_pending.front());
+        _pending.pop_front();
+        _pipe_cv.notify_all(); // Room for `add_last_chunk`
+        // Only this thread appends presums
+        uint32_t id = job->id;
+        uint64_t at = _chunk_size_presum.back();
+        _chunk_size_presum.push_back(at + job->cmprs_sz);
+        __lck.unlock();
+
+        if (fp == nullptr)
+            fp = fopen(_saving_path.c_str(), NATIVE_PATH("rb+"));
+        // The table is written after the last chunk by `flush`
+        bool ok = fp != nullptr && __seek(fp, _data_offset + at) &&
+            fwrite(job->cmprs.data(), 1, job->cmprs_sz, fp) == job->cmprs_sz &&
+            fflush(fp) == 0; // Visible to readers opening the file
+        job.reset();
+
+        __lck.lock();
+        if (!ok && _pipe_error.empty())
+            _pipe_error = "Cannot write database";
+        _chunk_written = id + 1;
+        _pipe_cv.notify_all();
+    }
+    if (fp != nullptr)
+        fclose(fp);
+}
+
+std::pair<uint64_t, uint64_t>
+file_mem_chunk::__wait_written(uint32_t chunk_idx) const {
+    std::unique_lock __lck(_pipe_mut);
+    // Every added chunk is eventually written by the writer
+    _pipe_cv.wait(__lck, [this, chunk_idx] {
+        return _chunk_written > chunk_idx; });
+    return { _chunk_size_presum[chunk_idx], _chunk_size_presum[chunk_idx + 1] };
+}
+
+bool file_mem_chunk::__write_table(FILE* fp) {
+    std::lock_guard __lck(_pipe_mut);
+    __header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.header_size = sizeof(h);
+    h.chunk_count = _chunk_size_presum.size() - 1;
+    h.table_offset = _data_offset + _chunk_size_presum.back();
+    h.chunk_size_hint = _params.chunk_size_hint;
+    h.nfile_in_batch = _params.nfile_in_batch;
+    h.trigram_bits = _params.trigram_bits;
+    h.ancestor_keys = _params.ancestor_keys;
+    h.short_keys = _params.short_keys;
+    h.anchor_keys = _params.anchor_keys;
+    // Header last, so that it never points to an incomplete table
+    return __seek(fp, h.table_offset) &&
+        fwrite(_chunk_size_presum.data(), sizeof(uint64_t),
+               _chunk_size_presum.size(), fp) == _chunk_size_presum.size() &&
+        __seek(fp, 0) && fwrite(&h, sizeof(h), 1, fp) == 1 && fflush(fp) == 0;
+}
+
+void file_mem_chunk::__read_table(FILE* fp) {
+    union {
+        __header_t hdr;
+        uint64_t v1_magic;
+    } h;
+    if (fread(&h, sizeof(h), 1, fp) != 1)
+        throw std::runtime_error("Not a valid database");
+
+    if (h.v1_magic == v1_magic_num) {
+        _version = 1;
+        _data_offset = __v1_table_len * sizeof(uint64_t);
+        _chunk_size_presum.resize(__v1_table_len);
+        if (!__seek(fp, 0) || fread(_chunk_size_presum.data(), sizeof(uint64_t),
+                                    __v1_table_len, fp) != __v1_table_len)
+            throw std::runtime_error("Not a valid database");
+        // Unused entries are ~0
+        auto end = std::find(_chunk_size_presum.begin() + 1,
+                             _chunk_size_presum.end(), ~uint64_t());
+        _chunk_size_presum.erase(end, _chunk_size_presum.end());
+        _params = build_params_t();
+        return;
+    }
+
+    if (memcmp(h.hdr.magic, magic, sizeof(magic)) != 0)
+        throw std::runtime_error("Not a valid database");
+    if (h.hdr.version > version)
+        throw std::runtime_error("Database is of a newer version; rebuild it");
+    uint64_t fsize = 0;
+    if (__seek(fp, 0, SEEK_END))
+        fsize = __tell(fp);
+    // The table must be within the file
+    if (h.hdr.header_size < sizeof(h.hdr) || h.hdr.table_offset < h.hdr.header_size ||
+        h.hdr.chunk_count >= ~uint32_t() || h.hdr.table_offset > fsize ||
+        (fsize - h.hdr.table_offset) / sizeof(uint64_t) < h.hdr.chunk_count + 1)
+        throw std::runtime_error("Not a valid database");
+    _version = h.hdr.version;
+    _data_offset = h.hdr.header_size;
+    _params.chunk_size_hint = h.hdr.chunk_size_hint;
+    _params.nfile_in_batch = h.hdr.nfile_in_batch;
+    _params.trigram_bits = h.hdr.trigram_bits;
+    _params.ancestor_keys = h.hdr.ancestor_keys;
+    _params.short_keys = h.hdr.short_keys;
+    _params.anchor_keys = h.hdr.anchor_keys;
+    _chunk_size_presum.resize(h.hdr.chunk_count + 1);
+    if (!__seek(fp, h.hdr.table_offset) ||
+        fread(_chunk_size_presum.data(), sizeof(uint64_t),
+              _chunk_size_presum.size(), fp) != _chunk_size_presum.size() ||
+        _chunk_size_presum[0] != 0 ||
+        _data_offset + _chunk_size_presum.back() > h.hdr.table_offset ||
+        !std::is_sorted(_chunk_size_presum.begin(), _chunk_size_presum.end()))
+        throw std::runtime_error("Not a valid database");
+}
+
+void file_mem_chunk::flush() {
+    std::unique_lock __lck(_pipe_mut);
+    if (_writer.joinable()) {
+        _pipe_stop = true;
+        _pipe_cv.notify_all();
+        __lck.unlock();
+        for (std::thread& t : _compressors)
+            t.join();
+        _writer.join();
+        __lck.lock();
+        _compressors.clear();
+        _pipe_stop = false;
+    }
+    if (!_pipe_error.empty()) {
+        std::string err = std::move(_pipe_error);
+        _pipe_error.clear();
+        throw std::runtime_error(err);
+    }
+    __lck.unlock();
+
+    if (_table_stale && !read_only()) {
+        FILE* fp = fopen(_saving_path.c_str(), NATIVE_PATH("rb+"));
+        bool ok = fp != nullptr && __write_table(fp);
+        if (fp != nullptr)
+            fclose(fp);
+        if (!ok)
+            throw std::runtime_error("Cannot write database");
+        _table_stale = false;
+    }
+}
+
+file_mem_chunk::file_mem_chunk(sv_t fpath, size_t cache_budget,
+                               bool empty, bool rm)
+    : _chunk_size_presum{ 0 }, _clock_hand(0), _cached_bytes(0)
+    , _probation_bytes(0), _cache_budget(cache_budget)
+    , _readahead(default_readahead), _prefetch_stop(false), _frame_starts{ 0 }
+    , _map(nullptr), _map_len(0), _map_valid(0), _hot(nullptr), _hot_len(0)
+    , _hot_chunks(0), _saving_path(fpath)
+    , _data_offset(sizeof(__header_t)), _version(version), _table_stale(false)
+    , _chunk_num(0), _chunk_written(0), _pipe_stop(false), _rmfile_on_dtor(rm)
+{
     // Open the file
     FILE* fp = nullptr;
     if (!empty) 
@@ -132,24 +909,32 @@ file_mem_chunk::file_mem_chunk(sv_t fpath, uint8_t cache_cnt,
     if (fp == nullptr)
         throw std::runtime_error("Cannot open database");
 
-    // No exception in this if statement
-    if (empty) {
-        // TODO: magic num
-        fwrite(_chunk_size_presum, sizeof(size_t), 4096, fp);
-    } else {
-        if (fread(_chunk_size_presum, sizeof(size_t), 4096, fp) != 4096
-            || _chunk_size_presum[0] != magic_num)
-            throw std::runtime_error("Not a valid database");
-        size_t nc = 0;
-        while (nc < 4096 && _chunk_size_presum[nc] != ~uint64_t())
-            ++nc;
-        _chunk_num = static_cast<uint32_t>(--nc);
+    try {
+        if (empty) {
+            if (!__write_table(fp))
+                throw std::runtime_error("Cannot write database");
+        } else __read_table(fp);
+    } catch (...) {
+        fclose(fp);
+        throw;
     }
     fclose(fp);
+    // Existing data is mapped now, so that it stays readable if the path
+    // is replaced, as a database of an older version is by a manifest
+    if (!empty)
+        __remap(0);
+    uint32_t nchunk = static_cast<uint32_t>(_chunk_size_presum.size() - 1);
+    for (size_t i = 0; i * slot_page < nchunk; ++i)
+        _slot_pages[i].reset(new std::atomic<entry_t*>[slot_page]());
+    _chunk_num = nchunk;
+    _chunk_written = nchunk;
+    for (ZSTD_DCtx*& dctx : _dctxs)
+        dctx = ZSTD_createDCtx();
 }
 
 void file_mem_chunk::move_file(const char_t* fpath) {
-    std::lock_guard __lck(_buf_mut);
+    flush();
+    std::lock_guard __lck(_file_mut);
 #ifdef _WIN32
     if (::MoveFileW(_saving_path.c_str(), fpath) == FALSE)
 #else // C89 rename(2)
@@ -162,63 +947,54 @@ void file_mem_chunk::move_file(const char_t* fpath) {
 size_t file_mem_chunk::chunk_size(uint32_t at) const {
     if (at >= _chunk_num)
         throw std::out_of_range("Chunk Index Out of Range");
-    return _chunk_size_presum[at + 1] - _chunk_size_presum[at];
+    auto [beg, end] = __wait_written(at);
+    return static_cast<size_t>(end - beg);
 }
 
 void file_mem_chunk::clear() {
-    std::lock_guard __lck(_buf_mut);
+    __stop_prefetch();
+    try {
+        flush();
+    } catch (const std::runtime_error&) {} // Cleared anyway
+    std::lock_guard __lck(_file_mut);
     FILE* fp = fopen(_saving_path.c_str(), NATIVE_PATH("wb"));
     if (fp == nullptr)
         throw std::runtime_error("Cannot clear database");
 
+    __drop_cache();
+    drop_hot();
+    __unmap(); // The file is truncated
     _chunk_num = 0;
-    // *reinterpret_cast<uint64_t*>(_cacheid_to_chunkid) = ~uint64_t();
-    for (size_t i = 0; i < 8; ++i)
-        _cacheid_to_chunkid[i] = 4095;
-    memset(_chunkid_to_cacheid, -1, 4096 * (1 + sizeof(size_t)));
-    _chunk_size_presum[0] = 0;
-    // TODO: magic num
-    fwrite(_chunk_size_presum, sizeof(size_t), 4096, fp);
+    _chunk_written = 0;
+    _chunk_size_presum.assign(1, 0);
+    _data_offset = sizeof(__header_t);
+    _version = version;
+    bool ok = __write_table(fp);
     fclose(fp);
-
+    _table_stale = !ok;
     _unplaced_dat.clear();
-    for (uint8_t i = 0; i < _cache_num; ++i)
-        _cached_dat[i].clear();
+    _frame_starts.assign(1, 0);
 }
 
 file_mem_chunk::~file_mem_chunk() {
-    std::lock_guard __lck(_buf_mut);
+    __stop_prefetch();
+    try {
+        if (!_rmfile_on_dtor)
+            add_last_chunk();
+        flush();
+    } catch (const std::exception&) {} // Nothing to do in destructor
+    drop_hot();
+    __unmap();
+
     if (_rmfile_on_dtor)
 #ifdef _WIN32
         ::DeleteFileW(_saving_path.c_str());
 #else // unlink(2)
         ::unlink(_saving_path.c_str());
 #endif
-    else 
-        add_last_chunk();
-    delete[] _chunkid_to_cacheid;
-    ZSTD_freeCCtx(_cctx);
-    ZSTD_freeDCtx(_dctx);
+    for (ZSTD_DCtx* dctx : _dctxs)
+        ZSTD_freeDCtx(dctx);
 }
 
-#ifdef _MSC_VER
-// Lock/unlock mismatch; intended here
-#pragma warning(disable: 26110 26115 26117)
-#endif
-
-// Reader Begin Reading
-void file_mem_chunk::__writer_lock() noexcept {
-    _buf_mut.lock_shared();
 }
-
-// Reader Finish Reading
-void file_mem_chunk::finish_visit() noexcept {
-    _buf_mut.unlock_shared();
-}
-
-#ifdef _MSC_VER
-#pragma warning(default: 26110 26115 26117)
-#endif
-
 }
-}
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include <orient/util/uring.hpp>
+
+#ifdef ORIE_HAVE_IO_URING
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+extern "C" {
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+}
+
+namespace orie {
+
+struct uring::ring_t {
+    int fd = -1;
+    unsigned sq_entries = 0;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ptr = MAP_FAILED;
+    void* cq_ptr = MAP_FAILED;
+    size_t sq_len = 0, cq_len = 0, sqes_len = 0;
+
+    ~ring_t() {
+        if (sqes_len)
+            ::munmap(sqes, sqes_len);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+            ::munmap(cq_ptr, cq_len);
+        if (sq_ptr != MAP_FAILED)
+            ::munmap(sq_ptr, sq_len);
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+
+// Whether the running kernel supports all opcodes we use
+static bool __opcodes_supported(int ring_fd) {
+    constexpr unsigned nops = 256;
+    std::vector<std::byte> buf(sizeof(struct io_uring_probe) +
+                               nops * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe* probe =
+        reinterpret_cast<struct io_uring_probe*>(buf.data());
+    if (::syscall(__NR_io_uring_register, ring_fd,
+                  IORING_REGISTER_PROBE, probe, nops) < 0)
+        return false; // Probing is available since 5.6 as well as our opcodes
+    for (unsigned op : { IORING_OP_OPENAT, IORING_OP_STATX }) {
+        if (op > probe->last_op ||
+            !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    }
+    return true;
+}
+
+uring::uring(unsigned depth) {
+    struct io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    auto r = std::make_unique<ring_t>();
+    r->fd = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &p));
+    // Not supported by the kernel, or forbidden by seccomp
+    if (r->fd < 0 || !__opcodes_supported(r->fd))
+        return;
+
+    r->sq_entries = p.sq_entries;
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        r->sq_len = r->cq_len = std::max(r->sq_len, r->cq_len);
+    r->sq_ptr = ::mmap(nullptr, r->sq_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        return;
+    r->cq_ptr = single_mmap ? r->sq_ptr :
+        ::mmap(nullptr, r->cq_len, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED)
+        return;
+    size_t sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return;
+    r->sqes_len = sqes_len;
+    r->sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(r->sq_ptr);
+    char* cq = static_cast<char*>(r->cq_ptr);
+    r->sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    r->sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    r->sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    r->cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    r->cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    r->cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    r->cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    _depth = p.sq_entries;
+    _ring = std::move(r);
+}
+
+uring::~uring() = default;
+
+template <class prep_t>
+bool uring::run_all(size_t n, prep_t prep, std::vector<int>& res) {
+    // Requests never run are reported canceled
+    res.assign(n, -ECANCELED);
+    ring_t& r = *_ring;
+    size_t next = 0, done = 0;
+    // Requests queued but not consumed by the kernel yet, and in flight
+    unsigned unsubmitted = 0, inflight = 0;
+    // Record results of completed requests
+    auto reap = [&r, &res, &inflight, &done] {
+        unsigned head = *r.cq_head;
+        while (head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe& cqe = r.cqes[head & *r.cq_mask];
+            res[cqe.user_data] = cqe.res;
+            ++head;
+            --inflight;
+            ++done;
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    };
+
+    while (done < n) {
+        // Fill the submission queue; we are its only producer
+        unsigned tail = *r.sq_tail;
+        for (; next < n && inflight < r.sq_entries; ++next) {
+            unsigned idx = tail & *r.sq_mask;
+            struct io_uring_sqe* sqe = r.sqes + idx;
+            std::memset(sqe, 0, sizeof(*sqe));
+            prep(*sqe, next);
+            sqe->user_data = next;
+            r.sq_array[idx] = idx;
+            ++tail;
+            ++inflight;
+            ++unsubmitted;
+        }
+        __atomic_store_n(r.sq_tail, tail, __ATOMIC_RELEASE);
+
+        // Submit and wait for at least one completion
+        long submitted = ::syscall(__NR_io_uring_enter, r.fd, unsubmitted, 1,
+                                   IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (submitted >= 0)
+            unsubmitted -= static_cast<unsigned>(submitted);
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // The ring is unusable now, but submitted requests may still
+            // write to their buffers; wait for them before tearing it down.
+            // Unsubmitted ones are never consumed without submitting.
+            for (reap(); inflight > unsubmitted; reap()) {
+                if (::syscall(__NR_io_uring_enter, r.fd, 0, 1,
+                              IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                    errno != EINTR)
+                    ::usleep(1000); // Completions are posted anyway
+            }
+            _ring.reset();
+            return false;
+        }
+        reap();
+    }
+    return true;
+}
+
+bool uring::openat_all(int dirfd, const std::vector<const char*>& names,
+                       int flags, std::vector<int>& res)
+{
+    if (!ok())
+        return false;
+    bool ran = run_all(names.size(),
+        [dirfd, flags, &names] (struct io_uring_sqe& sqe, size_t i) {
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = dirfd;
+            sqe.addr = reinterpret_cast<uintptr_t>(names[i]);
+            sqe.open_flags = flags;
+        }, res);
+    // Callers fall back to synchronous calls, so nothing is left open
+    if (!ran) {
+        for (int& fd : res) {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -ECANCELED;
+        }
+    }
+    return ran;
+}
+
+bool uring::statx_all(int dirfd, const std::vector<const char*>& names,
+                      int flags, unsigned mask, std::vector<struct statx>& bufs,
+                      std::vector<int>& res)
+{
+    if (!ok())
+        return false;
+    bufs.resize(names.size());
+    return run_all(names.size(),
+        [dirfd, flags, mask, &names, &bufs] (struct io_uring_sqe& sqe, size_t i) {
+            sqe.opcode = IORING_OP_STATX;
+            sqe.fd = dirfd;
+            sqe.addr = reinterpret_cast<uintptr_t>(names[i]);
+            sqe.len = mask;
+            sqe.off = reinterpret_cast<uintptr_t>(&bufs[i]);
+            sqe.statx_flags = flags;
+        }, res);
+}
+
+}
+
+#else // No io_uring
+
+namespace orie {
+
+struct uring::ring_t {};
+uring::uring(unsigned) {}
+uring::~uring() = default;
+
+bool uring::openat_all(int, const std::vector<const char*>&,
+                       int, std::vector<int>&) { return false; }
+#ifdef __linux__
+bool uring::statx_all(int, const std::vector<const char*>&, int, unsigned,
+                      std::vector<struct statx>&, std::vector<int>&) {
+    return false;
+}
+#endif
+
+}
+
+#endif // ORIE_HAVE_IO_URING
@@ -17,6 +17,21 @@ using orie::fs_data_iter;
 #endif
 
 inline orie::fifo_thpool __dummy_pool(0);
+
+// Remove the database manifest at `db` along with files of all its
+// generations, and of databases named after it
+inline void removeDb(const path& db) {
+    std::vector<path> todel;
+    std::error_code ec;
+    for (directory_iterator it(db.parent_path(), ec), end;
+         !ec && it != end; it.increment(ec)) {
+        if (it->path().filename().native().rfind(db.filename().native(), 0) == 0)
+            todel.push_back(it->path());
+    }
+    for (const path& p : todel)
+        remove(p, ec);
+}
+
 struct ABunchOfDirs {
     path tmpPath, dbPath;
     std::unique_ptr<dumper> dmp = nullptr;
@@ -60,8 +75,7 @@ struct ABunchOfDirs {
         dmp.reset();
         if (!persistent)
             remove_all(tmpPath);
-        remove(dbPath);
-        remove(dbPath += "_inv");
+        removeDb(dbPath);
     }
 
     ABunchOfDirs(ABunchOfDirs&& rhs) = delete;
@@ -0,0 +1,112 @@
+// Micro-benchmark of intersection kernels over posting lists of a real
+// inverted index, i.e. an `_inv` file of a database:
+//     orie_bench_intersect <path to _inv> [trigram bits = 13]
+// Pairs of trigram lines in a page are grouped by their size ratio, and
+// each kernel intersects every pair of a group repeatedly.
+#include <orient/util/arr2d.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+using namespace compressionLib;
+
+using kernel_t = size_t (*)(const uint32_t*, const size_t,
+                            const uint32_t*, const size_t, uint32_t*);
+struct pair_t {
+    const std::vector<uint32_t>* small;
+    const std::vector<uint32_t>* large;
+};
+
+// Nanoseconds per pair of `k` intersecting all `pairs`
+static double __time(kernel_t k, const std::vector<pair_t>& pairs,
+                     std::vector<uint32_t>& out, size_t& checksum) {
+    using clock = std::chrono::steady_clock;
+    size_t nrun = 0;
+    auto start = clock::now();
+    do {
+        for (const pair_t& p : pairs)
+            checksum += k(p.small->data(), p.small->size(),
+                          p.large->data(), p.large->size(), out.data());
+        ++nrun;
+    } while (clock::now() - start < std::chrono::milliseconds(200));
+    std::chrono::duration<double, std::nano> spent = clock::now() - start;
+    return spent.count() / double(nrun * pairs.size());
+}
+
+int main(int argc, const char* const* argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <_inv file> [trigram bits]\n", argv[0]);
+        return 1;
+    }
+    unsigned bits = argc > 2 ? unsigned(std::stoul(argv[2])) : 13;
+    arr2d_reader reader{ orie::str_t(argv[1], argv[1] + strlen(argv[1])) };
+    fastPForCodec codec;
+
+    // Lines 0 and 1 hold positions of batches, not trigrams
+    std::vector<std::vector<std::vector<uint32_t>>> pages;
+    for (size_t page = 0; page < reader.page_count(); ++page) {
+        pages.emplace_back();
+        std::vector<uint32_t> line;
+        for (size_t l = 2; l < (size_t(1) << bits); ++l) {
+            if (reader.uncmprs_size(l, page) == 0)
+                continue;
+            reader.line_data(codec, line, l, page);
+            pages.back().push_back(line);
+        }
+    }
+
+    // Group random pairs in a page by size ratio
+    const size_t ratios[] = { 1, 4, 32, 256, ~size_t() };
+    std::vector<pair_t> groups[4];
+    std::mt19937 rd(42);
+    for (const auto& lines : pages) {
+        if (lines.size() < 2)
+            continue;
+        for (size_t n = 0; n < 20000; ++n) {
+            const auto* a = &lines[rd() % lines.size()];
+            const auto* b = &lines[rd() % lines.size()];
+            if (a == b)
+                continue;
+            if (a->size() > b->size())
+                std::swap(a, b);
+            size_t ratio = b->size() / a->size();
+            for (size_t g = 0; g < 4; ++g)
+                if (ratio >= ratios[g] && ratio < ratios[g + 1] &&
+                    groups[g].size() < 2000)
+                    groups[g].push_back({ a, b });
+        }
+    }
+
+    std::vector<std::pair<const char*, kernel_t>> kernels{
+        { "sse", i32_intersect }, { "galloping", i32_intersect_galloping } };
+    if (cpu_has_avx2())
+        kernels.emplace_back("avx2", i32_intersect_avx2);
+    if (cpu_has_avx512())
+        kernels.emplace_back("avx512", i32_intersect_avx512);
+    kernels.emplace_back("adaptive", i32_intersect_adaptive);
+
+    size_t max_line = 0, checksum = 0;
+    for (const auto& lines : pages)
+        for (const auto& l : lines)
+            max_line = std::max(max_line, l.size());
+    std::vector<uint32_t> out(max_line + i32_intersect_slack);
+
+    printf("%zu pages. Nanoseconds per intersection:\n%-12s%8s",
+           pages.size(), "size ratio", "pairs");
+    for (const auto& k : kernels)
+        printf("%12s", k.first);
+    for (size_t g = 0; g < 4; ++g) {
+        std::string range = std::to_string(ratios[g]) + '-' +
+            (g == 3 ? std::string() : std::to_string(ratios[g + 1]));
+        printf("\n%-12s%8zu", range.c_str(), groups[g].size());
+        if (groups[g].empty())
+            continue;
+        for (const auto& k : kernels)
+            printf("%12.0f", __time(k.second, groups[g], out, checksum));
+    }
+    printf("\n(checksum %zu)\n", checksum);
+    return 0;
+}
@@ -47,8 +47,7 @@ protected:
             return;
         auto todel = _app.db_path();
         _app = orie::app(_pool);
-        std::filesystem::remove(todel);
-        std::filesystem::remove(todel + NATIVE_PATH("_inv"));
+        removeDb(todel);
         std::filesystem::remove(temp_directory_path() / "testConf.txt");
     }
 };
@@ -140,10 +139,87 @@ TEST_F(orieApp, readDb) {
     ASSERT_EQ(4, _do_tests(NATIVE_SV("-name dir9")));
 }
 
+#ifndef _WIN32
+TEST_F(orieApp, pathIndex) {
+    _app.update_db();
+    // Full path patterns narrowed by path keys, compared to a walk
+    for (std::string pat : { "*/dir11/*/dir9", "*/dir10/dir8/*",
+                             "*/dir1[01]/*file2", "*ir11/dir3*",
+                             "*/dir5/*ile*", "*/dir9/dir[0/]*",
+                             "*ir10*", "*/dir7/*/file3" }) {
+        size_t expected = 0;
+        for (const auto& ent : recursive_directory_iterator(tmpPath))
+            expected += ::fnmatch(pat.c_str(), ent.path().c_str(), 0) == 0;
+        EXPECT_LT(0, expected) << pat;
+        EXPECT_EQ(expected, _do_tests("-path " + pat)) << pat;
+    }
+    for (std::string needle : { "/dir11/dir10/", "dir10/dir8/file",
+                                "r3/dir2" }) {
+        size_t expected = 0;
+        for (const auto& ent : recursive_directory_iterator(tmpPath))
+            expected += ent.path().native().find(needle) != std::string::npos;
+        EXPECT_LT(0, expected) << needle;
+        EXPECT_EQ(expected, _do_tests("-strstr --full " + needle)) << needle;
+    }
+    EXPECT_EQ(_do_tests(NATIVE_SV("-path */dir11/*/dir9")),
+              _do_tests(NATIVE_SV("-ipath */DIR11/*/Dir9")));
+}
+
+TEST_F(orieApp, condIndex) {
+    _app.update_db();
+    // Candidates merged from the index, compared to a walk
+    size_t nfile1 = 0, ndir3 = 0, ndir3_file1 = 0;
+    for (const auto& ent : recursive_directory_iterator(tmpPath)) {
+        nfile1 += ent.path().filename() == "file1";
+        ndir3 += ent.path().filename() == "dir3";
+        ndir3_file1 += ent.path().filename() == "file1" &&
+            ent.path().native().find("dir3/") != std::string::npos;
+    }
+    EXPECT_EQ(nfile1 + ndir3,
+              _do_tests(NATIVE_SV("-name file1 -o -name dir3")));
+    EXPECT_EQ(nfile1 + ndir3, _do_tests(NATIVE_SV(
+        "-name file1 -o -strstr dir3 -o -name xyzzy")));
+    EXPECT_EQ(ndir3_file1,
+              _do_tests(NATIVE_SV("-name file1 -a -strstr --full dir3/")));
+    EXPECT_EQ(nfile1, _do_tests(NATIVE_SV("( -name file1 -o -name dir3 ) "
+                                          "-a -type f")));
+}
+
+TEST_F(orieApp, shortPatterns) {
+    _app.update_db();
+    // Bigrams of names, compared to a walk
+    size_t n11 = 0, n11_dir3 = 0;
+    for (const auto& ent : recursive_directory_iterator(tmpPath)) {
+        n11 += ent.path().filename().native().find("11") != std::string::npos;
+        n11_dir3 += ent.path().filename() == "dir3" ||
+                    ent.path().filename() == "11";
+    }
+    n11_dir3 += n11;
+    EXPECT_EQ(n11, _do_tests(NATIVE_SV("-strstr 11")));
+    EXPECT_EQ(n11, _do_tests(NATIVE_SV("-name *11")));
+    EXPECT_EQ(n11_dir3, _do_tests(NATIVE_SV("-strstr 11 -o -name dir3")));
+}
+
+TEST_F(orieApp, anchoredNames) {
+    _app.update_db();
+    // Where names start and end, compared to a walk
+    size_t ndir1x = 0, nfile1 = 0;
+    for (const auto& ent : recursive_directory_iterator(tmpPath)) {
+        ndir1x += ent.path().filename().native().rfind("dir1", 0) == 0;
+        nfile1 += ent.path().filename() == "file1";
+    }
+    EXPECT_EQ(ndir1x, _do_tests(NATIVE_SV("-name dir1*")));
+    EXPECT_EQ(nfile1, _do_tests(NATIVE_SV("-name *e1")));
+    EXPECT_EQ(nfile1, _do_tests(NATIVE_SV("-name file1")));
+    EXPECT_EQ(nfile1, _do_tests(NATIVE_SV("-iname FILE1")));
+}
+#endif
+
 TEST_F(orieApp, confFile) {
     // Generate configuration
     _app.add_ignored_path((tmpPath / "dir10").native())
         .add_ignored_path((tmpPath / "dir11" / "dir10").native())
+        .set_concur_limit((tmpPath / "dir1").native(), 2)
         .update_db()
         .write_conf((tmpPath / "testConf.txt").native());
     ASSERT_TRUE(_app) << "Write Configuration Failed.";
@@ -154,10 +230,112 @@ TEST_F(orieApp, confFile) {
     _app.read_conf((tmpPath / "testConf.txt").native())
         .add_start_path(orie::str_t());
     EXPECT_EQ(2, _do_tests(NATIVE_SV("-name dir9")));
+    ASSERT_EQ(1, _app.concur_limits().size());
+    EXPECT_EQ((tmpPath / "dir1").native(), _app.concur_limits()[0].first);
+    EXPECT_EQ(2, _app.concur_limits()[0].second);
     _app.update_db();
     EXPECT_EQ(2, _do_tests(NATIVE_SV("-name dir9")));
 }
 
+TEST_F(orieApp, shards) {
+    _app.update_db();
+    size_t n_dir9 = _do_tests(NATIVE_SV("-name dir9")),
+           n_dir10 = _do_tests(NATIVE_SV("-name dir10"));
+    ASSERT_EQ(4, n_dir9);
+
+    _app.add_shard((tmpPath / "dir10").native())
+        .add_shard((tmpPath / "dir11" / "dir10").native())
+        .add_shard((tmpPath / "dir10").native()) // Duplicate
+        .update_db()
+        .write_conf((tmpPath / "testConf.txt").native());
+    ASSERT_EQ(2, _app.shard_roots().size());
+    // Results from all shards, without repeating shard roots
+    EXPECT_EQ(n_dir9, _do_tests(NATIVE_SV("-name dir9")));
+    EXPECT_EQ(n_dir10, _do_tests(NATIVE_SV("-name dir10")));
+    // Starting in a shard
+    _app.add_start_path((tmpPath / "dir10").native());
+    EXPECT_EQ(n_dir9 + 1, _do_tests(NATIVE_SV("-name dir9")));
+    _app.erase_start_path((tmpPath / "dir10").native());
+
+    // Shards are saved in the conf file
+    _app = orie::app(_pool);
+    _app.read_conf((tmpPath / "testConf.txt").native())
+        .add_start_path(orie::str_t());
+    EXPECT_EQ(2, _app.shard_roots().size());
+    EXPECT_EQ(n_dir9, _do_tests(NATIVE_SV("-name dir9")));
+
+    // A failing shard does not block others
+    _app.add_shard((tmpPath / "nonexistent").native());
+    std::filesystem::create_directories(tmpPath / "dir1" / "shardDir9");
+    EXPECT_THROW(_app.update_db(), std::runtime_error);
+    EXPECT_EQ(1, _do_tests(NATIVE_SV("-name shardDir9")));
+    std::filesystem::remove(tmpPath / "dir1" / "shardDir9");
+
+    for (const orie::str_t& root : _app.shard_roots())
+        _app.erase_shard(root);
+    EXPECT_TRUE(_app.shard_roots().empty());
+}
+
+TEST_F(orieApp, hotIndex) {
+    _app.update_db();
+    size_t n_dir9 = _do_tests(NATIVE_SV("-name dir9"));
+    // In memory, and in files under a directory
+    _app.set_hot_index(orie::str_t());
+    EXPECT_EQ(n_dir9, _do_tests(NATIVE_SV("-name dir9")));
+    _app.set_hot_index(temp_directory_path().native())
+        .update_db()
+        .write_conf((tmpPath / "testConf.txt").native());
+    EXPECT_EQ(n_dir9, _do_tests(NATIVE_SV("-name dir9")));
+
+    _app = orie::app(_pool);
+    _app.read_conf((tmpPath / "testConf.txt").native())
+        .add_start_path(orie::str_t());
+    ASSERT_TRUE(_app.hot_index().has_value());
+    EXPECT_EQ(temp_directory_path().native(), *_app.hot_index());
+    EXPECT_EQ(n_dir9, _do_tests(NATIVE_SV("-name dir9")));
+    _app.set_hot_index(std::nullopt);
+    EXPECT_EQ(n_dir9, _do_tests(NATIVE_SV("-name dir9")));
+}
+
+TEST_F(orieApp, queryWindow) {
+    _app.update_db();
+    size_t n_file1 = _do_tests(NATIVE_SV("-name file1"));
+    size_t n_dir3 = _do_tests(NATIVE_SV("-strstr --full dir3/"));
+    // Pages evaluated ahead on the pool, by rebuilt databases as well
+    _app.set_query_window(4);
+    EXPECT_EQ(n_file1, _do_tests(NATIVE_SV("-name file1")));
+    _app.update_db();
+    EXPECT_EQ(4, _app.query_window());
+    EXPECT_EQ(n_file1, _do_tests(NATIVE_SV("-name file1")));
+    EXPECT_EQ(n_dir3, _do_tests(NATIVE_SV("-strstr --full dir3/")));
+    _app.set_query_window(0);
+    EXPECT_EQ(n_file1, _do_tests(NATIVE_SV("-name file1")));
+}
+
+TEST_F(orieApp, trigramBits) {
+    _app.update_db();
+    size_t n_dir9 = _do_tests(NATIVE_SV("-name dir9"));
+    size_t n_dir = _do_tests(NATIVE_SV("-iname '*DIR1*'"));
+    ASSERT_NE(0, n_dir);
+    EXPECT_THROW(_app.set_trigram_bits(25), std::out_of_range);
+    EXPECT_EQ(orie::dmp::default_trigram_bits, _app.trigram_bits());
+    _app.set_trigram_bits(orie::dmp::exact_trigram_bits)
+        .update_db()
+        .write_conf((tmpPath / "testConf.txt").native());
+    EXPECT_EQ(n_dir9, _do_tests(NATIVE_SV("-name dir9")));
+    EXPECT_EQ(n_dir, _do_tests(NATIVE_SV("-iname '*DIR1*'")));
+
+    // Recorded in both the conf file and the database
+    _app = orie::app(_pool);
+    _app.read_conf((tmpPath / "testConf.txt").native())
+        .add_start_path(orie::str_t());
+    EXPECT_EQ(orie::dmp::exact_trigram_bits, _app.trigram_bits());
+    EXPECT_EQ(n_dir9, _do_tests(NATIVE_SV("-name dir9")));
+    _app.set_trigram_bits(orie::dmp::default_trigram_bits).update_db();
+    EXPECT_EQ(n_dir9, _do_tests(NATIVE_SV("-name dir9")));
+    EXPECT_EQ(n_dir, _do_tests(NATIVE_SV("-iname '*DIR1*'")));
+}
+
 TEST_F(orieApp, autoUpdate) {
     _app.start_auto_update(std::chrono::milliseconds(80), true);
     std::ofstream(tmpPath / "testConf.txt") << "aaa";
@@ -171,6 +349,86 @@ TEST_F(orieApp, autoUpdate) {
         .stop_auto_update();
 }
 
+#ifdef __linux__
+TEST_F(orieApp, watchChanges) {
+    _app.update_db();
+    ASSERT_TRUE(_app.start_watching());
+    std::filesystem::create_directories(tmpPath / "dir1" / "watchDir");
+    std::ofstream(tmpPath / "dir1" / "watchDir" / "watchFile") << "aaa";
+    std::filesystem::rename(tmpPath / "dir9", tmpPath / "watchDir9");
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    // Found without updatedb
+    EXPECT_EQ(1, _do_tests(NATIVE_SV("-name watchFile")));
+    EXPECT_EQ(1, _do_tests(NATIVE_SV("-name watchDir -type d")));
+    EXPECT_EQ(1, _do_tests(NATIVE_SV("-name watchDir9")));
+    EXPECT_EQ(3, _do_tests(NATIVE_SV("-name dir9")));
+
+    std::filesystem::remove_all(tmpPath / "dir1" / "watchDir");
+    std::filesystem::rename(tmpPath / "watchDir9", tmpPath / "dir9");
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_EQ(0, _do_tests(NATIVE_SV("-name watchFile")));
+    // Changes are dropped once they are in the database
+    _app.update_db();
+    EXPECT_TRUE(_app.delta()->empty());
+    EXPECT_EQ(4, _do_tests(NATIVE_SV("-name dir9")));
+    _app.stop_watching();
+}
+
+TEST_F(orieApp, watchFailedShard) {
+    _app.update_db();
+    ASSERT_TRUE(_app.start_watching());
+    std::ofstream(tmpPath / "dir1" / "watchShardFile") << "aaa";
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_FALSE(_app.delta()->empty());
+    // Changes in the rebuilt database are dropped though a shard fails
+    _app.add_shard((tmpPath / "nonexistent").native());
+    EXPECT_THROW(_app.update_db(), std::runtime_error);
+    EXPECT_TRUE(_app.delta()->empty());
+    EXPECT_EQ(1, _do_tests(NATIVE_SV("-name watchShardFile")));
+    _app.erase_shard((tmpPath / "nonexistent").native())
+        .stop_watching();
+    std::filesystem::remove(tmpPath / "dir1" / "watchShardFile");
+}
+
+TEST_F(orieApp, watchOverflow) {
+    _app.update_db();
+    ASSERT_TRUE(_app.start_watching());
+    std::ofstream(tmpPath / "dir1" / "watchLostFile") << "aaa";
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_EQ(1, _do_tests(NATIVE_SV("-name watchLostFile")));
+    // Lost changes make the databases alone be used until next updatedb
+    _app.delta()->set_overflowed();
+    EXPECT_EQ(0, _do_tests(NATIVE_SV("-name watchLostFile")));
+    _app.update_db();
+    EXPECT_FALSE(_app.delta()->overflowed());
+    EXPECT_EQ(1, _do_tests(NATIVE_SV("-name watchLostFile")));
+    std::filesystem::remove(tmpPath / "dir1" / "watchLostFile");
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_EQ(0, _do_tests(NATIVE_SV("-name watchLostFile")));
+    _app.stop_watching();
+}
+
+TEST_F(orieApp, watchAutoUpdate) {
+    _app.set_watch(true)
+        .write_conf((tmpPath / "testConf.txt").native());
+    _app = orie::app(_pool);
+    _app.read_conf((tmpPath / "testConf.txt").native())
+        .add_start_path(orie::str_t());
+    ASSERT_TRUE(_app.watch());
+    // Only the immediate update runs, after which watching starts
+    _app.start_auto_update(std::chrono::hours(9999), true);
+    for (int i = 0; i < 100 && _app.delta() == nullptr; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_NE(nullptr, _app.delta());
+    std::ofstream(tmpPath / "dir1" / "watchAutoFile") << "aaa";
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_EQ(1, _do_tests(NATIVE_SV("-name watchAutoFile")));
+    _app.stop_auto_update();
+    EXPECT_EQ(nullptr, _app.delta());
+    std::filesystem::remove(tmpPath / "dir1" / "watchAutoFile");
+}
+#endif
+
 TEST_F(orieApp, osDefault) {
     // Erase existing config
     std::cout << "Regenerating filesystem database.\n May take longer than "
@@ -187,8 +445,7 @@ TEST_F(orieApp, osDefault) {
 #endif
 
     std::filesystem::remove(conf_dir / "default.txt");
-    std::filesystem::remove(conf_dir / "default.db");
-    std::filesystem::remove(conf_dir / "default.db_inv");
+    removeDb(conf_dir / "default.db");
     // Create config
     _app = orie::app::os_default(_pool);
     _app.update_db().add_start_path(orie::str_t());
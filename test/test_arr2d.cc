@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
 #include <filesystem>
 #include <random>
+#include <thread>
 #include <orient/util/arr2d.hpp>
+#include <orient/util/fifo_thpool.hpp>
 
 struct arr2d : public testing::Test {
     std::filesystem::path tmpPath;
@@ -74,6 +76,56 @@ TEST_F(arr2d, appendSimple) {
     EXPECT_ANY_THROW(writer._data_pending.at(4096));
 }
 
+TEST_F(arr2d, sparse) {
+    // A sparse page between the 2 dense pages of SetUp
+    writer.add_int(0, 5);
+    writer.add_int(16777215, 5);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        writer.add_int(3, i * 3);
+        writer.add_int(arr2d_writer::dense_rows + 7, i * 2);
+        writer.add_int(100000, i * 4);
+    }
+    writer.append_pending_to_file();
+    EXPECT_TRUE(writer._sparse_pending.empty());
+    SetUp();
+    // Rows are not allocated up to the largest one
+    EXPECT_LT(std::filesystem::file_size(tmpPath), 100000);
+
+    arr2d_reader reader(tmpPath.c_str());
+    for (size_t i = 0; i < 15; ++i)
+        ASSERT_EQ(reader.uncmprs_size(i, 0), i * 100 + 100);
+    EXPECT_EQ(1, reader.uncmprs_size(0, 2));
+    EXPECT_EQ(0, reader.uncmprs_size(1, 2));
+    EXPECT_EQ(1000, reader.uncmprs_size(3, 2));
+    EXPECT_EQ(0, reader.uncmprs_size(4, 2));
+    EXPECT_EQ(1000, reader.uncmprs_size(arr2d_writer::dense_rows + 7, 2));
+    EXPECT_EQ(1000, reader.uncmprs_size(100000, 2));
+    EXPECT_EQ(1, reader.uncmprs_size(16777215, 2));
+    EXPECT_EQ(0, reader.uncmprs_size(16777216, 2));
+    // Dense pages after it
+    EXPECT_EQ(400, reader.uncmprs_size(3, 3));
+    EXPECT_EQ(1000, reader.uncmprs_size(3, 4));
+    EXPECT_EQ(0, reader.uncmprs_size(100000, 4));
+    EXPECT_EQ(~uint32_t(), reader.uncmprs_size(100000, 5));
+    uint32_t lines[] = {arr2d_writer::dense_rows + 7, 100000, 16777216};
+    size_t totals[3];
+    reader.line_totals(lines, 3, totals);
+    EXPECT_EQ(1000, totals[0]);
+    EXPECT_EQ(1000, totals[1]);
+    EXPECT_EQ(0, totals[2]);
+
+    arr2d_intersect query(&reader);
+    query._lines_to_query.assign({3, arr2d_writer::dense_rows + 7, 100000});
+    while (query.next_intersect() < 12)
+        ; // Skip page 0 and 1
+    EXPECT_EQ(query.next_intersect(), 24);
+    EXPECT_EQ(query.next_intersect(), 36);
+    query._lines_to_query.assign({0, 16777215});
+    query.rewind();
+    EXPECT_EQ(query.next_intersect(), 5);
+    EXPECT_EQ(query.next_intersect(), ~uint32_t());
+}
+
 TEST_F(arr2d, reader) {
     arr2d_reader reader(tmpPath.c_str());
     EXPECT_EQ(reader.uncmprs_size(0, 1), 1000);
@@ -91,6 +143,44 @@ TEST_F(arr2d, reader) {
         ASSERT_EQ(reader.uncmprs_size(i, 0), i * 100 + 100);
 }
 
+TEST_F(arr2d, pageDirectory) {
+    arr2d_reader reader(tmpPath.c_str());
+    EXPECT_EQ(2, reader.page_count());
+    // Page i has i + 1 lines of i + 1 numbers each
+    for (uint32_t i = 0; i < 200; ++i) {
+        for (uint32_t j = 0; j <= i; ++j)
+            for (uint32_t k = 0; k <= i; ++k)
+                writer.add_int(j, k);
+        writer.append_pending_to_file();
+    }
+#ifdef _WIN32
+    reader.close();
+#endif
+    reader.refresh();
+    ASSERT_EQ(202, reader.page_count());
+
+    // Pages are looked up concurrently in random order
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nbad = 0;
+    for (unsigned t = 0; t < 4; ++t) threads.emplace_back([&reader, &nbad, t] {
+        std::mt19937 rd(t);
+        uint32_t lines[3] = { 0, 100, 199 }, sizes[3];
+        for (size_t n = 0; n < 2000; ++n) {
+            uint32_t i = rd() % 200;
+            reader.uncmprs_sizes(lines, 3, i + 2, sizes);
+            for (size_t l = 0; l < 3; ++l)
+                nbad += sizes[l] != (lines[l] <= i ? i + 1 : 0);
+        }
+    });
+    for (std::thread& t : threads)
+        t.join();
+    EXPECT_EQ(0, nbad);
+    EXPECT_EQ(~uint32_t(), reader.uncmprs_size(0, 202));
+
+    reader.clear();
+    EXPECT_EQ(1, reader.page_count());
+}
+
 TEST_F(arr2d, moveFile) {
     arr2d_reader reader(tmpPath.c_str());
     EXPECT_THROW(reader.move_file(NATIVE_PATH("/foobar/har")), std::system_error);
@@ -214,3 +304,96 @@ TEST_F(arr2d, intCorner) {
         ; // Skip page 0
     EXPECT_EQ(~uint32_t(), query.next_intersect());
 }
+
+TEST_F(arr2d, pairs) {
+    arr2d_reader reader(tmpPath.c_str());
+    arr2d_intersect query(&reader);
+    // Line 0 and either line 1 or 3; line 2 in page 1 is empty
+    query._lines_to_query.assign({0});
+    query._line_pairs_to_query.assign({{1, 3}, {2, 0}});
+
+    std::vector<uint32_t> expected, res;
+    for (uint32_t i = 0; i < 100; ++i)
+        expected.push_back(i * 7);
+    for (uint32_t i = 0; i < 1000; ++i)
+        if (((13 * i) % 17 == 0 && 13 * i / 17 < 1000) ||
+            ((13 * i) % 19 == 0 && 13 * i / 19 < 1000))
+            expected.push_back(100000 + 13 * i);
+    for (uint32_t n; (n = query.next_intersect()) != ~uint32_t(); )
+        res.push_back(n);
+    EXPECT_EQ(res, expected);
+
+    // Pairs alone, evaluated on the pool as well
+    query._lines_to_query.clear();
+    query._line_pairs_to_query.assign({{0, 1}});
+    orie::fifo_thpool pool(2);
+    for (orie::fifo_thpool* p : { (orie::fifo_thpool*)nullptr, &pool }) {
+        query.set_parallel(p, 2);
+        query.rewind();
+        res.clear();
+        for (uint32_t n; (n = query.next_intersect()) != ~uint32_t(); )
+            res.push_back(n);
+        // Union of multiples of 13 and 17 in page 1
+        ASSERT_EQ(res.size(), 200 + 2000 - 1000 / 17 - 1);
+        EXPECT_TRUE(std::is_sorted(res.begin(), res.end()));
+    }
+}
+
+TEST_F(arr2d, parallel) {
+    // 40 more pages with lines of multiples of 2, 3 and 5
+    for (uint32_t page = 0; page < 40; ++page) {
+        const uint32_t mult[] = { 2, 3, 5 };
+        writer._data_pending.resize(3);
+        for (uint32_t i = 0; i < 3000; ++i)
+            for (uint32_t line = 0; line < 3; ++line)
+                if (i % mult[line] == 0)
+                    writer._data_pending[line].push_back(200000 +
+                                                         page * 3000 + i);
+        writer.append_pending_to_file();
+    }
+    arr2d_reader reader(tmpPath.c_str());
+
+    auto all_results = [&reader] (arr2d_intersect& q, bool freq) {
+        std::vector<uint32_t> res;
+        q.rewind();
+        for (uint32_t n; (n = freq ? q.next_frequent(2)
+                                   : q.next_intersect()) != ~uint32_t(); )
+            res.push_back(n);
+        return res;
+    };
+    arr2d_intersect serial(&reader);
+    serial._lines_to_query.assign({0, 1, 2});
+    auto expected_int = all_results(serial, false);
+    auto expected_freq = all_results(serial, true);
+    // Multiples of 30 in new pages and those in SetUp
+    ASSERT_EQ(expected_int.size(), 40 * 100 + 100);
+
+    orie::fifo_thpool pool(4);
+    for (size_t window : { 1, 3, 16, 100 }) {
+        arr2d_intersect query(serial);
+        query.set_parallel(&pool, window);
+        EXPECT_EQ(all_results(query, false), expected_int) << window;
+        EXPECT_EQ(all_results(query, true), expected_freq) << window;
+
+        // Stop halfway, change lines and start again
+        query.rewind();
+        for (size_t i = 0; i < 1000; ++i)
+            query.next_intersect();
+        query._lines_to_query.assign({0, 2});
+        serial._lines_to_query.assign({0, 2});
+        EXPECT_EQ(all_results(query, false), all_results(serial, false));
+        serial._lines_to_query.assign({0, 1, 2});
+    }
+
+    // Queries run by the only worker evaluate the pages themselves
+    orie::fifo_thpool one(1);
+    arr2d_intersect query(serial);
+    query.set_parallel(&one, 4);
+    auto res = one.enqueue(all_results, std::ref(query), false);
+    EXPECT_EQ(res.get(), expected_int);
+
+    // No workers
+    orie::fifo_thpool none(0);
+    query.set_parallel(&none, 4);
+    EXPECT_EQ(all_results(query, false), expected_int);
+}
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include <orient/util/compresslib/intersection.h>
+#include <algorithm>
+#include <random>
 using namespace compressionLib;
 
 TEST(compressLib, compress) {
@@ -49,3 +51,45 @@ TEST(compressLib, intersect) {
     // Will write 16 bytes over end of result
     EXPECT_EQ(res[5], 12345678);
 }
+
+TEST(compressLib, intersectKernels) {
+    using kernel_t = size_t (*)(const uint32_t*, const size_t,
+                                const uint32_t*, const size_t, uint32_t*);
+    std::vector<kernel_t> kernels{ i32_intersect, i32_intersect_galloping,
+                                   i32_intersect_adaptive };
+    if (cpu_has_avx2())
+        kernels.push_back(i32_intersect_avx2);
+    if (cpu_has_avx512())
+        kernels.push_back(i32_intersect_avx512);
+
+    std::mt19937 rd(42);
+    // Sizes from equal to very skewed, including ones not a multiple of
+    // any vector width
+    for (size_t s_a : { 0, 1, 7, 33, 100, 1000 }) {
+        for (size_t s_b : { 0, 3, 17, 100, 5000, 100000 }) {
+            for (uint32_t span : { 2, 20 }) {
+                std::vector<uint32_t> a(s_a), b(s_b), expected;
+                std::uniform_int_distribution<uint32_t> gap(1, span);
+                uint32_t v = 0;
+                for (auto& x : a)
+                    x = v += gap(rd) * (s_b / std::max<size_t>(s_a, 1) + 1);
+                v = 0;
+                for (auto& x : b)
+                    x = v += gap(rd);
+                std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                                      std::back_inserter(expected));
+
+                std::vector<uint32_t> out(std::min(s_a, s_b) +
+                                          i32_intersect_slack);
+                for (kernel_t k : kernels) {
+                    size_t n = k(a.data(), s_a, b.data(), s_b, out.data());
+                    ASSERT_EQ(std::vector<uint32_t>(out.begin(), out.begin() + n),
+                              expected) << s_a << ' ' << s_b << ' ' << span;
+                    n = k(b.data(), s_b, a.data(), s_a, out.data());
+                    ASSERT_EQ(std::vector<uint32_t>(out.begin(), out.begin() + n),
+                              expected) << s_b << ' ' << s_a << ' ' << span;
+                }
+            }
+        }
+    }
+}
@@ -2,19 +2,10 @@
 #include <filesystem>
 #include <fstream>
 #include <random>
-#include <orient/fs/dumper.hpp>
-#include <orient/fs/data_iter.hpp>
-#include <orient/util/fifo_thpool.hpp>
+#include <algorithm>
+#include "abunchofdirs.hpp" // for `removeDb`
+#include <orient/fs/watcher.hpp>
 
-using namespace std::filesystem;
-using orie::dmp::dumper;
-using orie::fs_data_iter;
-
-#ifdef _WIN32
-#define sleep(sec) Sleep(sec * 1000)
-#endif
-
-inline orie::fifo_thpool __dummy_pool(0);
 struct dataIter : public ::testing::Test {
     path tmpPath, dbPath;
     dumper* dmp = nullptr;
@@ -46,8 +37,7 @@ struct dataIter : public ::testing::Test {
     ~dataIter() {
         delete dmp;
         remove_all(tmpPath);
-        remove_all(dbPath);
-        remove_all(dbPath += "_inv");
+        removeDb(dbPath);
     }
 };
 
@@ -119,3 +109,202 @@ TEST_F(dataIter, changeRoot) {
     it = fs_data_iter(nullptr, (tmpPath / "dirB").c_str());
     EXPECT_EQ(it, it.end());
 }
+
+TEST_F(dataIter, incrementalRebuild) {
+    // Directories changed too recently are always read again; none is
+    // racy in the test, so that stamps of a full rebuild are reusable.
+    dmp->_racy_stamp_margin = 0;
+    dmp->rebuild_database();
+    EXPECT_EQ(0, dmp->reused_dir_count());
+    // Stamps have at least a second of granularity on some filesystems
+    auto stamp = last_write_time(tmpPath / "dirA");
+    std::ofstream(tmpPath / "dirA" / "fileAC");
+    remove(tmpPath / "dirB" / "fileBA");
+    last_write_time(tmpPath / "dirA", stamp + std::chrono::seconds(1));
+    last_write_time(tmpPath / "dirB", stamp + std::chrono::seconds(1));
+
+    dumper incr((dbPath.native() + NATIVE_PATH("_incr")).c_str(), __dummy_pool);
+    incr.set_remove_on_destroy(true);
+    incr._root_path = tmpPath.native();
+    incr._noconcur_paths.push_back(tmpPath.native());
+    incr._racy_stamp_margin = 0;
+    incr.rebuild_database(dmp);
+    // All but dirA and dirB are unchanged
+    EXPECT_EQ(3, incr.reused_dir_count());
+
+    std::vector<orie::str_t> names;
+    for (fs_data_iter it(&incr); it != it.end(); ++it)
+        names.emplace_back(it.basename());
+    std::sort(names.begin(), names.end());
+    std::vector<orie::str_t> expected {
+        NATIVE_PATH("dirA"), NATIVE_PATH("dirB"), NATIVE_PATH("dirBA"),
+        NATIVE_PATH("dirEmpty"), NATIVE_PATH("fileA"), NATIVE_PATH("fileAA"),
+        NATIVE_PATH("fileAB"), NATIVE_PATH("fileAC"), NATIVE_PATH("fileB"),
+        NATIVE_PATH("fileBAA"), NATIVE_PATH("linkBAB")
+    };
+    EXPECT_EQ(names, expected);
+}
+
+TEST_F(dataIter, generations) {
+    size_t nfile = 0;
+    for (fs_data_iter it(dmp); it != it.end(); ++it)
+        ++nfile;
+    EXPECT_EQ(dmp->generation(), 0u);
+    EXPECT_TRUE(exists(dbPath));
+
+    // A rebuild that crashed before publishing is never seen
+    {
+        dumper crashed(dbPath.c_str(), __dummy_pool, true);
+        EXPECT_EQ(crashed.generation(), 1u);
+        std::ofstream(crashed.fwdidx_path()) << "torn";
+    }
+    dumper reopened(dbPath.c_str(), __dummy_pool);
+    EXPECT_EQ(reopened.generation(), 0u);
+    size_t nreopened = 0;
+    for (fs_data_iter it(&reopened); it != it.end(); ++it)
+        ++nreopened;
+    EXPECT_EQ(nfile, nreopened);
+
+    // Published generations replace previous ones, which are kept for
+    // their readers until the next one is published
+    std::ofstream(tmpPath / "fileC");
+    orie::str_t gen0 = dmp->fwdidx_path();
+    for (uint64_t gen = 1; gen <= 2; ++gen) {
+        dumper next(dbPath.c_str(), __dummy_pool, true);
+        next._root_path = tmpPath.native();
+        next.rebuild_database();
+        EXPECT_EQ(next.generation(), gen);
+    }
+    EXPECT_FALSE(exists(gen0));
+    EXPECT_FALSE(exists(gen0 + NATIVE_PATH("_inv")));
+    dumper published(dbPath.c_str(), __dummy_pool);
+    EXPECT_EQ(published.generation(), 2u);
+    size_t npublished = 0;
+    for (fs_data_iter it(&published); it != it.end(); ++it)
+        ++npublished;
+    EXPECT_EQ(nfile + 1, npublished);
+}
+
+TEST_F(dataIter, legacyDatabase) {
+    size_t nfile = 0;
+    for (fs_data_iter it(dmp); it != it.end(); ++it)
+        ++nfile;
+    // Laid out as before manifests: the forward index at the database path
+    path fwd = dmp->fwdidx_path(), inv = dmp->invidx_path();
+    delete dmp;
+    dmp = nullptr;
+    rename(fwd, dbPath);
+    rename(inv, dbPath.native() + "_inv");
+
+    auto legacy = std::make_unique<dumper>(dbPath.c_str(), __dummy_pool);
+    EXPECT_EQ(legacy->generation(), 0u);
+    EXPECT_EQ(legacy->fwdidx_path(), dbPath.native());
+    EXPECT_THROW(legacy->rebuild_database(), std::runtime_error);
+    fs_data_iter legacy_it(legacy.get());
+    EXPECT_EQ(nfile, _count_dataIt(legacy_it));
+
+    // Replaced by the first publish, and still readable by its dumper
+    dumper next(dbPath.c_str(), __dummy_pool, true);
+    next._root_path = tmpPath.native();
+    next.rebuild_database(legacy.get());
+    EXPECT_EQ(next.generation(), 1u);
+    EXPECT_FALSE(exists(dbPath.native() + "_inv"));
+    fs_data_iter again(legacy.get());
+    EXPECT_EQ(nfile, _count_dataIt(again));
+    dumper published(dbPath.c_str(), __dummy_pool);
+    EXPECT_EQ(published.generation(), 1u);
+    fs_data_iter published_it(&published);
+    EXPECT_EQ(nfile, _count_dataIt(published_it));
+}
+
+TEST_F(dataIter, seekableFrames) {
+    // Several frames of forward index in a chunk
+    for (int i = 0; i < 3000; ++i) {
+        path sub = tmpPath / ("dirF" + std::to_string(i % 7));
+        create_directories(sub);
+        std::ofstream(sub / ("a_rather_long_file_name_" + std::to_string(i)));
+    }
+    dmp->rebuild_database();
+    ASSERT_EQ(dmp->chunk_count(), 1);
+    std::vector<orie::str_t> expected;
+    for (fs_data_iter it(dmp); it != it.end(); ++it)
+        expected.emplace_back(it.path());
+
+    // Frames are decompressed as traversal reaches them
+    dumper reopened(dbPath.c_str(), __dummy_pool);
+    reopened.set_cache_budget(0);
+    std::vector<orie::str_t> paths;
+    for (fs_data_iter it(&reopened); it != it.end(); ++it)
+        paths.emplace_back(it.path());
+    EXPECT_EQ(paths, expected);
+    // And by batches visited directly
+    for (size_t b = reopened.batch_count(); b-- > 0; ) {
+        orie::fs_data_record rec(&reopened);
+        rec.change_batch(b);
+        EXPECT_NE(rec.file_type(), orie::unknown_tag);
+    }
+}
+
+TEST_F(dataIter, concurTraversal) {
+    for (int i = 0; i < 40; ++i) {
+        path sub = tmpPath / "dirB" / ("dirC" + std::to_string(i));
+        create_directories(sub / "dirD" / "dirE");
+        std::ofstream(sub / "dirD" / "fileD");
+    }
+    dmp->rebuild_database();
+    std::vector<orie::str_t> expected;
+    for (fs_data_iter it(dmp); it != it.end(); ++it)
+        expected.emplace_back(it.path());
+    std::sort(expected.begin(), expected.end());
+
+    // Traverse with work stealing workers, and with none of them
+    orie::fifo_thpool pool(4);
+    for (orie::fifo_thpool* p : { &pool, &__dummy_pool }) {
+        dumper concur((dbPath.native() + NATIVE_PATH("_concur")).c_str(), *p);
+        concur.set_remove_on_destroy(true);
+        concur._root_path = tmpPath.native();
+        concur.rebuild_database();
+
+        std::vector<orie::str_t> paths;
+        for (fs_data_iter it(&concur); it != it.end(); ++it)
+            paths.emplace_back(it.path());
+        std::sort(paths.begin(), paths.end());
+        EXPECT_EQ(paths, expected);
+    }
+
+    // With devices whose concurrency is limited
+    dumper limited((dbPath.native() + NATIVE_PATH("_limited")).c_str(), pool);
+    limited.set_remove_on_destroy(true);
+    limited._root_path = tmpPath.native();
+    limited._concur_limits = { { tmpPath.native(), 2 },
+                               { (tmpPath / "dirB").native(), 1 } };
+    limited.rebuild_database();
+    std::vector<orie::str_t> paths;
+    for (fs_data_iter it(&limited); it != it.end(); ++it)
+        paths.emplace_back(it.path());
+    std::sort(paths.begin(), paths.end());
+    EXPECT_EQ(paths, expected);
+}
+
+TEST(deltaSegment, addedUnder) {
+    orie::dmp::delta_segment delta;
+    for (const char* p : { "/a", "/a/b", "/a/b/c", "/a-b", "/a.b/c", "/ab" })
+        delta.add(p, orie::file_tag);
+    auto paths_under = [&delta] (orie::sv_t prefix) {
+        std::vector<orie::str_t> res;
+        for (const auto& [path, tag] : delta.added_under(prefix))
+            res.push_back(path);
+        return res;
+    };
+    using strs = std::vector<orie::str_t>;
+    EXPECT_EQ(paths_under("/a"), (strs{ "/a", "/a/b", "/a/b/c" }));
+    EXPECT_EQ(paths_under("/a/b/"), (strs{ "/a/b/c" }));
+    EXPECT_EQ(paths_under("").size(), 6);
+
+    // Siblings sharing the prefix are kept
+    delta.remove("/a");
+    EXPECT_EQ(paths_under(""), (strs{ "/a-b", "/a.b/c", "/ab" }));
+    EXPECT_TRUE(delta.is_removed("/a/b"));
+    delta.remove("");
+    EXPECT_TRUE(paths_under("").empty());
+}
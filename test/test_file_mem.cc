@@ -2,6 +2,7 @@
 #include <orient/util/file_mem_chunk.hpp>
 #include <orient/util/fifo_thpool.hpp>
 #include <filesystem>
+#include <fstream>
 #include <random>
 
 struct fileMemChunk : public testing::Test {
@@ -12,7 +13,8 @@ struct fileMemChunk : public testing::Test {
     fileMemChunk() 
         : tmpPath(std::filesystem::temp_directory_path() /
                   ("fileMemTest" + std::to_string(std::random_device()())))
-        , chunk(tmpPath.c_str(), 3, true, true) { }
+        // Room for 3 of the 4 chunks added in `SetUp`
+        , chunk(tmpPath.c_str(), 3 * 1111115, true, true) { }
 
     void SetUp() override {
         chunk._unplaced_dat.assign(1111111, std::byte('a'));
@@ -34,7 +36,7 @@ struct fileMemChunk : public testing::Test {
         const std::byte* res = chunk.start_visit(0, 1111110);
         EXPECT_EQ(res[0], std::byte('a'));
         EXPECT_EQ(res[1], std::byte('z'));
-        chunk.finish_visit();
+        chunk.finish_visit(0);
         return res;
     }
 
@@ -43,7 +45,7 @@ struct fileMemChunk : public testing::Test {
         const std::byte* res = chunk.start_visit(1, 1111111);
         EXPECT_EQ(res[0], std::byte('b'));
         EXPECT_EQ(res[1], std::byte('z'));
-        chunk.finish_visit();
+        chunk.finish_visit(1);
         return res;
     }
 
@@ -52,7 +54,7 @@ struct fileMemChunk : public testing::Test {
         const std::byte* res = chunk.start_visit(2, 1111112);
         EXPECT_EQ(res[0], std::byte('c'));
         EXPECT_EQ(res[1], std::byte('z'));
-        chunk.finish_visit();
+        chunk.finish_visit(2);
         return res;
     }
 
@@ -61,7 +63,7 @@ struct fileMemChunk : public testing::Test {
         const std::byte* res = chunk.start_visit(3, 1111113);
         EXPECT_EQ(res[0], std::byte('d'));
         EXPECT_EQ(res[1], std::byte('z'));
-        chunk.finish_visit();
+        chunk.finish_visit(3);
         return res;
     }
 };
@@ -77,18 +79,58 @@ TEST_F(fileMemChunk, visitCache) {
 
 TEST_F(fileMemChunk, pushCache) {
     EXPECT_TRUE(chunk._unplaced_dat.empty());
-    // D, B, C are in the 3 caches
+    // B, C, D are in memory; A is evicted to keep within the budget
+    EXPECT_FALSE(chunk.cached(0));
+    EXPECT_TRUE(chunk.cached(1));
+    EXPECT_TRUE(chunk.cached(2));
+    EXPECT_TRUE(chunk.cached(3));
+    EXPECT_LE(chunk.cached_bytes(), chunk.cache_budget());
     const std::byte* bRes = visitB(),
     *cRes = visitC(), *dRes = visitD();
     EXPECT_EQ(bRes, visitB());
     EXPECT_EQ(cRes, visitC());
     EXPECT_EQ(dRes, visitD());
 
-    // Read file and overwrite cache
+    // Read file and evict the oldest one
     EXPECT_EQ(visitA(), visitA());
-    EXPECT_NE(bRes, visitB());
-    EXPECT_NE(cRes, visitC());
-    EXPECT_NE(dRes, visitD());
+    EXPECT_TRUE(chunk.cached(0));
+    EXPECT_FALSE(chunk.cached(1));
+    EXPECT_EQ(cRes, visitC());
+    EXPECT_EQ(dRes, visitD());
+    EXPECT_LE(chunk.cached_bytes(), chunk.cache_budget());
+}
+
+TEST_F(fileMemChunk, scanResistant) {
+    // Nothing loaded behind the scan
+    chunk.set_readahead(0);
+    // Loaded again after eviction, thus protected
+    visitA();
+    for (size_t i = 0; i < 30; ++i) {
+        chunk._unplaced_dat.assign(200000, std::byte('f'));
+        chunk.add_last_chunk();
+    }
+    chunk.flush();
+    // Scan twice, with all of them read from file in the second time
+    for (size_t round = 0; round < 2; ++round) {
+        for (uint32_t i = 1; i < chunk.chunk_count(); ++i) {
+            chunk.start_visit(i, 0);
+            chunk.finish_visit(i);
+        }
+    }
+    EXPECT_TRUE(chunk.cached(0));
+    EXPECT_LE(chunk.cached_bytes(), chunk.cache_budget());
+
+    // Budget exceeded only if all chunks are pinned
+    chunk.set_cache_budget(0);
+    EXPECT_EQ(0, chunk.cached_bytes());
+    const std::byte* res = chunk.start_visit(0, 1111110);
+    EXPECT_EQ(res[0], std::byte('a'));
+    EXPECT_EQ(visitB(), visitB());
+    EXPECT_TRUE(chunk.cached(0));
+    chunk.finish_visit(0);
+    chunk.set_cache_budget(0);
+    EXPECT_FALSE(chunk.cached(0));
+    EXPECT_EQ(0, chunk.cached_bytes());
 }
 
 TEST_F(fileMemChunk, pushEmpty) {
@@ -103,21 +145,21 @@ TEST_F(fileMemChunk, pushEmpty) {
 TEST_F(fileMemChunk, moveFile) {
     chunk.move_file((tmpPath.native() + NATIVE_PATH(".old")).c_str());
 
-    // D, B, C are in the 3 caches
+    // B, C, D are in memory
     const std::byte* bRes = visitB(),
     *cRes = visitC(), *dRes = visitD();
     EXPECT_EQ(bRes, visitB());
     EXPECT_EQ(cRes, visitC());
     EXPECT_EQ(dRes, visitD());
 
-    // Read from new file and rewrite cache
+    // Read from new file
+    EXPECT_FALSE(chunk.cached(0));
     EXPECT_EQ(visitA(), visitA());
-    EXPECT_NE(bRes, visitB());
-    EXPECT_NE(cRes, visitC());
-    EXPECT_NE(dRes, visitD());
+    EXPECT_TRUE(chunk.cached(0));
 }
 
 TEST_F(fileMemChunk, read) {
+    chunk.flush();
     orie::dmp::file_mem_chunk chunk2(tmpPath.c_str(), 3, false, false);
 
     ASSERT_EQ(4, chunk2.chunk_count());
@@ -179,3 +221,175 @@ TEST_F(fileMemChunk, concurMoveFile) {
         chunk.move_file(tmpPath.native().c_str());
     });
 }
+
+TEST_F(fileMemChunk, pipelinedAdd) {
+    // More chunks than those allowed to wait for compression
+    for (size_t i = 0; i < 20; ++i) {
+        chunk._unplaced_dat.assign(300000 + i, std::byte('f' + i));
+        chunk.add_last_chunk();
+        ASSERT_EQ(5 + i, chunk.chunk_count());
+    }
+    // Readable before written to file, and after being evicted from cache
+    for (uint32_t i = 0; i < 20; ++i) {
+        const std::byte* res = chunk.start_visit(4 + i, 299999 + i);
+        EXPECT_EQ(res[0], std::byte('f' + i));
+        chunk.finish_visit(4 + i);
+    }
+    EXPECT_EQ(visitA(), visitA());
+
+    chunk.flush();
+    orie::dmp::file_mem_chunk chunk2(tmpPath.c_str(), 3, false, false);
+    ASSERT_EQ(24, chunk2.chunk_count());
+    const std::byte* res = chunk2.start_visit(23, 300018);
+    EXPECT_EQ(res[0], std::byte('f' + 19));
+    chunk2.finish_visit(23);
+}
+
+TEST_F(fileMemChunk, manyChunks) {
+    // More than the 4095 chunks version 1 files hold
+    for (uint32_t i = 0; i < 5000; ++i) {
+        chunk._unplaced_dat.assign(100, std::byte(i % 256));
+        chunk.add_last_chunk();
+    }
+    chunk.set_build_params({ 123456, 24, 16, 1, 0, 1 });
+    chunk.flush();
+
+    orie::dmp::file_mem_chunk chunk2(tmpPath.c_str(), 3, false, false);
+    ASSERT_EQ(5004, chunk2.chunk_count());
+    EXPECT_EQ(orie::dmp::file_mem_chunk::version, chunk2.file_version());
+    EXPECT_FALSE(chunk2.read_only());
+    EXPECT_EQ(123456, chunk2.build_params().chunk_size_hint);
+    EXPECT_EQ(24, chunk2.build_params().nfile_in_batch);
+    EXPECT_EQ(16, chunk2.build_params().trigram_bits);
+    EXPECT_EQ(1, chunk2.build_params().ancestor_keys);
+    EXPECT_EQ(0, chunk2.build_params().short_keys);
+    EXPECT_EQ(1, chunk2.build_params().anchor_keys);
+    for (uint32_t i : { 0u, 4095u, 4096u, 4999u }) {
+        const std::byte* res = chunk2.start_visit(4 + i, 99);
+        EXPECT_EQ(res[0], std::byte(i % 256));
+        chunk2.finish_visit(4 + i);
+    }
+}
+
+TEST_F(fileMemChunk, seekableFrames) {
+    // Seek points every 1000 bytes; frames of about `frame_size_hint`
+    constexpr size_t frame = orie::dmp::file_mem_chunk::frame_size_hint;
+    for (size_t i = 0; i < 8 * frame; ++i) {
+        if (i % 1000 == 0)
+            chunk.mark_seek_point();
+        chunk._unplaced_dat.push_back(std::byte(i / 1000 % 251));
+    }
+    chunk.add_last_chunk();
+    chunk.flush();
+
+    orie::dmp::file_mem_chunk chunk2(tmpPath.c_str(), 8 * frame, false, false);
+    ASSERT_EQ(5, chunk2.chunk_count());
+    // Only the frame holding it is decompressed
+    const std::byte* res = chunk2.start_visit(4, 5 * frame);
+    EXPECT_EQ(res[0], std::byte(5 * frame / 1000 % 251));
+    size_t one_frame = chunk2.cached_bytes();
+    EXPECT_GE(one_frame, frame);
+    EXPECT_LT(one_frame, frame + 1000);
+    // Another frame, at the same address
+    chunk2.extend_visit(4, 7 * frame);
+    EXPECT_EQ(res[2 * frame], std::byte(7 * frame / 1000 % 251));
+    EXPECT_EQ(2 * one_frame, chunk2.cached_bytes());
+    chunk2.finish_visit(4);
+
+    chunk2.set_cache_budget(0);
+    EXPECT_EQ(0, chunk2.cached_bytes());
+    res = chunk2.start_visit(4, 0);
+    EXPECT_EQ(res[999], std::byte(0));
+    chunk2.finish_visit(4);
+}
+
+TEST_F(fileMemChunk, readahead) {
+    chunk.flush();
+    orie::dmp::file_mem_chunk chunk2(tmpPath.c_str(), 4 * 1111115, false, false);
+    chunk2.set_readahead(2);
+    chunk2.start_visit(0, 0);
+    chunk2.finish_visit(0);
+    EXPECT_FALSE(chunk2.cached(1));
+
+    // Visited in order; the next two are decompressed in background
+    chunk2.start_visit(1, 0);
+    chunk2.finish_visit(1);
+    for (int i = 0; i < 1000 && !(chunk2.cached(2) && chunk2.cached(3)); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_TRUE(chunk2.cached(2));
+    EXPECT_TRUE(chunk2.cached(3));
+    const std::byte* res = chunk2.start_visit(3, 1111114);
+    EXPECT_EQ(res[0], std::byte('z'));
+    chunk2.finish_visit(3);
+}
+
+TEST_F(fileMemChunk, hot) {
+    // In memory, then in a file
+    for (const orie::str_t& dir : { orie::str_t(),
+                                    std::filesystem::temp_directory_path().native() }) {
+        chunk.make_hot(dir);
+        EXPECT_TRUE(chunk.hot());
+        EXPECT_EQ(0, chunk.cached_bytes());
+        for (int i = 0; i < 4; ++i)
+            EXPECT_TRUE(chunk.cached(i));
+        visitA(); visitB(); visitC(); visitD();
+        // Not pinned
+        for (int i = 0; i < 5; ++i)
+            chunk.start_visit(3, 0);
+        EXPECT_EQ(0, chunk.cached_bytes());
+    }
+
+    // Chunks added later are cached as usual
+    chunk._unplaced_dat.assign(10, std::byte('e'));
+    chunk.add_last_chunk();
+    const std::byte* res = chunk.start_visit(4, 9);
+    EXPECT_EQ(res[0], std::byte('e'));
+    chunk.finish_visit(4);
+    EXPECT_EQ(10, chunk.cached_bytes());
+    EXPECT_FALSE(chunk.cached(5));
+
+    chunk.drop_hot();
+    EXPECT_FALSE(chunk.hot());
+    visitA();
+}
+
+TEST(fileMemChunkV1, readOnly) {
+    auto v1Path = std::filesystem::temp_directory_path() /
+                  ("fileMemV1Test" + std::to_string(std::random_device()()));
+    // A fixed table of 4096 presums, then compressed chunks
+    std::vector<char> raw(5000, 'v');
+    std::vector<char> cmprs(ZSTD_compressBound(raw.size()));
+    size_t cmprs_sz = ZSTD_compress(cmprs.data(), cmprs.size(),
+                                    raw.data(), raw.size(), 1);
+    ASSERT_FALSE(ZSTD_isError(cmprs_sz));
+    std::vector<uint64_t> table(4096, ~uint64_t());
+    table[0] = 0;
+    table[1] = cmprs_sz;
+    {
+        std::ofstream ofs(v1Path, std::ios::binary);
+        ofs.write(reinterpret_cast<const char*>(table.data()), 4096 * 8);
+        ofs.write(cmprs.data(), cmprs_sz);
+    }
+
+    orie::dmp::file_mem_chunk v1(v1Path.c_str(), 3, false, true);
+    ASSERT_EQ(1, v1.chunk_count());
+    EXPECT_EQ(1, v1.file_version());
+    EXPECT_TRUE(v1.read_only());
+    EXPECT_EQ(0, v1.build_params().nfile_in_batch);
+    const std::byte* res = v1.start_visit(0, 4999);
+    EXPECT_EQ(res[0], std::byte('v'));
+    v1.finish_visit(0);
+
+    v1._unplaced_dat.assign(10, std::byte('w'));
+    EXPECT_THROW(v1.add_last_chunk(), std::runtime_error);
+    v1._unplaced_dat.clear();
+    // Rewritten as the current version
+    v1.clear();
+    EXPECT_FALSE(v1.read_only());
+    v1._unplaced_dat.assign(10, std::byte('w'));
+    v1.add_last_chunk();
+    v1.flush();
+    orie::dmp::file_mem_chunk v2(v1Path.c_str(), 3, false, false);
+    EXPECT_EQ(1, v2.chunk_count());
+    EXPECT_EQ(orie::dmp::file_mem_chunk::version, v2.file_version());
+}
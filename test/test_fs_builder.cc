@@ -50,6 +50,46 @@ TEST_F(fsExprBuilder, cond) {
     EXPECT_FALSE(builder.has_action());
 }
 
+TEST_F(fsExprBuilder, indexPlans) {
+    orie::pred_tree::fs_expr_builder builder;
+    auto by_next = [this] (orie::pred_tree::fs_node& matcher) {
+        fs_data_iter it(info.dmp.get()), end = it.end();
+        matcher.update_cost();
+        size_t cnt = 0;
+        for (matcher.next(it, end, true); it != end;
+             matcher.next(it, end, true))
+            ++cnt;
+        return cnt;
+    };
+    // Whether candidates of the expression are planned from the index
+    const std::pair<orie::sv_t, bool> exprs[] = {
+        { NATIVE_SV("-name file1 -o -name dir3"), true },
+        { NATIVE_SV("-name file1 -o -strstr ir2 -o -name *le3"), true },
+        { NATIVE_SV("( -name file1 -o -name dir3 ) -a -strstr 1"), true },
+        { NATIVE_SV("-strstr dir -a -name *r2"), true },
+        { NATIVE_SV("-name file1 -a -type f"), true },
+        { NATIVE_SV("( -name file1 -a -type f ) -o -name dir0"), true },
+        { NATIVE_SV("-name file1 -o -type l"), false },
+        { NATIVE_SV("-name file1 -o -not -name file2"), false },
+        { NATIVE_SV("-bregex fil(e1|e3)"), true },
+        { NATIVE_SV("-bregex ^(file1|dir3)$"), true },
+        { NATIVE_SV("-name file2 -o -bregex ^d[i]r[0-9]$"), false },
+        { NATIVE_SV("-name file2 -o -bregex ^dir[0-9]$"), true },
+        { NATIVE_SV("-bregex ^d.r -a -type d"), false },
+    };
+    for (const auto& [expr, planned] : exprs) {
+        builder.build(expr);
+        fs_data_iter it(info.dmp.get());
+        EXPECT_EQ(planned, builder.get()->plan(it) != nullptr);
+        size_t expected = _do_tests(*builder.get());
+        EXPECT_LT(0, expected);
+        // Only `next` faster than iteration moves past a match it stops at
+        if (builder.get()->faster_with_next(true)) {
+            EXPECT_EQ(expected, by_next(*builder.get()));
+        }
+    }
+}
+
 // TODO: Tests for modifiers without builder
 
 TEST_F(fsExprBuilder, updir) {
@@ -0,0 +1,62 @@
+#include <orient/fs/mounts.hpp>
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+using namespace orie::dmp;
+using namespace std::filesystem;
+
+#ifdef __linux__
+TEST(mountsTest, readMounts) {
+    path tmp = temp_directory_path() / "mountsTest";
+    remove_all(tmp);
+    // A fake sysfs with a partitioned HDD and an NVMe drive
+    path sys = tmp / "sys";
+    create_directories(sys / "dev" / "block");
+    create_directories(sys / "devices" / "sda" / "queue");
+    create_directories(sys / "devices" / "sda" / "sda1");
+    create_directories(sys / "devices" / "nvme0n1" / "queue");
+    std::ofstream(sys / "devices" / "sda" / "queue" / "rotational") << "1\n";
+    std::ofstream(sys / "devices" / "sda" / "queue" / "nr_requests") << "64\n";
+    std::ofstream(sys / "devices" / "nvme0n1" / "queue" / "rotational") << "0\n";
+    std::ofstream(sys / "devices" / "nvme0n1" / "queue" / "nr_requests") << "1023\n";
+    create_directory_symlink("../../devices/sda/sda1", sys / "dev" / "block" / "8:1");
+    create_directory_symlink("../../devices/nvme0n1", sys / "dev" / "block" / "259:0");
+
+    std::ofstream(tmp / "mountinfo")
+        << "22 1 8:1 / / rw,relatime shared:1 - ext4 /dev/sda1 rw\n"
+        << "23 22 0:21 / /proc rw,nosuid - proc proc rw\n"
+        << "24 22 259:0 / /home\\040dir rw - ext4 /dev/nvme0n1 rw\n"
+        << "25 22 0:40 / /merged rw - overlay overlay "
+           "rw,lowerdir=/l,upperdir=/u,workdir=/w\n"
+        << "26 22 0:50 / /net rw shared:5 master:2 - nfs srv:/x rw\n"
+        << "Malformed line\n";
+
+    auto mnts = read_mounts((tmp / "mountinfo").c_str(), sys.c_str());
+    ASSERT_EQ(5, mnts.size());
+    EXPECT_EQ("/", mnts[0].path);
+    EXPECT_TRUE(mnts[0].rotational);
+    EXPECT_FALSE(mnts[0].nvme);
+    EXPECT_EQ(64, mnts[0].nr_requests);
+    EXPECT_EQ(1, device_concurrency(mnts[0]));
+
+    EXPECT_TRUE(mnts[1].pseudo);
+    EXPECT_EQ("proc", mnts[1].fstype);
+
+    EXPECT_EQ("/home dir", mnts[2].path);
+    EXPECT_TRUE(mnts[2].nvme);
+    EXPECT_FALSE(mnts[2].rotational);
+    EXPECT_EQ(1023 / 32, device_concurrency(mnts[2]));
+
+    EXPECT_FALSE(mnts[3].pseudo);
+    EXPECT_EQ(std::vector<orie::str_t>({ "/u", "/w" }), mnts[3].hidden_paths);
+    // No block device
+    EXPECT_EQ(0, device_concurrency(mnts[3]));
+    EXPECT_EQ(0, device_concurrency(mnts[4]));
+    EXPECT_TRUE(mnts[4].network);
+    EXPECT_FALSE(mnts[3].network);
+    EXPECT_EQ("259:0", mnts[2].device);
+
+    EXPECT_TRUE(read_mounts((tmp / "nonexistent").c_str()).empty());
+    remove_all(tmp);
+}
+#endif
@@ -1,6 +1,7 @@
 #include <orient/fs/trigram.hpp>
 #include <gtest/gtest.h>
 #include <filesystem>
+#include <fstream>
 #include <random>
 using namespace orie::dmp;
 
@@ -29,6 +30,142 @@ TEST(trigramParse, baseStrstr) {
     EXPECT_EQ(15, strstr_trigram_ext(NATIVE_SV("/*\\?[]56789012345"), buf, 32));
 }
 
+// Bit-by-bit CRC the trigram hashes are defined by
+static uint32_t _reference_trigram(uint32_t low, uint32_t mid, uint32_t high) {
+    low |= 0b100000;
+    mid &= ~(0b100000);
+    high |= 0b100000;
+    uint32_t crc = low + (mid << 8) + (high << 16);
+    for (size_t i = 0; i < 32; i++) {
+        bool bit = crc & 0x80000000;
+        crc <<= 1;
+        if (bit)
+            crc ^= 0x1edc6f41;
+    }
+    return crc;
+}
+
+TEST(trigramParse, hashKernel) {
+    std::mt19937 rd(42);
+    std::uniform_int_distribution<int> dist(-128, 255);
+    orie::char_t name[200];
+    for (auto& c : name)
+        c = static_cast<orie::char_t>(dist(rd));
+    for (size_t i = 0; i < 198; ++i)
+        ASSERT_EQ(_reference_trigram(name[i], name[i+1], name[i+2]),
+                  char_to_trigram(name[i], name[i+1], name[i+2]));
+
+    uint32_t hashes[198], buf[198];
+    hash_trigrams(name, 198, hashes);
+    size_t nhash = 0;
+    for (size_t i = 0; i < 198; ++i) {
+        ASSERT_EQ(_reference_trigram(name[i], name[i+1], name[i+2]) & 8191,
+                  hashes[i]);
+        if (hashes[i] > 1)
+            hashes[nhash++] = hashes[i];
+    }
+    // Query side extraction spans more than one kernel call
+    ASSERT_EQ(nhash, strstr_trigram_ext(orie::sv_t(name, 200), buf, 198));
+    EXPECT_TRUE(std::equal(buf, buf + nhash, hashes));
+}
+
+TEST(trigramParse, placerDedupe) {
+    auto path_a = std::filesystem::temp_directory_path() / "trigramPlaceA";
+    auto path_b = std::filesystem::temp_directory_path() / "trigramPlaceB";
+    {
+        arr2d_writer wa(path_a.native()), wb(path_b.native());
+        trigram_placer placer;
+        const orie::char_t* names[] = { NATIVE_PATH("aaaaaa"),
+            NATIVE_PATH("abcabc"), NATIVE_PATH("ABCD"), NATIVE_PATH("xyz") };
+        for (uint32_t batch = 0; batch < 100; ++batch) {
+            for (const orie::char_t* n : names) {
+                place_trigram(n, batch / 3, wa);
+                placer.place(n, batch / 3, wb);
+            }
+        }
+        wa.append_pending_to_file();
+        wb.append_pending_to_file();
+    }
+    std::ifstream a(path_a, std::ios::binary), b(path_b, std::ios::binary);
+    std::string sa((std::istreambuf_iterator<char>(a)), {}),
+                sb((std::istreambuf_iterator<char>(b)), {});
+    a.close(); b.close();
+    std::filesystem::remove(path_a);
+    std::filesystem::remove(path_b);
+    EXPECT_FALSE(sa.empty());
+    EXPECT_EQ(sa, sb);
+}
+
+TEST(trigramParse, exactKeys) {
+    using orie::char_t;
+    const unsigned bits = exact_trigram_bits;
+    // Case insensitive, and exact otherwise
+    EXPECT_EQ(trigram_key('a', 'b', 'c', bits), trigram_key('A', 'B', 'C', bits));
+    EXPECT_NE(trigram_key('a', 'b', 'c', bits), trigram_key('a', 'b', 'd', bits));
+    EXPECT_NE(trigram_key('a', 'b', 'c', bits), trigram_key('c', 'b', 'a', bits));
+    EXPECT_EQ(trigram_key('a', 'b', 'c', default_trigram_bits),
+              char_to_trigram('a', 'b', 'c') & 8191);
+
+    std::mt19937 rd(42);
+    std::uniform_int_distribution<int> dist(-128, 255);
+    char_t name[200];
+    for (auto& c : name)
+        c = static_cast<char_t>(dist(rd));
+    uint32_t hashes[198], buf[198];
+    for (unsigned b : { min_trigram_bits, default_trigram_bits, 20u, bits }) {
+        hash_trigrams(name, 198, hashes, b);
+        for (size_t i = 0; i < 198; ++i) {
+            ASSERT_EQ(trigram_key(name[i], name[i+1], name[i+2], b), hashes[i]);
+            ASSERT_GT(uint64_t(1) << b, hashes[i]);
+        }
+        size_t nhash = std::remove_if(hashes, hashes + 198,
+            [] (uint32_t h) { return h <= 1; }) - hashes;
+        ASSERT_EQ(nhash, strstr_trigram_ext(orie::sv_t(name, 200), buf, 198, b));
+        EXPECT_TRUE(std::equal(buf, buf + nhash, hashes));
+    }
+    if constexpr (sizeof(char_t) == 1) {
+        // No collisions at all among byte trigrams not equal in case folding
+        auto fold = [&name] (size_t i) { return uint8_t(name[i] | 32); };
+        for (size_t i = 0; i < 198; ++i)
+            for (size_t j = 0; j < 198; ++j)
+                if (fold(i) != fold(j) || fold(i + 1) != fold(j + 1) ||
+                    fold(i + 2) != fold(j + 2)) {
+                    ASSERT_NE(trigram_key(name[i], name[i+1], name[i+2], bits),
+                              trigram_key(name[j], name[j+1], name[j+2], bits));
+                }
+    }
+
+    // Placers of any width place the same as `place_trigram`
+    auto path_a = std::filesystem::temp_directory_path() / "trigramExactA";
+    auto path_b = std::filesystem::temp_directory_path() / "trigramExactB";
+    {
+        arr2d_writer wa(path_a.native()), wb(path_b.native());
+        trigram_placer placer;
+        placer.reset(bits);
+        for (uint32_t batch = 0; batch < 100; ++batch) {
+            orie::sv_t n(name + batch, 100);
+            place_trigram(n, batch / 3, wa, bits);
+            place_trigram(n, batch / 3, wa, bits);
+            placer.place(n, batch / 3, wb);
+            placer.place(n, batch / 3, wb);
+        }
+        wa.append_pending_to_file();
+        wb.append_pending_to_file();
+    }
+    arr2d_reader ra(path_a.native()), rb(path_b.native());
+    ra._rmfile_on_dtor = rb._rmfile_on_dtor = true;
+    compressionLib::fastPForCodec codec;
+    std::vector<uint32_t> la, lb;
+    for (size_t i = 0; i < 197; ++i) {
+        uint32_t k = trigram_key(name[i], name[i+1], name[i+2], bits);
+        ASSERT_TRUE(ra.line_data(codec, la, k, 0));
+        ASSERT_TRUE(rb.line_data(codec, lb, k, 0));
+        ASSERT_FALSE(la.empty());
+        ASSERT_EQ(la, lb);
+    }
+    EXPECT_THROW(trigram_placer().reset(bits + 1), std::out_of_range);
+}
+
 TEST(trigramParse, baseGlob) {
     uint32_t buf[32] = {};
     // This is basename and '/' has no special meaning
@@ -66,6 +203,191 @@ TEST(trigramParse, baseGlob) {
     EXPECT_EQ(glob_trigram_ext(NATIVE_SV("*?*?*[*?]?*?"), buf, 32, false).first, 0);
 }
 
+TEST(trigramParse, regexLiterals) {
+    using strs = std::vector<orie::str_t>;
+    regex_literals lits = regex_literal_ext(NATIVE_SV("lib[^/]*\\.so\\.[0-9]+$"));
+    EXPECT_FALSE(lits.is_or);
+    EXPECT_EQ(lits.lits, strs({NATIVE_PATH("lib"), NATIVE_PATH(".so.")}));
+
+    // Optional chars split literals; repeated ones stay next to the rest
+    lits = regex_literal_ext(NATIVE_SV("abcd?efg+hij"));
+    EXPECT_EQ(lits.lits, strs({NATIVE_PATH("abc"), NATIVE_PATH("efg"),
+                               NATIVE_PATH("ghij")}));
+    lits = regex_literal_ext(NATIVE_SV("\\Qa.b*c\\E(?:xyz)*\\d{2}qwe"));
+    EXPECT_EQ(lits.lits, strs({NATIVE_PATH("a.b*c"), NATIVE_PATH("qwe")}));
+
+    // Alternations
+    lits = regex_literal_ext(NATIVE_SV("foo(bar|baz)\\.txt"));
+    EXPECT_EQ(lits.lits, strs({NATIVE_PATH("foo"), NATIVE_PATH(".txt")}));
+    ASSERT_EQ(lits.subs.size(), 1);
+    EXPECT_TRUE(lits.subs[0].is_or);
+    EXPECT_EQ(lits.subs[0].lits, strs({NATIVE_PATH("bar"), NATIVE_PATH("baz")}));
+    lits = regex_literal_ext(NATIVE_SV("(?i)(abc|defg)(hij|k)"));
+    EXPECT_TRUE(lits.is_or);
+    EXPECT_EQ(lits.lits, strs({NATIVE_PATH("abc"), NATIVE_PATH("defg")}));
+
+    // Nothing required
+    EXPECT_TRUE(regex_literal_ext(NATIVE_SV("abc|de")).any());
+    EXPECT_TRUE(regex_literal_ext(NATIVE_SV("^.*[0-4]+.?$")).any());
+    EXPECT_TRUE(regex_literal_ext(NATIVE_SV("(?x)a b c")).any());
+    EXPECT_TRUE(regex_literal_ext(NATIVE_SV("(*UTF)abc")).any());
+    EXPECT_TRUE(regex_literal_ext(NATIVE_SV("(?(1)abc|def)")).any());
+    EXPECT_TRUE(regex_literal_ext(NATIVE_SV("a(?=xyz)b")).any());
+    EXPECT_TRUE(regex_literal_ext(NATIVE_SV("(abc")).any());
+    EXPECT_TRUE(regex_literal_ext(NATIVE_SV("abc\\")).any());
+}
+
+TEST(trigramParse, shortKeys) {
+    uint32_t buf[32] = {}, buf2[32] = {};
+    const unsigned bits = default_trigram_bits;
+    ASSERT_EQ(2, short_key_ext(NATIVE_SV("*.c"), true, buf, 32));
+    EXPECT_EQ(bigram_key(bigram_hash('.', 'c', bits), bits), buf[0]);
+    EXPECT_EQ(extension_key(extension_hash(NATIVE_SV("c"), bits), bits), buf[1]);
+    ASSERT_EQ(2, short_key_ext(NATIVE_SV("*.C"), true, buf2, 32));
+    EXPECT_EQ(buf[0], buf2[0]);
+    EXPECT_EQ(buf[1], buf2[1]);
+    // Matches may have other extensions
+    EXPECT_EQ(1, short_key_ext(NATIVE_SV("*.c*"), true, buf, 32));
+    EXPECT_EQ(1, short_key_ext(NATIVE_SV(".c"), false, buf, 32));
+    EXPECT_EQ(1, short_key_ext(NATIVE_SV("go"), false, buf, 32));
+    EXPECT_EQ(bigram_key(bigram_hash('g', 'o', bits), bits), buf[0]);
+    EXPECT_EQ(0, short_key_ext(NATIVE_SV("x"), false, buf, 32));
+    EXPECT_EQ(0, short_key_ext(NATIVE_SV("a?b*"), true, buf, 32));
+    EXPECT_EQ(0, short_key_ext(NATIVE_SV("go"), false, buf, 0));
+}
+
+TEST(trigramParse, anchorKeys) {
+    uint32_t buf[32] = {}, buf2[32] = {};
+    const orie::char_t sep = orie::separator;
+    auto key = [] (orie::char_t l, orie::char_t m, orie::char_t h) {
+        return trigram_key(l, m, h, default_trigram_bits);
+    };
+    ASSERT_EQ(2, name_anchor_ext(NATIVE_SV("libfoo"), buf, 32));
+    EXPECT_EQ(key(sep, 'l', 'i'), buf[0]);
+    EXPECT_EQ(key('o', 'o', sep), buf[1]);
+    ASSERT_EQ(1, name_anchor_ext(NATIVE_SV("x"), buf, 32));
+    EXPECT_EQ(key(sep, 'x', sep), buf[0]);
+    EXPECT_EQ(0, name_anchor_ext(NATIVE_SV(""), buf, 32));
+    EXPECT_EQ(1, name_anchor_ext(NATIVE_SV("libfoo"), buf, 1));
+
+    // Globs have the keys of names they start or end with
+    ASSERT_EQ(2, name_anchor_ext(NATIVE_SV("libfoo.tar.zst"), buf, 32));
+    ASSERT_EQ(1, glob_anchor_ext(NATIVE_SV("libfoo*"), buf2, 32));
+    EXPECT_EQ(buf[0], buf2[0]);
+    ASSERT_EQ(1, glob_anchor_ext(NATIVE_SV("*.tar.zst"), buf2, 32));
+    EXPECT_EQ(buf[1], buf2[0]);
+    ASSERT_EQ(2, glob_anchor_ext(NATIVE_SV("LibFoo.tar.ZST"), buf2, 32));
+    EXPECT_EQ(buf[0], buf2[0]);
+    EXPECT_EQ(buf[1], buf2[1]);
+    ASSERT_EQ(1, glob_anchor_ext(NATIVE_SV("x"), buf2, 32));
+    EXPECT_EQ(key(sep, 'x', sep), buf2[0]);
+
+    // Wildcards and sets, which may match nothing or anything
+    EXPECT_EQ(0, glob_anchor_ext(NATIVE_SV("a*"), buf, 32));
+    EXPECT_EQ(0, glob_anchor_ext(NATIVE_SV("?"), buf, 32));
+    EXPECT_EQ(0, glob_anchor_ext(NATIVE_SV("a?b*c"), buf, 32));
+    ASSERT_EQ(1, glob_anchor_ext(NATIVE_SV("[ab]cd"), buf, 32));
+    EXPECT_EQ(key('c', 'd', sep), buf[0]);
+    ASSERT_EQ(2, glob_anchor_ext(NATIVE_SV("\\*a\\?"), buf, 32));
+    EXPECT_EQ(key(sep, '*', 'a'), buf[0]);
+    EXPECT_EQ(key('a', '?', sep), buf[1]);
+    // Unpaired '[' is a normal char
+    ASSERT_EQ(2, glob_anchor_ext(NATIVE_SV("ab["), buf, 32));
+    EXPECT_EQ(key('b', '[', sep), buf[1]);
+}
+
+TEST(trigramSearch, anchorKeys) {
+    auto path = std::filesystem::temp_directory_path() / "trigramAnchorKeys";
+    const unsigned bits = exact_trigram_bits;
+    {
+        arr2d_writer w(path.native());
+        trigram_placer placer;
+        placer.reset(bits);
+        for (uint32_t batch = 0; batch < 100; ++batch) {
+            orie::sv_t name = NATIVE_SV("file");
+            if (batch == 3)
+                name = NATIVE_SV("libfoo.so");
+            else if (batch == 5)
+                name = NATIVE_SV("foolib");
+            else if (batch == 7)
+                name = NATIVE_SV("lib");
+            placer.place(name, batch, w);
+            placer.place_anchors(name, batch, w);
+        }
+        w.append_pending_to_file();
+    }
+    arr2d_reader reader(path.native());
+    reader._rmfile_on_dtor = true;
+    trigram_query query;
+    auto batches = [&] (orie::sv_t pat, bool anchors) {
+        query.reset_glob_needle(pat, false);
+        query.reset_reader(&reader, bits, false, false, anchors);
+        std::vector<uint32_t> res;
+        for (uint32_t b; (b = query.next_batch_possible()) != ~uint32_t(); )
+            res.push_back(b);
+        return res;
+    };
+    using batches_t = std::vector<uint32_t>;
+    EXPECT_EQ(batches_t({3, 5, 7}), batches(NATIVE_SV("lib*"), false));
+    EXPECT_EQ(batches_t({3, 7}), batches(NATIVE_SV("lib*"), true));
+    EXPECT_EQ(batches_t({5, 7}), batches(NATIVE_SV("*LIB"), true));
+    EXPECT_EQ(batches_t({7}), batches(NATIVE_SV("lib"), true));
+    EXPECT_EQ(batches_t({3}), batches(NATIVE_SV("lib*.so"), true));
+    EXPECT_EQ(batches_t({3, 5, 7}), batches(NATIVE_SV("*lib*"), true));
+}
+
+TEST(trigramSearch, shortKeys) {
+    auto path = std::filesystem::temp_directory_path() / "trigramShortKeys";
+    const unsigned bits = exact_trigram_bits;
+    std::vector<uint32_t> dot_c;
+    {
+        arr2d_writer w(path.native());
+        trigram_placer placer;
+        placer.reset(bits);
+        for (uint32_t batch = 0; batch < 1000; ++batch) {
+            orie::sv_t name = NATIVE_SV("file");
+            if (batch % 100 == 7) {
+                name = NATIVE_SV("main.c");
+                dot_c.push_back(batch);
+            } else if (batch == 500)
+                name = NATIVE_SV("go.h");
+            w.add_int(0, batch); // Row 0 has every batch
+            placer.place(name, batch, w);
+            placer.place_short(name, batch, w);
+        }
+        w.append_pending_to_file();
+    }
+    arr2d_reader reader(path.native());
+    reader._rmfile_on_dtor = true;
+    trigram_query query;
+    auto batches = [&] (orie::sv_t pat, bool glob) {
+        glob ? query.reset_glob_needle(pat, false)
+             : query.reset_strstr_needle(pat, false);
+        query.reset_reader(&reader, bits, false, true);
+        std::vector<uint32_t> res;
+        for (uint32_t b; (b = query.next_batch_possible()) != ~uint32_t(); )
+            res.push_back(b);
+        return res;
+    };
+    EXPECT_EQ(dot_c, batches(NATIVE_SV("*.c"), true));
+    EXPECT_EQ(dot_c, batches(NATIVE_SV("*.C"), true));
+    EXPECT_EQ(std::vector<uint32_t>{500}, batches(NATIVE_SV("*.h"), true));
+    EXPECT_EQ(std::vector<uint32_t>{500}, batches(NATIVE_SV("go"), false));
+    EXPECT_TRUE(batches(NATIVE_SV("*.o"), true).empty());
+
+    // Too dense to look up, so every batch is scanned
+    query.reset_strstr_needle(NATIVE_SV("fi"), false);
+    query.reset_reader(&reader, bits, false, true);
+    EXPECT_EQ(0, query.trigram_size());
+    EXPECT_TRUE(query.indexable());
+    // Short keys of an index without them
+    query.reset_glob_needle(NATIVE_SV("*.c"), false);
+    query.reset_reader(&reader, bits, false, false);
+    EXPECT_EQ(0, query.trigram_size());
+    query.reset_reader(&reader, bits, false, true);
+    EXPECT_EQ(2, query.trigram_size());
+}
+
 TEST(trigramParse, fullGlobNoSep) {
     uint32_t buf[32] = {};
     // `glob_trigram_ext` also works as long as '/' is not in pattern
@@ -212,6 +534,76 @@ TEST(trigramParse, fullGlob) {
 }
 #endif
 
+#ifndef _WIN32
+TEST(trigramParse, ancestorKeys) {
+    uint32_t buf[32] = {}, names[32] = {};
+    using res_t = std::pair<size_t, size_t>;
+
+    // All names of a strstr needle; those before the last separator are
+    // of ancestors
+    ASSERT_EQ(res_t(8, 4), path_trigram_ext(NATIVE_SV("build/lib/libfoo"),
+                                            false, buf, 32));
+    strstr_trigram_ext(NATIVE_SV("build"), names, 32);
+    EXPECT_TRUE(std::equal(buf, buf + 3, names));
+    strstr_trigram_ext(NATIVE_SV("lib"), names, 32);
+    EXPECT_EQ(buf[3], names[0]);
+    strstr_trigram_ext(NATIVE_SV("libfoo"), names, 32);
+    EXPECT_TRUE(std::equal(buf + 4, buf + 8, names));
+    EXPECT_EQ(res_t(4, 0), path_trigram_ext(NATIVE_SV("libfoo"),
+                                            false, buf, 32));
+    EXPECT_EQ(res_t(4, 4), path_trigram_ext(NATIVE_SV("libfoo/"),
+                                            false, buf, 32));
+
+    // The final literal of a glob is left for basename keys
+    EXPECT_EQ(res_t(7, 3), path_trigram_ext(NATIVE_SV("*/build/*/libfoo*"),
+                                            true, buf, 32));
+    EXPECT_EQ(res_t(3, 3), path_trigram_ext(NATIVE_SV("*/build/*/libfoo.so"),
+                                            true, buf, 32));
+    EXPECT_EQ(res_t(0, 0), path_trigram_ext(NATIVE_SV("libfoo.so"),
+                                            true, buf, 32));
+
+    // Wildcards and separators break names; separators in brackets are
+    // not counted
+    auto count = [&buf] (orie::sv_t pat) {
+        return path_trigram_ext(pat, true, buf, 32).first;
+    };
+    EXPECT_EQ(0, count(NATIVE_SV("*/bu*ld/x")));
+    EXPECT_EQ(1, count(NATIVE_SV("abc*/x")));
+    EXPECT_EQ(1, count(NATIVE_SV("abc[/]def")));
+    EXPECT_EQ(1, count(NATIVE_SV("[]/]abc/x")));
+    EXPECT_EQ(1, count(NATIVE_SV("[!]/]abc/x")));
+    EXPECT_EQ(2, count(NATIVE_SV("abc\\/def/x")));
+    // Unpaired '[' is a normal char
+    EXPECT_EQ(2, count(NATIVE_SV("ab[c/x")));
+}
+
+TEST(trigramParse, placeAncestors) {
+    auto path = std::filesystem::temp_directory_path() / "trigramAncestors";
+    {
+        arr2d_writer w(path.native());
+        trigram_placer placer;
+        placer.place_ancestors(NATIVE_SV("/usr/lib"), 0, w);
+        placer.place_ancestors(NATIVE_SV("/usr/lib"), 0, w);
+        placer.place(NATIVE_SV("usr"), 0, w);
+        placer.place_ancestors(NATIVE_SV("/usr"), 1, w);
+        w.append_pending_to_file();
+    }
+    arr2d_reader reader(path.native());
+    reader._rmfile_on_dtor = true;
+    const unsigned bits = default_trigram_bits;
+    auto key = [] (const char* t) {
+        return trigram_key(t[0], t[1], t[2], default_trigram_bits);
+    };
+    EXPECT_EQ(2, reader.uncmprs_size(ancestor_key(key("usr"), bits), 0));
+    EXPECT_EQ(1, reader.uncmprs_size(ancestor_key(key("lib"), bits), 0));
+    EXPECT_EQ(1, reader.uncmprs_size(key("usr"), 0));
+    EXPECT_EQ(0, reader.uncmprs_size(key("lib"), 0));
+    // Not across separators
+    for (const char* t : { "/us", "r/l", "sr/" })
+        EXPECT_EQ(0, reader.uncmprs_size(ancestor_key(key(t), bits), 0));
+}
+#endif
+
 // Simulate a search from 100K "batchs" spanning 4 "pages" with each batch
 // containing ~400 trigrams each (400 characters)
 // The target "Hello World" is in batch 90K, at the beginning of last page.
@@ -384,3 +776,81 @@ TEST(trigramSearch, corner) {
         query.next_batch_possible();
     EXPECT_EQ(query.next_batch_possible(), ~uint32_t());
 }
+
+// Share of batches found by strstr searches in an index of `bits` wide keys
+// that have no name containing the needle, i.e. are scanned in vain.
+// Names join common words and random ids, like many real ones. Needles are
+// taken from the ids if `in_ids`, or from anywhere in names otherwise.
+static double _false_positive_rate(unsigned bits, bool in_ids) {
+    static const char* const words[] = { "lib", "test", "src", "config",
+        "main", "util", "build", "cache", "index", "data", "image", "log",
+        "backup", "report", "module", "plugin", "core", "server", "client",
+        "node" };
+    static const char* const exts[] = { ".cc", ".h", ".so", ".txt", ".json",
+                                        ".png", ".py", ".js" };
+    constexpr size_t nbatch = 10000, nfile = 24;
+    std::mt19937 rd(2024);
+    std::vector<std::string> names(nbatch * nfile);
+    for (std::string& n : names) {
+        n = std::string(words[rd() % 20]) + '_' + words[rd() % 20] + '_';
+        for (size_t i = 0; i < 8; ++i)
+            n.push_back("0123456789abcdefghijklmnopqrstuvwxyz"[rd() % 36]);
+        n += exts[rd() % 8];
+    }
+
+    auto path = std::filesystem::temp_directory_path() /
+                ("trigramFalsePos" + std::to_string(bits));
+    {
+        arr2d_writer writer(path.native());
+        trigram_placer placer;
+        placer.reset(bits);
+        for (size_t i = 0; i < names.size(); ++i) {
+            placer.place(orie::str_t(names[i].begin(), names[i].end()),
+                         i / nfile, writer);
+            if (i % (nfile * 2000) == nfile * 2000 - 1)
+                writer.append_pending_to_file();
+        }
+        writer.append_pending_to_file();
+    }
+    arr2d_reader reader(path.native());
+    reader._rmfile_on_dtor = true;
+
+    // Intersect all trigrams, unlike `trigram_query`, which stops when one
+    // batch is left in a page, so that only the index is measured
+    arr2d_intersect query(&reader);
+    size_t ncandidate = 0, nfalse = 0;
+    std::mt19937 needle_rd(7);
+    for (size_t q = 0; q < 300; ++q) {
+        const std::string& from = names[needle_rd() % names.size()];
+        size_t len = 5 + needle_rd() % 4;
+        size_t at = in_ids ? from.rfind('_') + 1 + needle_rd() % (9 - len)
+                           : needle_rd() % (from.size() - len);
+        std::string needle = from.substr(at, len);
+        orie::str_t native(needle.begin(), needle.end());
+        query._lines_to_query.resize(32);
+        query._lines_to_query.resize(strstr_trigram_ext(
+            native, query._lines_to_query.data(), 32, bits));
+        query.rewind();
+        for (uint32_t b; (b = query.next_intersect()) != ~uint32_t(); ) {
+            ++ncandidate;
+            nfalse += std::none_of(names.begin() + b * nfile,
+                                   names.begin() + (b + 1) * nfile,
+                [&needle] (const std::string& n) {
+                    return n.find(needle) != n.npos; });
+        }
+    }
+    return double(nfalse) / double(ncandidate);
+}
+
+TEST(trigramSearch, falsePositiveBatches) {
+    for (bool in_ids : { true, false }) {
+        double hashed = _false_positive_rate(default_trigram_bits, in_ids);
+        double exact = _false_positive_rate(exact_trigram_bits, in_ids);
+        std::cout << "Batches scanned in vain, needles from "
+                  << (in_ids ? "ids: " : "names: ") << hashed * 100
+                  << "% with " << default_trigram_bits << " bit trigrams, "
+                  << exact * 100 << "% with " << exact_trigram_bits
+                  << " bit trigrams" << std::endl;
+        EXPECT_LT(exact, hashed);
+    }
+}
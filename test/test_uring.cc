@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <orient/util/uring.hpp>
+
+#ifdef __linux__
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+struct uringTest : public testing::Test {
+    std::filesystem::path tmpPath;
+    // More requests than the queue depth of 4 used below
+    std::vector<std::string> names;
+    std::vector<const char*> names_c;
+    int dirfd;
+
+    uringTest() : tmpPath(std::filesystem::temp_directory_path() /
+                          ("uringTest" + std::to_string(std::random_device()()))) {
+        std::filesystem::create_directories(tmpPath);
+        for (int i = 0; i < 20; ++i) {
+            names.push_back("f" + std::to_string(i));
+            if (i % 2)
+                std::filesystem::create_directory(tmpPath / names.back());
+            else std::ofstream(tmpPath / names.back());
+        }
+        names.push_back("nonexistent");
+        for (const std::string& n : names)
+            names_c.push_back(n.c_str());
+        dirfd = ::open(tmpPath.c_str(), O_RDONLY | O_DIRECTORY);
+    }
+
+    ~uringTest() {
+        ::close(dirfd);
+        std::filesystem::remove_all(tmpPath);
+    }
+};
+
+TEST_F(uringTest, openat) {
+    orie::uring ring(4);
+    if (!ring.ok())
+        GTEST_SKIP() << "io_uring unavailable";
+    std::vector<int> fds;
+    ASSERT_TRUE(ring.openat_all(dirfd, names_c, O_RDONLY | O_DIRECTORY, fds));
+    ASSERT_EQ(fds.size(), names.size());
+    for (size_t i = 0; i < 20; ++i) {
+        if (i % 2) {
+            EXPECT_GE(fds[i], 0);
+            ::close(fds[i]);
+        } else EXPECT_EQ(fds[i], -ENOTDIR);
+    }
+    EXPECT_EQ(fds.back(), -ENOENT);
+}
+
+TEST_F(uringTest, statx) {
+    orie::uring ring(4);
+    if (!ring.ok())
+        GTEST_SKIP() << "io_uring unavailable";
+    std::vector<struct statx> bufs;
+    std::vector<int> rets;
+    ASSERT_TRUE(ring.statx_all(dirfd, names_c, 0, STATX_TYPE, bufs, rets));
+    ASSERT_EQ(rets.size(), names.size());
+    for (size_t i = 0; i < 20; ++i) {
+        ASSERT_EQ(rets[i], 0);
+        EXPECT_EQ(S_ISDIR(bufs[i].stx_mode), i % 2 == 1);
+    }
+    EXPECT_EQ(rets.back(), -ENOENT);
+}
+#endif